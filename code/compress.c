@@ -0,0 +1,178 @@
+#include "zmodule.h"
+#include "compress.h"
+
+struct _compress_ctx
+{
+    lz_enc_t* lz;
+    CLzmaEncHandle lzma;
+    CLzmaDec dec;
+};
+
+compress_ctx_t* compress_ctx_create(void)
+{
+    compress_ctx_t* ctx = (compress_ctx_t*)memory_alloc(sizeof(compress_ctx_t));
+
+    if (ctx != NULL) {
+        lzma_dec_init(&ctx->dec);
+    }
+    return ctx;
+}
+
+void compress_ctx_destroy(compress_ctx_t* ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+    lz_enc_destroy(ctx->lz);
+    lzma_enc_destroy(ctx->lzma);
+    lzma_dec_free(&ctx->dec);
+    memory_free(ctx);
+}
+
+size_t compress_bound(size_t srcLen)
+{
+    // Whatever does not shrink is stored, so no codec ever needs more.
+    return COMPRESS_HEADER_SIZE + srcLen;
+}
+
+static int compress_encode_payload(compress_ctx_t* ctx, uint8_t codec, int level, uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen)
+{
+    CLzmaEncProps props;
+    size_t propsSize = LZMA_PROPS_SIZE;
+    size_t packSize;
+    int res;
+
+    switch (codec) {
+        case COMPRESS_CODEC_STORED:
+            return SZ_ERROR_OUTPUT_EOF;
+
+        case COMPRESS_CODEC_LZ:
+            if (ctx->lz == NULL && (ctx->lz = lz_enc_create()) == NULL) {
+                return SZ_ERROR_MEM;
+            }
+            return lz_enc_encode(ctx->lz, dest, destLen, src, srcLen);
+
+        case COMPRESS_CODEC_LZMA:
+            if (ctx->lzma == NULL && (ctx->lzma = lzma_enc_create()) == NULL) {
+                return SZ_ERROR_MEM;
+            }
+            lzma_encprops_init(&props);
+            if (level >= 0) {
+                props.level = level;
+            }
+            RINOK(lzma_enc_set_props(ctx->lzma, &props));
+            if (*destLen < LZMA_PROPS_SIZE) {
+                return SZ_ERROR_OUTPUT_EOF;
+            }
+            packSize = *destLen - LZMA_PROPS_SIZE;
+            res = lzma_enc_encode(ctx->lzma, dest + LZMA_PROPS_SIZE, &packSize, src, srcLen, dest, &propsSize);
+            *destLen = LZMA_PROPS_SIZE + packSize;
+            return res;
+    }
+    return SZ_ERROR_UNSUPPORTED;
+}
+
+int compress_encode(compress_ctx_t* ctx, uint8_t codec, int level, uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen)
+{
+    compress_ctx_t* tmp = NULL;
+    size_t cap, packSize;
+    int res;
+
+    if (codec > COMPRESS_CODEC_LZMA) {
+        return SZ_ERROR_UNSUPPORTED;
+    }
+    if (srcLen > (uint32_t)-1) {
+        return SZ_ERROR_PARAM;
+    }
+    if (*destLen < COMPRESS_HEADER_SIZE) {
+        return SZ_ERROR_OUTPUT_EOF;
+    }
+    if (ctx == NULL && (ctx = tmp = compress_ctx_create()) == NULL) {
+        return SZ_ERROR_MEM;
+    }
+
+    // The payload is only worth keeping when it is smaller than the input itself.
+    cap = *destLen - COMPRESS_HEADER_SIZE;
+    packSize = (srcLen != 0 && srcLen - 1 < cap) ? srcLen - 1 : cap;
+    res = (srcLen != 0) ? compress_encode_payload(ctx, codec, level, dest + COMPRESS_HEADER_SIZE, &packSize, src, srcLen) : SZ_ERROR_OUTPUT_EOF;
+    compress_ctx_destroy(tmp);
+
+    if (res == SZ_ERROR_OUTPUT_EOF) {
+        if (cap < srcLen) {
+            return SZ_ERROR_OUTPUT_EOF;
+        }
+        codec = COMPRESS_CODEC_STORED;
+        __movsb(dest + COMPRESS_HEADER_SIZE, src, srcLen);
+        packSize = srcLen;
+    }
+    else if (res != SZ_OK) {
+        return res;
+    }
+
+    dest[0] = codec;
+    *(uint32_t*)(dest + 1) = (uint32_t)srcLen;
+    *destLen = COMPRESS_HEADER_SIZE + packSize;
+    return SZ_OK;
+}
+
+int compress_decoded_size(const uint8_t* src, size_t srcLen, size_t* size)
+{
+    if (srcLen < COMPRESS_HEADER_SIZE) {
+        return SZ_ERROR_INPUT_EOF;
+    }
+    *size = *(const uint32_t*)(src + 1);
+    return SZ_OK;
+}
+
+int compress_decode(compress_ctx_t* ctx, uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen)
+{
+    CLzmaDec dec;
+    ELzmaStatus status;
+    size_t size, outSize, packSize;
+    int res;
+
+    RINOK(compress_decoded_size(src, srcLen, &size));
+    if (*destLen < size) {
+        return SZ_ERROR_OUTPUT_EOF;
+    }
+    packSize = srcLen - COMPRESS_HEADER_SIZE;
+    src += COMPRESS_HEADER_SIZE;
+    outSize = size;
+
+    switch (src[-COMPRESS_HEADER_SIZE]) {
+        case COMPRESS_CODEC_STORED:
+            if (packSize != size) {
+                return SZ_ERROR_DATA;
+            }
+            __movsb(dest, src, size);
+            res = SZ_OK;
+            break;
+
+        case COMPRESS_CODEC_LZ:
+            res = lz_decode(dest, &outSize, src, packSize);
+            break;
+
+        case COMPRESS_CODEC_LZMA:
+            if (ctx != NULL) {
+                res = lzma_dec_decode_buffer(&ctx->dec, dest, &outSize, src, packSize, &status);
+            }
+            else {
+                lzma_dec_init(&dec);
+                res = lzma_dec_decode_buffer(&dec, dest, &outSize, src, packSize, &status);
+                lzma_dec_free(&dec);
+            }
+            break;
+
+        default:
+            return SZ_ERROR_UNSUPPORTED;
+    }
+
+    if (res == SZ_OK && outSize != size) {
+        res = SZ_ERROR_DATA;
+    }
+    if (res != SZ_OK) {
+        return res;
+    }
+    *destLen = size;
+    return SZ_OK;
+}
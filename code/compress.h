@@ -0,0 +1,87 @@
+#ifndef __0LIB_COMPRESS_H_
+#define __0LIB_COMPRESS_H_
+
+/* One framing for all codecs, so that the reading side does not need to know
+   which one the writing side picked. A frame is
+
+     uint8_t  codec            COMPRESS_CODEC_*
+     uint32_t size             decoded size
+     payload                   as produced by the codec
+
+   An input the chosen codec does not shrink is framed as COMPRESS_CODEC_STORED.
+   Return codes are those of lzma.h. */
+
+#define COMPRESS_CODEC_STORED 0
+#define COMPRESS_CODEC_LZ 1     /* lz.h: hundreds of MB/s to compress, GB/s to decompress */
+#define COMPRESS_CODEC_LZMA 2   /* lzma.h: a far better ratio at a fraction of the speed */
+
+#define COMPRESS_HEADER_SIZE 5
+
+typedef struct _compress_ctx compress_ctx_t;
+
+/* Keeps the encoders and the decoder state between calls. Every function below also
+   takes ctx = NULL, and then sets up what it needs for that one call. A context is
+   not to be shared between threads. */
+compress_ctx_t* compress_ctx_create(void);
+void compress_ctx_destroy(compress_ctx_t* ctx);
+
+size_t compress_bound(size_t srcLen);
+
+/* level applies to LZMA only (0..9, -1 for the default). */
+int compress_encode(compress_ctx_t* ctx, uint8_t codec, int level, uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen);
+int compress_decoded_size(const uint8_t* src, size_t srcLen, size_t* size);
+int compress_decode(compress_ctx_t* ctx, uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen);
+
+// Benchmark
+
+#ifdef COMPRESS_BENCHMARK
+
+/* Time spent on each measurement, at least one run is always made. */
+#ifndef COMPRESS_BENCHMARK_MS
+#define COMPRESS_BENCHMARK_MS 250
+#endif
+
+/* Size of each generated corpus. */
+#ifndef COMPRESS_BENCHMARK_SIZE
+#define COMPRESS_BENCHMARK_SIZE ((size_t)1 << 22)
+#endif
+
+/* Block size for the parallel runs, small enough to give every thread work. */
+#ifndef COMPRESS_BENCHMARK_MT_BLOCK_SIZE
+#define COMPRESS_BENCHMARK_MT_BLOCK_SIZE ((uint32_t)1 << 18)
+#endif
+
+#define COMPRESS_BENCHMARK_LZ 0x01      /* LZ codec */
+#define COMPRESS_BENCHMARK_LZMA 0x02    /* LZMA at every level 0..9 */
+#define COMPRESS_BENCHMARK_MT 0x04      /* block-parallel LZMA at 1, 2, 4 .. threads up to the processor count */
+#define COMPRESS_BENCHMARK_ALL 0x07
+
+typedef struct _compress_corpus
+{
+    const char* name;
+    const uint8_t* data;
+    size_t size;
+} compress_corpus_t;
+
+/* Runs the codecs over every corpus and writes the results to buf as JSON (NUL
+   terminated), one object per measurement:
+
+     {"corpus":"text","size":4194304,"codec":"lzma","level":5,"threads":1,"packed":...,
+      "ratio":3.41,"enc_ms":...,"enc_in_mb_per_s":...,"enc_out_mb_per_s":...,
+      "dec_ms":...,"dec_in_mb_per_s":...,"dec_out_mb_per_s":...}
+
+   "in" and "out" are the uncompressed and compressed sides when encoding, and the
+   other way round when decoding. Built with MEMORY_STATS, each object also has
+   "enc_peak_kb" and "dec_peak_kb", the most memory held during a run above what
+   was held before it. Every output is decoded and compared with its input, a
+   mismatch gives "error" in place of the figures.
+
+   corpora = NULL runs over generated text, JSON, binary records and random bytes
+   of COMPRESS_BENCHMARK_SIZE each. Standard corpus files are loaded by the caller
+   and passed in. *bufLen is the size of buf on input and the length of the text on
+   output; SZ_ERROR_OUTPUT_EOF means buf was too small. */
+int compress_benchmark(char* buf, size_t* bufLen, const compress_corpus_t* corpora, uint32_t numCorpora, uint32_t groups);
+
+#endif // COMPRESS_BENCHMARK
+
+#endif // __0LIB_COMPRESS_H_
@@ -0,0 +1,434 @@
+#include "zmodule.h"
+#include "compress.h"
+
+#ifdef COMPRESS_BENCHMARK
+
+#define COMPRESS_BENCHMARK_NUM_SYNTHETIC 4
+
+/* JSON output, the first error sticks. */
+typedef struct _compress_bench_out
+{
+    char* p;
+    size_t n;
+    int count;
+    int res;
+} compress_bench_out_t;
+
+#define COMPRESS_BENCH_PRINT(out, ARGS) \
+{ \
+    int len_; \
+    if ((out)->res == SZ_OK) { \
+        len_ = fn__snprintf ARGS; \
+        if (len_ < 0 || (size_t)len_ >= (out)->n) { \
+            (out)->res = SZ_ERROR_OUTPUT_EOF; \
+        } \
+        else { \
+            (out)->p += len_; \
+            (out)->n -= len_; \
+        } \
+    } \
+}
+
+/* Fixed point value with two decimals. */
+#define COMPRESS_BENCH_FIX2(x) (uint32_t)((x) / 100), (uint32_t)((x) % 100)
+
+/* One codec setting over one corpus. threads = 0 goes through compress_encode()
+   and compress_decode(), anything else through the block-parallel format. */
+typedef struct _compress_bench_run
+{
+    uint8_t codec;
+    int level;
+    uint32_t threads;
+    compress_ctx_t* ctx;
+    const uint8_t* src;
+    size_t srcLen;
+    uint8_t* packed;
+    size_t packedCap;
+    size_t packedLen;
+    uint8_t* out;
+} compress_bench_run_t;
+
+typedef int (*compress_bench_fn)(compress_bench_run_t* r);
+
+typedef struct _compress_bench_time
+{
+    uint64_t runs;
+    uint64_t us;
+    size_t peak;
+} compress_bench_time_t;
+
+static const char* compress_bench_words[64] = {
+    "the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was", "with", "be", "by", "on",
+    "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had", "they", "you", "were",
+    "their", "one", "all", "we", "can", "her", "has", "there", "been", "if", "more", "when", "will", "would", "who", "so",
+    "request", "server", "buffer", "window", "stream", "thread", "memory", "handle", "record", "value", "length", "offset", "status", "network", "socket", "cache"
+};
+
+static uint32_t compress_bench_rand(uint32_t* seed)
+{
+    uint32_t x = *seed;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *seed = x;
+}
+
+/* Skewed towards the first words, the way word frequencies are. */
+static const char* compress_bench_word(uint32_t r)
+{
+    return compress_bench_words[((r & 63) * ((r >> 6) & 63)) >> 6];
+}
+
+static uint8_t* compress_bench_put(uint8_t* p, uint8_t* end, const char* s, size_t len)
+{
+    if (len > (size_t)(end - p)) {
+        len = (size_t)(end - p);
+    }
+    __movsb(p, (const uint8_t*)s, len);
+    return p + len;
+}
+
+static void compress_bench_text(uint8_t* p, size_t size, uint32_t seed)
+{
+    uint8_t* end = p + size;
+    const char* w;
+    uint32_t r;
+
+    while (p < end) {
+        r = compress_bench_rand(&seed);
+        w = compress_bench_word(r);
+        p = compress_bench_put(p, end, w, fn_lstrlenA(w));
+        r >>= 12;
+        if (r % 61 == 0) {
+            p = compress_bench_put(p, end, ".\n", 2);
+        }
+        else if (r % 11 == 0) {
+            p = compress_bench_put(p, end, ". ", 2);
+        }
+        else if (r % 17 == 0) {
+            p = compress_bench_put(p, end, ", ", 2);
+        }
+        else {
+            p = compress_bench_put(p, end, " ", 1);
+        }
+    }
+}
+
+static void compress_bench_json(uint8_t* p, size_t size, uint32_t seed)
+{
+    uint8_t* end = p + size;
+    char rec[256];
+    uint32_t id = 1000, ts = 1500000000, r, r2;
+    int len;
+
+    p = compress_bench_put(p, end, "[\n", 2);
+    while (p < end) {
+        r = compress_bench_rand(&seed);
+        r2 = compress_bench_rand(&seed);
+        id += 1 + (r & 3);
+        ts += r2 & 1023;
+        len = fn__snprintf(rec, sizeof(rec),
+            "  {\"id\":%u,\"user\":\"%s_%s\",\"active\":%s,\"score\":%u.%02u,\"tags\":[\"%s\",\"%s\"],\"ts\":%u},\n",
+            id, compress_bench_word(r), compress_bench_word(r >> 12), (r & 0x100000) ? "true" : "false",
+            (r2 >> 10) % 1000, (r2 >> 20) % 100, compress_bench_word(r2), compress_bench_word(r2 >> 12), ts);
+        if (len <= 0 || (size_t)len >= sizeof(rec)) {
+            break;
+        }
+        p = compress_bench_put(p, end, rec, (size_t)len);
+    }
+}
+
+/* Fixed-size records of counters, small enums, a random walk, a random word and a
+   zero-padded name, as found in logs and tables. */
+static void compress_bench_binary(uint8_t* p, size_t size, uint32_t seed)
+{
+    uint8_t* end = p + size;
+    uint8_t rec[32];
+    uint32_t id = 0, ts = 1500000000, r;
+    int32_t value = 0;
+    const char* w;
+
+    while (p < end) {
+        r = compress_bench_rand(&seed);
+        __stosb(rec, 0, sizeof(rec));
+        *(uint32_t*)(rec + 0) = ++id;
+        *(uint32_t*)(rec + 4) = ts += r & 255;
+        *(uint16_t*)(rec + 8) = (uint16_t)((r >> 8) & 7);
+        *(uint16_t*)(rec + 10) = (uint16_t)((r >> 11) & 0x0101);
+        *(int32_t*)(rec + 12) = value += (int32_t)((r >> 16) & 255) - 128;
+        *(uint32_t*)(rec + 16) = compress_bench_rand(&seed);
+        w = compress_bench_word(r >> 20);
+        __movsb(rec + 20, (const uint8_t*)w, fn_lstrlenA(w));
+        p = compress_bench_put(p, end, (const char*)rec, sizeof(rec));
+    }
+}
+
+static void compress_bench_random(uint8_t* p, size_t size, uint32_t seed)
+{
+    size_t i;
+
+    for (i = 0; i + 4 <= size; i += 4) {
+        *(uint32_t*)(p + i) = compress_bench_rand(&seed);
+    }
+    for ( ; i < size; ++i) {
+        p[i] = (uint8_t)compress_bench_rand(&seed);
+    }
+}
+
+static uint64_t compress_bench_ticks(void)
+{
+    LARGE_INTEGER t;
+
+    fn_QueryPerformanceCounter(&t);
+    return (uint64_t)t.QuadPart;
+}
+
+static int compress_bench_encode(compress_bench_run_t* r)
+{
+    CLzmaEncProps props;
+    size_t len = r->packedCap;
+    int res;
+
+    if (r->threads == 0) {
+        res = compress_encode(r->ctx, r->codec, r->level, r->packed, &len, r->src, r->srcLen);
+    }
+    else {
+        lzma_encprops_init(&props);
+        props.level = r->level;
+        res = lzma_mt_encode(r->packed, &len, r->src, r->srcLen, &props, COMPRESS_BENCHMARK_MT_BLOCK_SIZE, r->threads);
+    }
+    r->packedLen = len;
+    return res;
+}
+
+static int compress_bench_decode(compress_bench_run_t* r)
+{
+    size_t len = r->srcLen;
+    int res;
+
+    if (r->threads == 0) {
+        res = compress_decode(r->ctx, r->out, &len, r->packed, r->packedLen);
+    }
+    else {
+        res = lzma_mt_decode(r->out, &len, r->packed, r->packedLen, r->threads);
+    }
+    if (res == SZ_OK && len != r->srcLen) {
+        res = SZ_ERROR_DATA;
+    }
+    return res;
+}
+
+/* The first run also measures memory. When it alone is shorter than COMPRESS_BENCHMARK_MS
+   the figures come from the runs after it, until that much time has passed. */
+static int compress_bench_time(compress_bench_fn fn, compress_bench_run_t* r, uint64_t freq, compress_bench_time_t* t)
+{
+    uint64_t start, ticks;
+    int res;
+#ifdef MEMORY_STATS
+    size_t base, cur, peak;
+
+    memory_stats_reset();
+    memory_stats(&base, &peak);
+#endif // MEMORY_STATS
+
+    start = compress_bench_ticks();
+    res = fn(r);
+    ticks = compress_bench_ticks() - start;
+    t->runs = 1;
+#ifdef MEMORY_STATS
+    memory_stats(&cur, &peak);
+    t->peak = peak - base;
+#else
+    t->peak = 0;
+#endif // MEMORY_STATS
+    RINOK(res);
+
+    if (ticks * 1000 < freq * COMPRESS_BENCHMARK_MS) {
+        t->runs = 0;
+        start = compress_bench_ticks();
+        do {
+            RINOK(fn(r));
+            ++t->runs;
+            ticks = compress_bench_ticks() - start;
+        } while (ticks * 1000 < freq * COMPRESS_BENCHMARK_MS);
+    }
+
+    t->us = ticks * 1000000 / freq;
+    if (t->us == 0) {
+        t->us = 1;
+    }
+    return SZ_OK;
+}
+
+/* MB/s, times 100. */
+static uint64_t compress_bench_rate(size_t bytes, const compress_bench_time_t* t)
+{
+    return (uint64_t)bytes * t->runs * 100000000 / (t->us * 1048576);
+}
+
+static void compress_bench_measure(compress_bench_out_t* out, const compress_corpus_t* corpus, compress_bench_run_t* r, uint64_t freq)
+{
+    compress_bench_time_t enc, dec;
+    const char* name = (r->threads != 0) ? "lzma-mt" : (r->codec == COMPRESS_CODEC_LZ) ? "lz" : "lzma";
+    char level[16];
+    int res;
+
+    if (r->codec == COMPRESS_CODEC_LZ) {
+        fn__snprintf(level, sizeof(level), "null");
+    }
+    else {
+        fn__snprintf(level, sizeof(level), "%d", r->level);
+    }
+
+    r->ctx = NULL;
+    if (r->threads == 0 && (r->ctx = compress_ctx_create()) == NULL) {
+        res = SZ_ERROR_MEM;
+    }
+    else if ((res = compress_bench_time(compress_bench_encode, r, freq, &enc)) == SZ_OK &&
+             (res = compress_bench_time(compress_bench_decode, r, freq, &dec)) == SZ_OK &&
+             fn_RtlCompareMemory(r->out, r->src, r->srcLen) != r->srcLen) {
+        res = SZ_ERROR_DATA;
+    }
+    compress_ctx_destroy(r->ctx);
+
+    COMPRESS_BENCH_PRINT(out, (out->p, out->n,
+        "%s\n    {\"corpus\":\"%s\",\"size\":%u,\"codec\":\"%s\",\"level\":%s,\"threads\":%u,",
+        out->count++ ? "," : "", corpus->name, (uint32_t)corpus->size, name, level, r->threads ? r->threads : 1));
+
+    if (res != SZ_OK) {
+        COMPRESS_BENCH_PRINT(out, (out->p, out->n, "\"error\":%d}", res));
+        return;
+    }
+
+    COMPRESS_BENCH_PRINT(out, (out->p, out->n,
+        "\"packed\":%u,\"ratio\":%u.%02u,"
+        "\"enc_ms\":%u,\"enc_in_mb_per_s\":%u.%02u,\"enc_out_mb_per_s\":%u.%02u,"
+        "\"dec_ms\":%u,\"dec_in_mb_per_s\":%u.%02u,\"dec_out_mb_per_s\":%u.%02u",
+        (uint32_t)r->packedLen, COMPRESS_BENCH_FIX2((uint64_t)r->srcLen * 100 / r->packedLen),
+        (uint32_t)(enc.us / 1000), COMPRESS_BENCH_FIX2(compress_bench_rate(r->srcLen, &enc)), COMPRESS_BENCH_FIX2(compress_bench_rate(r->packedLen, &enc)),
+        (uint32_t)(dec.us / 1000), COMPRESS_BENCH_FIX2(compress_bench_rate(r->packedLen, &dec)), COMPRESS_BENCH_FIX2(compress_bench_rate(r->srcLen, &dec))));
+#ifdef MEMORY_STATS
+    COMPRESS_BENCH_PRINT(out, (out->p, out->n, ",\"enc_peak_kb\":%u,\"dec_peak_kb\":%u",
+        (uint32_t)(enc.peak >> 10), (uint32_t)(dec.peak >> 10)));
+#endif // MEMORY_STATS
+    COMPRESS_BENCH_PRINT(out, (out->p, out->n, "}"));
+}
+
+static void compress_bench_corpus(compress_bench_out_t* out, const compress_corpus_t* corpus, uint32_t groups, uint32_t numProcessors, uint64_t freq)
+{
+    compress_bench_run_t r;
+    size_t mtCap;
+    int level;
+
+    __stosb((uint8_t*)&r, 0, sizeof(r));
+    r.src = corpus->data;
+    r.srcLen = corpus->size;
+    r.packedCap = compress_bound(corpus->size);
+    mtCap = lzma_mt_bound(corpus->size, COMPRESS_BENCHMARK_MT_BLOCK_SIZE);
+    if (r.packedCap < mtCap) {
+        r.packedCap = mtCap;
+    }
+    r.packed = (uint8_t*)memory_alloc(r.packedCap);
+    r.out = (uint8_t*)memory_alloc(corpus->size + 1);
+    if (r.packed == NULL || r.out == NULL) {
+        out->res = SZ_ERROR_MEM;
+        goto exit;
+    }
+
+    if (groups & COMPRESS_BENCHMARK_LZ) {
+        r.codec = COMPRESS_CODEC_LZ;
+        r.level = -1;
+        compress_bench_measure(out, corpus, &r, freq);
+    }
+
+    if (groups & COMPRESS_BENCHMARK_LZMA) {
+        r.codec = COMPRESS_CODEC_LZMA;
+        for (level = 0; level <= 9 && out->res == SZ_OK; ++level) {
+            r.level = level;
+            compress_bench_measure(out, corpus, &r, freq);
+        }
+    }
+
+    // Thread counts double up to the processor count, which is always included.
+    if (groups & COMPRESS_BENCHMARK_MT) {
+        r.codec = COMPRESS_CODEC_LZMA;
+        r.level = 5;
+        for (r.threads = 1; out->res == SZ_OK; r.threads = (r.threads * 2 < numProcessors) ? r.threads * 2 : numProcessors) {
+            compress_bench_measure(out, corpus, &r, freq);
+            if (r.threads >= numProcessors) {
+                break;
+            }
+        }
+    }
+
+exit:
+    memory_free(r.packed);
+    memory_free(r.out);
+}
+
+int compress_benchmark(char* buf, size_t* bufLen, const compress_corpus_t* corpora, uint32_t numCorpora, uint32_t groups)
+{
+    compress_bench_out_t out;
+    compress_corpus_t synthetic[COMPRESS_BENCHMARK_NUM_SYNTHETIC];
+    SYSTEM_INFO si;
+    LARGE_INTEGER freq;
+    uint32_t i, numProcessors;
+
+    out.p = buf;
+    out.n = *bufLen;
+    out.count = 0;
+    out.res = SZ_OK;
+
+    fn_QueryPerformanceFrequency(&freq);
+    fn_GetSystemInfo(&si);
+    numProcessors = si.dwNumberOfProcessors;
+    if (numProcessors > LZMA_MT_MAX_THREADS) {
+        numProcessors = LZMA_MT_MAX_THREADS;
+    }
+
+    __stosb((uint8_t*)synthetic, 0, sizeof(synthetic));
+    if (corpora == NULL) {
+        synthetic[0].name = "text";
+        synthetic[1].name = "json";
+        synthetic[2].name = "binary";
+        synthetic[3].name = "random";
+        for (i = 0; i < COMPRESS_BENCHMARK_NUM_SYNTHETIC; ++i) {
+            if ((synthetic[i].data = (const uint8_t*)memory_alloc(COMPRESS_BENCHMARK_SIZE)) == NULL) {
+                out.res = SZ_ERROR_MEM;
+                goto exit;
+            }
+            synthetic[i].size = COMPRESS_BENCHMARK_SIZE;
+        }
+        compress_bench_text((uint8_t*)synthetic[0].data, COMPRESS_BENCHMARK_SIZE, 0x2545F491);
+        compress_bench_json((uint8_t*)synthetic[1].data, COMPRESS_BENCHMARK_SIZE, 0x9E3779B9);
+        compress_bench_binary((uint8_t*)synthetic[2].data, COMPRESS_BENCHMARK_SIZE, 0x7F4A7C15);
+        compress_bench_random((uint8_t*)synthetic[3].data, COMPRESS_BENCHMARK_SIZE, 0x1B873593);
+        corpora = synthetic;
+        numCorpora = COMPRESS_BENCHMARK_NUM_SYNTHETIC;
+    }
+
+    COMPRESS_BENCH_PRINT(&out, (out.p, out.n, "{\n  \"ms\":%u,\n  \"processors\":%u,\n  \"results\":[",
+        COMPRESS_BENCHMARK_MS, numProcessors));
+
+    for (i = 0; i < numCorpora && out.res == SZ_OK; ++i) {
+        // An empty corpus has no ratio to speak of.
+        if (corpora[i].size != 0) {
+            compress_bench_corpus(&out, &corpora[i], groups, numProcessors, (uint64_t)freq.QuadPart);
+        }
+    }
+
+    COMPRESS_BENCH_PRINT(&out, (out.p, out.n, "\n  ]\n}\n"));
+
+exit:
+    for (i = 0; i < COMPRESS_BENCHMARK_NUM_SYNTHETIC; ++i) {
+        memory_free((void*)synthetic[i].data);
+    }
+    if (out.res != SZ_OK) {
+        return out.res;
+    }
+    *bufLen = *bufLen - out.n;
+    return SZ_OK;
+}
+
+#endif // COMPRESS_BENCHMARK
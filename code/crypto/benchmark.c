@@ -0,0 +1,615 @@
+#include "..\zmodule.h"
+#include "config.h"
+
+#if defined(POLARSSL_BENCHMARK_C)
+
+#include "benchmark.h"
+#include "timing.h"
+#include "aes.h"
+#include "sha256.h"
+#include "sha512.h"
+#include "crc64.h"
+#include "base64.h"
+#include "bignum.h"
+#include "rsa.h"
+#include "ecdh.h"
+#include "entropy.h"
+#include "ctr_drbg.h"
+#include "pk.h"
+#include "x509_crt.h"
+#include "ssl.h"
+
+#define BENCHMARK_MAX_LEN   16384
+
+static const size_t benchmark_sizes[] = { 64, 1024, BENCHMARK_MAX_LEN };
+
+/*
+ * JSON output, the first error sticks
+ */
+typedef struct
+{
+    char *p;
+    size_t n;
+    int count;
+    int ret;
+}
+benchmark_out;
+
+#define BENCHMARK_PRINT( out, ARGS )                                        \
+{                                                                           \
+    int len_;                                                               \
+    if( (out)->ret == 0 )                                                   \
+    {                                                                       \
+        len_ = fn__snprintf ARGS;                                           \
+        if( len_ < 0 || (size_t) len_ >= (out)->n )                         \
+            (out)->ret = POLARSSL_ERR_BENCHMARK_BUFFER_TOO_SMALL;           \
+        else                                                                \
+        {                                                                   \
+            (out)->p += len_;                                               \
+            (out)->n -= len_;                                               \
+        }                                                                   \
+    }                                                                       \
+}
+
+/*
+ * Fixed point value with two decimals
+ */
+#define BENCHMARK_FIX2( x )     (uint32_t) ( (x) / 100 ), (uint32_t) ( (x) % 100 )
+
+typedef int (*benchmark_fn)( void *ctx, uint8_t *buf, size_t len );
+
+/*
+ * Run fn over len bytes for BENCHMARK_MS and report cycles per byte
+ */
+static void benchmark_bytes( benchmark_out *out, const char *name,
+                             benchmark_fn fn, void *ctx,
+                             uint8_t *buf, size_t len )
+{
+    struct hr_time t;
+    uint64_t iterations = 0, cycles, bytes;
+    ulong_t ms;
+    int ret = 0;
+
+    fn( ctx, buf, len );                /* warm up */
+
+    get_timer( &t, 1 );
+    cycles = __rdtsc();
+
+    do
+    {
+        ret |= fn( ctx, buf, len );
+        iterations++;
+    }
+    while( ( ms = get_timer( &t, 0 ) ) < BENCHMARK_MS );
+
+    cycles = __rdtsc() - cycles;
+    bytes = iterations * len;
+
+    if( ret != 0 )
+    {
+        BENCHMARK_PRINT( out, ( out->p, out->n,
+            "%s\n    {\"name\":\"%s\",\"size\":%u,\"error\":%d}",
+            out->count++ ? "," : "", name, (uint32_t) len, ret ) );
+        return;
+    }
+
+    BENCHMARK_PRINT( out, ( out->p, out->n,
+        "%s\n    {\"name\":\"%s\",\"size\":%u,\"iterations\":%I64u,\"ms\":%u,"
+        "\"cycles_per_byte\":%u.%02u,\"mb_per_s\":%u.%02u}",
+        out->count++ ? "," : "", name, (uint32_t) len, iterations, (uint32_t) ms,
+        BENCHMARK_FIX2( cycles * 100 / bytes ),
+        BENCHMARK_FIX2( bytes * 100000 / ( (uint64_t) ms * 1024 * 1024 ) ) ) );
+}
+
+/*
+ * Run fn for BENCHMARK_MS (or at least twice) and report operations per
+ * second
+ */
+static void benchmark_ops( benchmark_out *out, const char *name,
+                           benchmark_fn fn, void *ctx )
+{
+    struct hr_time t;
+    uint64_t iterations = 0;
+    ulong_t ms;
+    int ret = 0;
+
+    get_timer( &t, 1 );
+
+    do
+    {
+        ret |= fn( ctx, NULL, 0 );
+        iterations++;
+    }
+    while( ( ms = get_timer( &t, 0 ) ) < BENCHMARK_MS || iterations < 2 );
+
+    if( ret != 0 )
+    {
+        BENCHMARK_PRINT( out, ( out->p, out->n,
+            "%s\n    {\"name\":\"%s\",\"error\":%d}",
+            out->count++ ? "," : "", name, ret ) );
+        return;
+    }
+
+    if( ms == 0 )
+        ms = 1;
+
+    BENCHMARK_PRINT( out, ( out->p, out->n,
+        "%s\n    {\"name\":\"%s\",\"iterations\":%I64u,\"ms\":%u,"
+        "\"ops_per_s\":%u.%02u}",
+        out->count++ ? "," : "", name, iterations, (uint32_t) ms,
+        BENCHMARK_FIX2( iterations * 100000 / ms ) ) );
+}
+
+/*
+ * Symmetric primitives
+ */
+typedef struct
+{
+    aes_context_t aes;
+    uint8_t iv[16];
+    uint8_t key[32];
+    uint8_t *tmp;
+}
+benchmark_sym;
+
+static int bench_aes_enc( void *ctx, uint8_t *buf, size_t len )
+{
+    benchmark_sym *s = (benchmark_sym *) ctx;
+
+    return( aes_crypt_cbc( &s->aes, AES_ENCRYPT, len, s->iv, buf, buf ) );
+}
+
+static int bench_aes_dec( void *ctx, uint8_t *buf, size_t len )
+{
+    benchmark_sym *s = (benchmark_sym *) ctx;
+
+    return( aes_crypt_cbc( &s->aes, AES_DECRYPT, len, s->iv, buf, buf ) );
+}
+
+static int bench_sha256( void *ctx, uint8_t *buf, size_t len )
+{
+    benchmark_sym *s = (benchmark_sym *) ctx;
+
+    sha256( buf, len, s->tmp, 0 );
+    return( 0 );
+}
+
+static int bench_sha512( void *ctx, uint8_t *buf, size_t len )
+{
+    benchmark_sym *s = (benchmark_sym *) ctx;
+
+    sha512( buf, len, s->tmp, 0 );
+    return( 0 );
+}
+
+static int bench_hmac_sha256( void *ctx, uint8_t *buf, size_t len )
+{
+    benchmark_sym *s = (benchmark_sym *) ctx;
+
+    sha256_hmac( s->key, sizeof( s->key ), buf, len, s->tmp, 0 );
+    return( 0 );
+}
+
+static int bench_hmac_sha384( void *ctx, uint8_t *buf, size_t len )
+{
+    benchmark_sym *s = (benchmark_sym *) ctx;
+
+    sha512_hmac( s->key, sizeof( s->key ), buf, len, s->tmp, 1 );
+    return( 0 );
+}
+
+static int bench_crc64( void *ctx, uint8_t *buf, size_t len )
+{
+    benchmark_sym *s = (benchmark_sym *) ctx;
+
+    *(uint64_t *) s->tmp = crc64( 0, buf, len );
+    return( 0 );
+}
+
+static int bench_base64_enc( void *ctx, uint8_t *buf, size_t len )
+{
+    benchmark_sym *s = (benchmark_sym *) ctx;
+    size_t dlen = BENCHMARK_MAX_LEN * 2;
+
+    return( base64_encode( s->tmp, &dlen, buf, len ) );
+}
+
+static int bench_base64_dec( void *ctx, uint8_t *buf, size_t len )
+{
+    benchmark_sym *s = (benchmark_sym *) ctx;
+    size_t dlen = BENCHMARK_MAX_LEN * 2;
+
+    /* buf holds the encoding of len bytes, see below */
+    return( base64_decode( s->tmp, &dlen, buf, len ) );
+}
+
+static void benchmark_symmetric( benchmark_out *out )
+{
+    benchmark_sym s;
+    uint8_t *buf, *enc;
+    size_t i, elen;
+
+    buf = (uint8_t *) memory_alloc( BENCHMARK_MAX_LEN );
+    enc = (uint8_t *) memory_alloc( BENCHMARK_MAX_LEN * 2 );
+    s.tmp = (uint8_t *) memory_alloc( BENCHMARK_MAX_LEN * 2 );
+
+    __stosb( s.key, 0xA5, sizeof( s.key ) );
+    __stosb( s.iv, 0x5A, sizeof( s.iv ) );
+
+    for( i = 0; i < sizeof( benchmark_sizes ) / sizeof( benchmark_sizes[0] ); i++ )
+    {
+        aes_setkey_enc( &s.aes, s.key );
+        benchmark_bytes( out, "aes-256-cbc-enc", bench_aes_enc, &s, buf, benchmark_sizes[i] );
+        aes_setkey_dec( &s.aes, s.key );
+        benchmark_bytes( out, "aes-256-cbc-dec", bench_aes_dec, &s, buf, benchmark_sizes[i] );
+
+        benchmark_bytes( out, "sha-256", bench_sha256, &s, buf, benchmark_sizes[i] );
+        benchmark_bytes( out, "sha-512", bench_sha512, &s, buf, benchmark_sizes[i] );
+        benchmark_bytes( out, "hmac-sha-256", bench_hmac_sha256, &s, buf, benchmark_sizes[i] );
+        benchmark_bytes( out, "hmac-sha-384", bench_hmac_sha384, &s, buf, benchmark_sizes[i] );
+        benchmark_bytes( out, "crc64", bench_crc64, &s, buf, benchmark_sizes[i] );
+        benchmark_bytes( out, "base64-enc", bench_base64_enc, &s, buf, benchmark_sizes[i] );
+
+        /* Decode the encoding of a buffer of the same size */
+        elen = BENCHMARK_MAX_LEN * 2;
+        if( base64_encode( enc, &elen, buf, benchmark_sizes[i] ) == 0 )
+            benchmark_bytes( out, "base64-dec", bench_base64_dec, &s, enc, elen );
+    }
+
+    memory_free( buf );
+    memory_free( enc );
+    memory_free( s.tmp );
+    __stosb( (uint8_t *) &s, 0, sizeof( s ) );
+}
+
+/*
+ * Public key operations
+ */
+typedef struct
+{
+    rsa_context_t *rsa;
+    ecp_group grp;
+    mpi_t d, z;
+    ecp_point Q, peer;
+    mpi_t A, E, N, X, RR;
+    uint8_t in[512];
+    uint8_t res[512];
+    ctr_drbg_context_t *drbg;
+}
+benchmark_pk;
+
+static int bench_rsa_public( void *ctx, uint8_t *buf, size_t len )
+{
+    benchmark_pk *s = (benchmark_pk *) ctx;
+    ((void) buf); ((void) len);
+
+    return( rsa_public( s->rsa, s->in, s->res ) );
+}
+
+static int bench_rsa_private( void *ctx, uint8_t *buf, size_t len )
+{
+    benchmark_pk *s = (benchmark_pk *) ctx;
+    ((void) buf); ((void) len);
+
+    return( rsa_private( s->rsa, ctr_drbg_random, s->drbg, s->in, s->res ) );
+}
+
+static int bench_ecdh( void *ctx, uint8_t *buf, size_t len )
+{
+    int ret;
+    benchmark_pk *s = (benchmark_pk *) ctx;
+    ((void) buf); ((void) len);
+
+    /* One side of an ephemeral exchange: key generation and shared secret */
+    if( ( ret = ecdh_gen_public( &s->grp, &s->d, &s->Q,
+                                 ctr_drbg_random, s->drbg ) ) != 0 )
+        return( ret );
+
+    return( ecdh_compute_shared( &s->grp, &s->z, &s->peer, &s->d,
+                                 ctr_drbg_random, s->drbg ) );
+}
+
+static int bench_exp_mod( void *ctx, uint8_t *buf, size_t len )
+{
+    benchmark_pk *s = (benchmark_pk *) ctx;
+    ((void) buf); ((void) len);
+
+    return( mpi_exp_mod( &s->X, &s->A, &s->E, &s->N, &s->RR ) );
+}
+
+static void benchmark_rsa( benchmark_out *out, benchmark_pk *s,
+                           pk_context *pk, uint32_t nbits )
+{
+    int ret;
+    char name[32];
+
+    if( ( ret = pk_init_ctx( pk, pk_info_from_type( POLARSSL_PK_RSA ) ) ) != 0 ||
+        ( ret = rsa_gen_key( pk_rsa( *pk ), ctr_drbg_random, s->drbg,
+                             nbits, 65537 ) ) != 0 )
+    {
+        out->ret = ret;
+        return;
+    }
+
+    s->rsa = pk_rsa( *pk );
+    __stosb( s->in, 0x2A, sizeof( s->in ) );
+    s->in[0] = 0;
+
+    fn__snprintf( name, sizeof( name ), "rsa-%u-public", nbits );
+    benchmark_ops( out, name, bench_rsa_public, s );
+    fn__snprintf( name, sizeof( name ), "rsa-%u-private", nbits );
+    benchmark_ops( out, name, bench_rsa_private, s );
+
+    /* Raw modular exponentiation at the modulus size, full size exponent */
+    mpi_copy( &s->N, &s->rsa->N );
+    mpi_fill_random( &s->A, s->rsa->len - 1, ctr_drbg_random, s->drbg );
+    mpi_fill_random( &s->E, s->rsa->len - 1, ctr_drbg_random, s->drbg );
+    mpi_free( &s->RR );
+
+    fn__snprintf( name, sizeof( name ), "mpi-exp-mod-%u", nbits );
+    benchmark_ops( out, name, bench_exp_mod, s );
+}
+
+static void benchmark_public_key( benchmark_out *out, ctr_drbg_context_t *drbg,
+                                  pk_context *pk2048 )
+{
+    benchmark_pk s;
+    pk_context pk4096;
+    const ecp_curve_info *curve;
+    char name[64];
+
+    __stosb( (uint8_t *) &s, 0, sizeof( s ) );
+    s.drbg = drbg;
+    mpi_init( &s.A ); mpi_init( &s.E ); mpi_init( &s.N );
+    mpi_init( &s.X ); mpi_init( &s.RR );
+
+    benchmark_rsa( out, &s, pk2048, 2048 );
+
+    pk_init( &pk4096 );
+    benchmark_rsa( out, &s, &pk4096, 4096 );
+    pk_free( &pk4096 );
+
+    for( curve = ecp_curve_list();
+         curve->grp_id != POLARSSL_ECP_DP_NONE && out->ret == 0;
+         curve++ )
+    {
+        ecp_group_init( &s.grp );
+        mpi_init( &s.d ); mpi_init( &s.z );
+        ecp_point_init( &s.Q ); ecp_point_init( &s.peer );
+
+        if( ecp_use_known_dp( &s.grp, curve->grp_id ) == 0 &&
+            ecdh_gen_public( &s.grp, &s.z, &s.peer,
+                             ctr_drbg_random, drbg ) == 0 )
+        {
+            fn__snprintf( name, sizeof( name ), "ecdh-%s", curve->name );
+            benchmark_ops( out, name, bench_ecdh, &s );
+        }
+
+        ecp_group_free( &s.grp );
+        mpi_free( &s.d ); mpi_free( &s.z );
+        ecp_point_free( &s.Q ); ecp_point_free( &s.peer );
+    }
+
+    mpi_free( &s.A ); mpi_free( &s.E ); mpi_free( &s.N );
+    mpi_free( &s.X ); mpi_free( &s.RR );
+}
+
+/*
+ * Client/server handshakes over memory BIOs
+ */
+typedef struct
+{
+    uint8_t buf[BENCHMARK_MAX_LEN * 2];
+    size_t len;
+}
+benchmark_pipe;
+
+static int benchmark_pipe_recv( void *ctx, uint8_t *buf, size_t len )
+{
+    benchmark_pipe *pipe = (benchmark_pipe *) ctx;
+
+    if( pipe->len == 0 )
+        return( POLARSSL_ERR_NET_WANT_READ );
+
+    if( len > pipe->len )
+        len = pipe->len;
+
+    __movsb( buf, pipe->buf, len );
+    pipe->len -= len;
+    __movsb( pipe->buf, pipe->buf + len, pipe->len );
+
+    return( (int) len );
+}
+
+static int benchmark_pipe_send( void *ctx, const uint8_t *buf, size_t len )
+{
+    benchmark_pipe *pipe = (benchmark_pipe *) ctx;
+
+    if( len > sizeof( pipe->buf ) - pipe->len )
+        len = sizeof( pipe->buf ) - pipe->len;
+
+    if( len == 0 )
+        return( POLARSSL_ERR_NET_WANT_WRITE );
+
+    __movsb( pipe->buf + pipe->len, buf, len );
+    pipe->len += len;
+
+    return( (int) len );
+}
+
+typedef struct
+{
+    ssl_context cli;
+    ssl_context srv;
+    benchmark_pipe to_srv;
+    benchmark_pipe to_cli;
+}
+benchmark_tls;
+
+static int bench_handshake( void *ctx, uint8_t *buf, size_t len )
+{
+    int ret_cli, ret_srv, rounds;
+    benchmark_tls *s = (benchmark_tls *) ctx;
+    ((void) buf); ((void) len);
+
+    s->to_srv.len = s->to_cli.len = 0;
+    ssl_session_reset( &s->cli );
+    ssl_session_reset( &s->srv );
+
+    for( rounds = 0; rounds < 64; rounds++ )
+    {
+        ret_cli = ssl_handshake( &s->cli );
+        if( ret_cli != 0 && ret_cli != POLARSSL_ERR_NET_WANT_READ &&
+            ret_cli != POLARSSL_ERR_NET_WANT_WRITE )
+            return( ret_cli );
+
+        ret_srv = ssl_handshake( &s->srv );
+        if( ret_srv != 0 && ret_srv != POLARSSL_ERR_NET_WANT_READ &&
+            ret_srv != POLARSSL_ERR_NET_WANT_WRITE )
+            return( ret_srv );
+
+        if( ret_cli == 0 && ret_srv == 0 )
+            return( 0 );
+    }
+
+    return( POLARSSL_ERR_SSL_INTERNAL_ERROR );
+}
+
+static void benchmark_handshake( benchmark_out *out, ctr_drbg_context_t *drbg,
+                                 pk_context *key )
+{
+    int ret;
+    benchmark_tls *s;
+    x509write_cert wr;
+    x509_crt crt;
+    mpi_t serial;
+    uint8_t *der;
+
+    x509_crt_init( &crt );
+
+    s = (benchmark_tls *) memory_alloc( sizeof( benchmark_tls ) );
+    der = (uint8_t *) memory_alloc( 4096 );
+
+    x509write_crt_init( &wr );
+    mpi_init( &serial );
+
+    /*
+     * Self-signed server certificate for the 2048-bit key
+     */
+    if( ( ret = mpi_lset( &serial, 1 ) ) != 0 ||
+        ( ret = x509write_crt_set_serial( &wr, &serial ) ) != 0 ||
+        ( ret = x509write_crt_set_validity( &wr, "20010101000000",
+                                                 "20491231235959" ) ) != 0 ||
+        ( ret = x509write_crt_set_subject_name( &wr, "CN=benchmark" ) ) != 0 ||
+        ( ret = x509write_crt_set_issuer_name( &wr, "CN=benchmark" ) ) != 0 )
+        goto cert_done;
+
+    x509write_crt_set_md_alg( &wr, POLARSSL_MD_SHA256 );
+    x509write_crt_set_subject_key( &wr, key );
+    x509write_crt_set_issuer_key( &wr, key );
+
+    if( ( ret = x509write_crt_der( &wr, der, 4096,
+                                   ctr_drbg_random, drbg ) ) < 0 )
+        goto cert_done;
+
+    /* The DER is written at the end of the buffer */
+    ret = x509_crt_parse_der( &crt, der + 4096 - ret, ret );
+
+cert_done:
+    x509write_crt_free( &wr );
+    mpi_free( &serial );
+
+    if( ret != 0 )
+    {
+        out->ret = ret;
+        goto exit;
+    }
+
+    ssl_init( &s->cli );
+    ssl_init( &s->srv );
+
+    ssl_set_endpoint( &s->cli, SSL_IS_CLIENT );
+    ssl_set_authmode( &s->cli, SSL_VERIFY_NONE );
+    ssl_set_rng( &s->cli, ctr_drbg_random, drbg );
+    ssl_set_bio( &s->cli, benchmark_pipe_recv, &s->to_cli,
+                          benchmark_pipe_send, &s->to_srv );
+
+    ssl_set_endpoint( &s->srv, SSL_IS_SERVER );
+    ssl_set_rng( &s->srv, ctr_drbg_random, drbg );
+    ssl_set_bio( &s->srv, benchmark_pipe_recv, &s->to_srv,
+                          benchmark_pipe_send, &s->to_cli );
+
+    if( ( ret = ssl_set_own_cert( &s->srv, &crt, key ) ) != 0 )
+        out->ret = ret;
+    else
+        benchmark_ops( out, "tls-handshake-full", bench_handshake, s );
+
+    ssl_free( &s->cli );
+    ssl_free( &s->srv );
+
+exit:
+    x509_crt_free( &crt );
+    memory_free( der );
+    memory_free( s );
+}
+
+/*
+ * Run the requested groups
+ */
+int crypto_benchmark( char *buf, size_t size, int groups )
+{
+    int ret;
+    benchmark_out out;
+    entropy_context_t entropy;
+    ctr_drbg_context_t drbg;
+    pk_context pk2048;
+
+    out.p = buf;
+    out.n = size;
+    out.count = 0;
+    out.ret = 0;
+
+    entropy_init( &entropy );
+    if( ( ret = ctr_drbg_init( &drbg, entropy_func, &entropy,
+                               (const uint8_t *) "benchmark", 9 ) ) != 0 )
+    {
+        entropy_free( &entropy );
+        return( ret );
+    }
+
+    pk_init( &pk2048 );
+
+    BENCHMARK_PRINT( &out, ( out.p, out.n, "{\n  \"ms\":%u,\n  \"results\":[",
+                             BENCHMARK_MS ) );
+
+    if( groups & BENCHMARK_SYMMETRIC )
+        benchmark_symmetric( &out );
+
+    /* The handshake reuses the RSA-2048 key */
+    if( groups & ( BENCHMARK_PUBLIC_KEY | BENCHMARK_HANDSHAKE ) )
+    {
+        if( groups & BENCHMARK_PUBLIC_KEY )
+            benchmark_public_key( &out, &drbg, &pk2048 );
+        else if( ( ret = pk_init_ctx( &pk2048,
+                                pk_info_from_type( POLARSSL_PK_RSA ) ) ) != 0 ||
+                 ( ret = rsa_gen_key( pk_rsa( pk2048 ), ctr_drbg_random, &drbg,
+                                      2048, 65537 ) ) != 0 )
+            out.ret = ret;
+    }
+
+    if( ( groups & BENCHMARK_HANDSHAKE ) && out.ret == 0 )
+        benchmark_handshake( &out, &drbg, &pk2048 );
+
+    BENCHMARK_PRINT( &out, ( out.p, out.n, "\n  ]\n}\n" ) );
+
+    pk_free( &pk2048 );
+    __stosb( (uint8_t *) &drbg, 0, sizeof( ctr_drbg_context_t ) );
+    entropy_free( &entropy );
+
+    if( out.ret != 0 )
+        return( out.ret );
+
+    return( (int) ( size - out.n ) );
+}
+
+#endif /* POLARSSL_BENCHMARK_C */
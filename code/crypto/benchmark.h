@@ -0,0 +1,59 @@
+#ifndef POLARSSL_BENCHMARK_H
+#define POLARSSL_BENCHMARK_H
+
+#include "config.h"
+
+/**
+ * \name SECTION: Module settings
+ *
+ * The configuration options you can set for this module are in this section.
+ * Either change them in config.h or define them on the compiler command line.
+ * \{
+ */
+
+#if !defined(BENCHMARK_MS)
+#define BENCHMARK_MS            250     /*!< Time spent on each measurement */
+#endif
+
+/* \} name SECTION: Module settings */
+
+/*
+ * Benchmark groups
+ */
+#define BENCHMARK_SYMMETRIC     0x01    /*!< AES-CBC, hashes, HMAC, CRC64, base64 */
+#define BENCHMARK_PUBLIC_KEY    0x02    /*!< RSA, ECDH on every curve, mpi_exp_mod */
+#define BENCHMARK_HANDSHAKE     0x04    /*!< in-memory client/server handshakes */
+#define BENCHMARK_ALL           0x07
+
+#define POLARSSL_ERR_BENCHMARK_BUFFER_TOO_SMALL            -0x0076  /**< Output buffer too small. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          Measure the crypto primitives and write the results
+ *
+ *                 The output is a JSON object with a "results" array, one
+ *                 object per measurement, for trend tracking:
+ *
+ *                 {"name":"aes-256-cbc-enc","size":1024,"iterations":...,
+ *                  "ms":...,"cycles_per_byte":12.34,"mb_per_s":...}
+ *
+ *                 Bulk primitives are measured at 64, 1024 and 16384 bytes
+ *                 and report cycles per byte (TSC) and throughput, the
+ *                 others report operations per second.
+ *
+ * \param buf      buffer for the JSON text (NUL terminated)
+ * \param size     size of the buffer
+ * \param groups   BENCHMARK_xxx groups to run
+ *
+ * \return         length of the JSON text, or a negative error code
+ */
+int crypto_benchmark( char *buf, size_t size, int groups );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* benchmark.h */
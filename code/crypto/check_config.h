@@ -42,6 +42,10 @@
 #error "POLARSSL_SSL_SRV_C defined, but not all prerequisites"
 #endif
 
+#if defined(POLARSSL_SSL_ASYNC_C) && !defined(POLARSSL_SSL_TLS_C)
+#error "POLARSSL_SSL_ASYNC_C defined, but not all prerequisites"
+#endif
+
 #if defined(POLARSSL_SSL_SERVER_NAME_INDICATION) && \
         !defined(POLARSSL_X509_CRT_PARSE_C)
 #error "POLARSSL_SSL_SERVER_NAME_INDICATION defined, but not all prerequisites"
@@ -63,10 +67,29 @@
 #error "POLARSSL_X509_CRT_PARSE_C defined, but not all prerequisites"
 #endif
 
+#if defined(POLARSSL_BENCHMARK_C) && ( !defined(POLARSSL_PK_C) ||         \
+    !defined(POLARSSL_X509_CRT_WRITE_C) || !defined(POLARSSL_X509_CRT_PARSE_C) || \
+    !defined(POLARSSL_SSL_CLI_C) || !defined(POLARSSL_SSL_SRV_C) )
+#error "POLARSSL_BENCHMARK_C defined, but not all prerequisites"
+#endif
+
+#if defined(POLARSSL_X509_CRT_PARALLEL_LOAD) && !defined(POLARSSL_X509_CRT_PARSE_C)
+#error "POLARSSL_X509_CRT_PARALLEL_LOAD defined, but not all prerequisites"
+#endif
+
+#if defined(POLARSSL_X509_CRT_VERIFY_CACHE) && ( \
+    !defined(POLARSSL_X509_CRT_PARSE_C) || !defined(POLARSSL_SHA256_C) )
+#error "POLARSSL_X509_CRT_VERIFY_CACHE defined, but not all prerequisites"
+#endif
+
 #if defined(POLARSSL_X509_CRL_PARSE_C) && ( !defined(POLARSSL_X509_USE_C) )
 #error "POLARSSL_X509_CRL_PARSE_C defined, but not all prerequisites"
 #endif
 
+#if defined(POLARSSL_X509_CRL_INDEX) && !defined(POLARSSL_X509_CRL_PARSE_C)
+#error "POLARSSL_X509_CRL_INDEX defined, but not all prerequisites"
+#endif
+
 #if defined(POLARSSL_X509_CSR_PARSE_C) && ( !defined(POLARSSL_X509_USE_C) )
 #error "POLARSSL_X509_CSR_PARSE_C defined, but not all prerequisites"
 #endif
@@ -150,6 +150,18 @@
  */
 #define POLARSSL_SSL_TRUNCATED_HMAC
 
+/**
+ * \def POLARSSL_SSL_SESSION_TICKETS
+ *
+ * Enable support for RFC 5077 session tickets in SSL.
+ *
+ * The server seals the session state with a shared, rotating key ring
+ * (see ssl_ticket_keys_init()) and keeps no per-session memory.
+ *
+ * Comment this macro to disable support for SSL session tickets
+ */
+#define POLARSSL_SSL_SESSION_TICKETS
+
 /**
  * \def POLARSSL_X509_CHECK_KEY_USAGE
  *
@@ -177,6 +189,43 @@
  */
 #define POLARSSL_X509_CHECK_EXTENDED_KEY_USAGE
 
+/**
+ * \def POLARSSL_X509_CRL_INDEX
+ *
+ * Build a sorted serial number index when parsing CRLs, so revocation
+ * checks are a binary search instead of a list walk, and enable
+ * x509_crl_parse_file_mapped() for large CRLs.
+ *
+ * Requires: POLARSSL_X509_CRL_PARSE_C
+ *
+ * Comment this macro to keep the plain entry list only
+ */
+#define POLARSSL_X509_CRL_INDEX
+
+/**
+ * \def POLARSSL_X509_CRT_PARALLEL_LOAD
+ *
+ * Load certificate directories with x509_crt_parse_files(), which maps the
+ * files and decodes and parses the certificates on a pool of threads.
+ *
+ * Requires: POLARSSL_X509_CRT_PARSE_C
+ *
+ * Comment this macro to load certificate files one by one
+ */
+#define POLARSSL_X509_CRT_PARALLEL_LOAD
+
+/**
+ * \def POLARSSL_X509_CRT_VERIFY_CACHE
+ *
+ * Enable a cache of successful certificate chain verifications, keyed by
+ * the chain, the trusted CAs, the CRLs and the expected CN.
+ *
+ * Requires: POLARSSL_X509_CRT_PARSE_C, POLARSSL_SHA256_C
+ *
+ * Comment this macro to always verify chains in full
+ */
+#define POLARSSL_X509_CRT_VERIFY_CACHE
+
 /* \} name SECTION: PolarSSL feature support */
 
 /**
@@ -214,6 +263,21 @@
  */
 #define POLARSSL_ASN1_WRITE_C
 
+/**
+ * \def POLARSSL_BENCHMARK_C
+ *
+ * Enable the crypto benchmark suite (crypto_benchmark()).
+ *
+ * Module:  library/benchmark.c
+ * Caller:
+ *
+ * Requires: POLARSSL_PK_C, POLARSSL_X509_CRT_WRITE_C,
+ *           POLARSSL_X509_CRT_PARSE_C, POLARSSL_SSL_CLI_C, POLARSSL_SSL_SRV_C
+ *
+ * This module is used for performance tracking only.
+ */
+//#define POLARSSL_BENCHMARK_C
+
 /**
  * \def POLARSSL_CERTS_C
  *
@@ -394,6 +458,21 @@
  */
 #define POLARSSL_SSL_CACHE_C
 
+/**
+ * \def POLARSSL_SSL_ASYNC_C
+ *
+ * Enable the TLS adapter for async streams.
+ *
+ * Module:  library/ssl_async.c
+ * Caller:
+ *
+ * Requires: POLARSSL_SSL_TLS_C
+ *
+ * Runs a TLS context over an async_stream_t through memory BIOs, without
+ * a thread per connection.
+ */
+#define POLARSSL_SSL_ASYNC_C
+
 /**
  * \def POLARSSL_SSL_CLI_C
  *
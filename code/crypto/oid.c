@@ -15,25 +15,114 @@
  */
 #define ADD_LEN(s)      s, OID_SIZE(s)
 
+/*
+ * Lookups by OID go through an open addressing hash index per table, built
+ * once on first use. Until the index is ready (async_once() gave up, or the
+ * table is too large for it) lookups scan the table. The tables keep their
+ * declaration order, which the reverse (by attribute) lookups rely on to
+ * pick the preferred OID.
+ */
+#define OID_INDEX_SIZE  64      /* power of two, over twice the largest table */
+
+typedef struct {
+    async_once_t once;
+    volatile int ready;                 /* slots filled, 0: scan     */
+    uint8_t slot[OID_INDEX_SIZE];       /* entry number + 1, 0: free */
+} oid_index_t;
+
+/*
+ * FNV-1a. OIDs of a table mostly share their arc and differ in the last
+ * bytes, which this mixes well enough for a handful of entries.
+ */
+static uint32_t oid_hash( const uint8_t *p, size_t len )
+{
+    uint32_t hash = 0x811C9DC5;
+
+    while( len-- > 0 )
+    {
+        hash ^= *p++;
+        hash *= 0x01000193;
+    }
+
+    return( hash );
+}
+
+#define OID_ENTRY( LIST, STRIDE, I ) \
+    ( (const oid_descriptor_t *) ( (const uint8_t *) (LIST) + (I) * (STRIDE) ) )
+
+static void oid_index_build( oid_index_t *index, const void *list,
+                             size_t stride )
+{
+    size_t i, h;
+    const oid_descriptor_t *cur;
+
+    for( i = 0; ( cur = OID_ENTRY( list, stride, i ) )->asn1 != NULL; i++ )
+    {
+        if( i >= OID_INDEX_SIZE / 2 )
+            return;
+
+        h = oid_hash( (const uint8_t *) cur->asn1, cur->asn1_len );
+
+        while( index->slot[h & ( OID_INDEX_SIZE - 1 )] != 0 )
+            h++;
+
+        index->slot[h & ( OID_INDEX_SIZE - 1 )] = (uint8_t) ( i + 1 );
+    }
+
+    index->ready = 1;
+}
+
+static const void *oid_index_find( const oid_index_t *index,
+                                   const void *list, size_t stride,
+                                   const asn1_buf *oid )
+{
+    size_t i, h;
+    const oid_descriptor_t *cur;
+
+    if( !index->ready )
+    {
+        for( i = 0; ( cur = OID_ENTRY( list, stride, i ) )->asn1 != NULL; i++ )
+        {
+            if( cur->asn1_len == oid->len &&
+                memcmp( cur->asn1, oid->p, oid->len ) == 0 )
+                return( cur );
+        }
+
+        return( NULL );
+    }
+
+    h = oid_hash( oid->p, oid->len );
+
+    while( ( i = index->slot[h & ( OID_INDEX_SIZE - 1 )] ) != 0 )
+    {
+        cur = OID_ENTRY( list, stride, i - 1 );
+
+        if( cur->asn1_len == oid->len &&
+            memcmp( cur->asn1, oid->p, oid->len ) == 0 )
+            return( cur );
+
+        h++;
+    }
+
+    return( NULL );
+}
+
 /*
  * Macro to generate an internal function for oid_XXX_from_asn1() (used by
  * the other functions)
  */
 #define FN_OID_TYPED_FROM_ASN1( TYPE_T, NAME, LIST )                        \
+static oid_index_t oid_ ## NAME ## _index = { ASYNC_ONCE_INIT };            \
+static void oid_ ## NAME ## _index_init( void )                             \
+{                                                                           \
+    oid_index_build( &oid_ ## NAME ## _index, LIST, sizeof( TYPE_T ) );     \
+}                                                                           \
 static const TYPE_T * oid_ ## NAME ## _from_asn1( const asn1_buf *oid )     \
 {                                                                           \
-    const TYPE_T *p = LIST;                                                 \
-    const oid_descriptor_t *cur = (const oid_descriptor_t *) p;             \
-    if( p == NULL || oid == NULL ) return( NULL );                          \
-    while( cur->asn1 != NULL ) {                                            \
-        if( cur->asn1_len == oid->len &&                                    \
-            memcmp( cur->asn1, oid->p, oid->len ) == 0 ) {                  \
-            return( p );                                                    \
-        }                                                                   \
-        p++;                                                                \
-        cur = (const oid_descriptor_t *) p;                                 \
-    }                                                                       \
-    return( NULL );                                                         \
+    if( oid == NULL ) return( NULL );                                       \
+    async_once( &oid_ ## NAME ## _index.once, oid_ ## NAME ## _index_init ); \
+    return( (const TYPE_T *) oid_index_find( &oid_ ## NAME ## _index,       \
+                                    LIST, sizeof( TYPE_T ), oid ) );        \
 }
 
 /*
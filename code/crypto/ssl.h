@@ -134,6 +134,14 @@
 #define SSL_DEFAULT_TICKET_LIFETIME     86400 /**< Lifetime of session tickets (if enabled) */
 #endif
 
+#if !defined(SSL_TICKET_KEYS)
+#define SSL_TICKET_KEYS                 2     /**< Ticket keys kept in a key ring (active + retired) */
+#endif
+
+#if !defined(SSL_BUFFER_POOL_SLABS)
+#define SSL_BUFFER_POOL_SLABS           64    /**< Idle record buffers kept per size class */
+#endif
+
 /*
  * Size of the input / output buffer.
  * Note: the RFC defines the default size of SSL / TLS messages. If you
@@ -168,6 +176,11 @@
 
 #define SSL_EMPTY_RENEGOTIATION_INFO    0xFF   /**< renegotiation info ext */
 
+/*
+ * Largest byte count a single ssl_readv() / ssl_writev() call reports
+ */
+#define SSL_IOV_MAX_LEN                 0x7FFFFFFF
+
 /*
  * Supported Signature and Hash algorithms (For TLS 1.2)
  * RFC 5246 section 7.4.1.4.1
@@ -326,6 +339,10 @@ typedef struct _ssl_session ssl_session;
 typedef struct _ssl_context ssl_context;
 typedef struct _ssl_transform ssl_transform;
 typedef struct _ssl_handshake_params ssl_handshake_params;
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+typedef struct _ssl_ticket_key ssl_ticket_key;
+typedef struct _ssl_ticket_keys ssl_ticket_keys;
+#endif
 #if defined(POLARSSL_X509_CRT_PARSE_C)
 typedef struct _ssl_key_cert ssl_key_cert;
 #endif
@@ -354,6 +371,12 @@ struct _ssl_session
 #if defined(POLARSSL_SSL_TRUNCATED_HMAC)
     int trunc_hmac;             /*!< flag for truncated hmac activation   */
 #endif /* POLARSSL_SSL_TRUNCATED_HMAC */
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    uint8_t *ticket;            /*!< RFC 5077 session ticket */
+    size_t ticket_len;          /*!< session ticket length   */
+    uint32_t ticket_lifetime;   /*!< ticket lifetime hint    */
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
 };
 
 /*
@@ -432,7 +455,43 @@ struct _ssl_handshake_params
     int max_major_ver;                  /*!< max. major version client*/
     int max_minor_ver;                  /*!< max. minor version client*/
     int cli_exts;                       /*!< client extension presence*/
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    int new_session_ticket;             /*!< use NewSessionTicket?    */
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+};
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+/*
+ * One session ticket protection key (RFC 5077 section 4)
+ */
+struct _ssl_ticket_key
+{
+    uint8_t key_name[16];               /*!< name to quickly discard bad tickets */
+    aes_context_t enc;                  /*!< encryption context                  */
+    aes_context_t dec;                  /*!< decryption context                  */
+    uint8_t mac_key[32];                /*!< authentication key                  */
+    time_t generation;                  /*!< time the key became active          */
+};
+
+/*
+ * Session ticket key ring, shared by all server contexts (and, through
+ * ssl_ticket_keys_add(), by several processes). New tickets are sealed with
+ * the active key, older keys are only kept to open tickets issued before
+ * the last rotation.
+ */
+struct _ssl_ticket_keys
+{
+    ssl_ticket_key keys[SSL_TICKET_KEYS];   /*!< key slots              */
+    int active;                         /*!< slot sealing new tickets    */
+    int count;                          /*!< slots holding a key         */
+    int rotation;                       /*!< rotation interval, 0: never */
+    async_rwlock_t lock;                /*!< guards keys during rotation */
+
+    int  (*f_rng)(void *, uint8_t *, size_t);
+    void *p_rng;                        /*!< context for key generation  */
 };
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
 
 #if defined(POLARSSL_X509_CRT_PARSE_C)
 /*
@@ -519,6 +578,11 @@ struct _ssl_context
     uint8_t *in_iv;       /*!< ivlen-byte IV (in_hdr+5)         */
     uint8_t *in_msg;      /*!< message contents (in_iv+ivlen)   */
     uint8_t *in_offt;     /*!< read offset in application data  */
+    uint8_t *in_dst;      /*!< caller buffer for direct decrypt */
+    size_t in_dst_len;    /*!< room available in in_dst         */
+    uint8_t in_ctr_saved[8];    /*!< in_ctr while no buffer is held   */
+    int in_buf_mfl;             /*!< size class of the input buffer   */
+    size_t in_buf_len;          /*!< usable size of the input buffer  */
 
     int in_msgtype;             /*!< record header: message type      */
     size_t in_msglen;           /*!< record header: message length    */
@@ -535,6 +599,8 @@ struct _ssl_context
     uint8_t *out_hdr;     /*!< 5-byte record header (out_ctr+8) */
     uint8_t *out_iv;      /*!< ivlen-byte IV (out_hdr+5)        */
     uint8_t *out_msg;     /*!< message contents (out_iv+ivlen)  */
+    uint8_t out_ctr_saved[8];   /*!< out_ctr while no buffer is held  */
+    int out_buf_mfl;            /*!< size class of the output buffer  */
 
     int out_msgtype;            /*!< record header: message type      */
     size_t out_msglen;          /*!< record header: message length    */
@@ -553,6 +619,9 @@ struct _ssl_context
     x509_crt *ca_chain;                 /*!<  own trusted CA chain      */
     x509_crl *ca_crl;                   /*!<  trusted CA CRLs           */
     const char *peer_cn;                /*!<  expected peer CN          */
+#if defined(POLARSSL_X509_CRT_VERIFY_CACHE)
+    x509_crt_verify_cache *verify_cache; /*!< shared verification cache  */
+#endif
 #endif /* POLARSSL_X509_CRT_PARSE_C */
 
     /*
@@ -570,6 +639,11 @@ struct _ssl_context
 #if defined(POLARSSL_SSL_TRUNCATED_HMAC)
     int trunc_hmac;                     /*!<  negotiate truncated hmac?      */
 #endif
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    int session_tickets;                /*!<  use session tickets?           */
+    int ticket_lifetime;                /*!<  session ticket lifetime        */
+    ssl_ticket_keys *ticket_keys;       /*!<  server ticket key ring         */
+#endif
 
 #if defined(POLARSSL_SSL_SERVER_NAME_INDICATION)
     /*
@@ -836,6 +910,19 @@ void ssl_set_ciphersuites_for_version( ssl_context *ssl,
 void ssl_set_ca_chain( ssl_context *ssl, x509_crt *ca_chain,
                        x509_crl *ca_crl, const char *peer_cn );
 
+#if defined(POLARSSL_X509_CRT_VERIFY_CACHE)
+/**
+ * \brief          Share a cache of successful peer chain verifications
+ *                 between contexts, so reconnecting peers skip the
+ *                 signature checks. Flush it when the CA chain or the
+ *                 CRLs change.
+ *
+ * \param ssl      SSL context
+ * \param cache    verification cache (or NULL to always verify)
+ */
+void ssl_set_verify_cache( ssl_context *ssl, x509_crt_verify_cache *cache );
+#endif /* POLARSSL_X509_CRT_VERIFY_CACHE */
+
 /**
  * \brief          Set own certificate chain and private key
  *
@@ -1057,6 +1144,88 @@ int ssl_set_max_frag_len( ssl_context *ssl, uint8_t mfl_code );
 int ssl_set_truncated_hmac( ssl_context *ssl, int truncate );
 #endif /* POLARSSL_SSL_TRUNCATED_HMAC */
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+/**
+ * \brief          Enable / Disable session tickets
+ *                 (Default: SSL_SESSION_TICKETS_DISABLED)
+ *
+ * \note           On server, tickets are only issued once a key ring has
+ *                 been set with ssl_set_session_ticket_keys().
+ *
+ * \param ssl      SSL context
+ * \param use_tickets   Enable or disable (SSL_SESSION_TICKETS_ENABLED or
+ *                                         SSL_SESSION_TICKETS_DISABLED)
+ */
+void ssl_set_session_tickets( ssl_context *ssl, int use_tickets );
+
+/**
+ * \brief          Set session ticket lifetime (server only)
+ *                 (Default: SSL_DEFAULT_TICKET_LIFETIME (86400 secs / 1 day))
+ *
+ * \param ssl      SSL context
+ * \param lifetime session ticket lifetime
+ */
+void ssl_set_session_ticket_lifetime( ssl_context *ssl, int lifetime );
+
+/**
+ * \brief          Set the key ring used to seal and open session tickets
+ *                 (server only). The key ring is not copied and may be
+ *                 shared by any number of contexts and threads.
+ *
+ * \param ssl      SSL context
+ * \param keys     initialized key ring (see ssl_ticket_keys_init())
+ */
+void ssl_set_session_ticket_keys( ssl_context *ssl, ssl_ticket_keys *keys );
+
+/**
+ * \brief          Initialize a session ticket key ring and generate its
+ *                 first key
+ *
+ * \param keys     key ring to initialize
+ * \param f_rng    RNG function used to generate keys
+ * \param p_rng    RNG parameter
+ * \param rotation seconds after which a fresh key is generated while
+ *                 sealing a ticket, 0 to rotate only on demand. Tickets
+ *                 stay valid for at least one rotation period, so it
+ *                 should not be shorter than the ticket lifetime.
+ *
+ * \return         0 if successful, or the RNG error code
+ */
+int ssl_ticket_keys_init( ssl_ticket_keys *keys,
+                          int (*f_rng)(void *, uint8_t *, size_t),
+                          void *p_rng, int rotation );
+
+/**
+ * \brief          Generate a new active key, retiring the oldest one
+ *
+ * \param keys     key ring
+ *
+ * \return         0 if successful, or the RNG error code
+ */
+int ssl_ticket_keys_rotate( ssl_ticket_keys *keys );
+
+/**
+ * \brief          Install externally distributed key material as the
+ *                 active key, retiring the oldest one. Processes sharing
+ *                 the same key material accept each other's tickets.
+ *
+ * \param keys     key ring
+ * \param key_name 16 bytes key name
+ * \param enc_key  32 bytes AES-256 key
+ * \param mac_key  32 bytes HMAC-SHA-256 key
+ */
+void ssl_ticket_keys_add( ssl_ticket_keys *keys, const uint8_t key_name[16],
+                          const uint8_t enc_key[32],
+                          const uint8_t mac_key[32] );
+
+/**
+ * \brief          Free a session ticket key ring and clear the keys
+ *
+ * \param keys     key ring
+ */
+void ssl_ticket_keys_free( ssl_ticket_keys *keys );
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
 /**
  * \brief          Enable / Disable renegotiation support for connection when
  *                 initiated by peer
@@ -1253,6 +1422,24 @@ int ssl_renegotiate( ssl_context *ssl );
  */
 int ssl_read( ssl_context *ssl, uint8_t *buf, size_t len );
 
+/**
+ * \brief          Read application data into a list of buffers
+ *
+ *                 Pending data from the current record is spread over the
+ *                 buffers. Otherwise one record is read; when the first
+ *                 buffer has room for the whole ciphertext plus 256 bytes it
+ *                 is decrypted there directly, without going through the
+ *                 internal input buffer.
+ *
+ * \param ssl      SSL context
+ * \param iov      buffers that will hold the data
+ * \param iovcnt   number of buffers
+ *
+ * \return         This function returns the number of bytes read, 0 for EOF,
+ *                 or a negative error code.
+ */
+int ssl_readv( ssl_context *ssl, const async_buf_t *iov, int iovcnt );
+
 /**
  * \brief          Write exactly 'len' application data bytes
  *
@@ -1269,6 +1456,30 @@ int ssl_read( ssl_context *ssl, uint8_t *buf, size_t len );
  */
 int ssl_write( ssl_context *ssl, const uint8_t *buf, size_t len );
 
+/**
+ * \brief          Write application data gathered from a list of buffers
+ *
+ *                 The data is cut into as many records as needed, each one
+ *                 encrypted straight from the caller's buffers into the
+ *                 output record. Under TLS 1.0, or with a cipher other than
+ *                 CBC, each record's data is copied into the output record
+ *                 first and encrypted there.
+ *
+ * \param ssl      SSL context
+ * \param iov      buffers holding the data
+ * \param iovcnt   number of buffers
+ *
+ * \return         This function returns the number of bytes written,
+ *                 or a negative error code. A short count means a later
+ *                 record could not be sent yet.
+ *
+ * \note           When this function returns POLARSSL_ERR_NET_WANT_WRITE,
+ *                 or a short count, it must be called later with the
+ *                 remaining data (the *same* buffers, advanced by the
+ *                 count), until all of it is written.
+ */
+int ssl_writev( ssl_context *ssl, const async_buf_t *iov, int iovcnt );
+
 /**
  * \brief           Send an alert message
  *
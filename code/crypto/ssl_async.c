@@ -0,0 +1,405 @@
+#include "..\zmodule.h"
+#include "config.h"
+
+#if defined(POLARSSL_SSL_ASYNC_C)
+
+#include "ssl_async.h"
+
+typedef struct
+{
+    async_write_t req;
+    ssl_async_t *tls;
+    uint8_t *data;
+}
+ssl_async_write_req;
+
+/*
+ * Input memory BIO: hand out ciphertext received from the stream
+ */
+static int ssl_async_bio_recv( void *ctx, uint8_t *buf, size_t len )
+{
+    ssl_async_t *tls = (ssl_async_t *) ctx;
+    size_t n = tls->in_len - tls->in_off;
+
+    if( n == 0 )
+        return( POLARSSL_ERR_NET_WANT_READ );
+
+    if( n > len )
+        n = len;
+
+    __movsb( buf, tls->in_buf + tls->in_off, n );
+    tls->in_off += n;
+
+    return( (int) n );
+}
+
+/*
+ * Output memory BIO: collect ciphertext until the next flush
+ */
+static int ssl_async_bio_send( void *ctx, const uint8_t *buf, size_t len )
+{
+    ssl_async_t *tls = (ssl_async_t *) ctx;
+    size_t size;
+    uint8_t *p;
+
+    if( tls->out_size - tls->out_len < len )
+    {
+        size = tls->out_size * 2;
+        if( size < tls->out_len + len )
+            size = tls->out_len + len;
+
+        p = (uint8_t *) memory_realloc( tls->out_buf, size );
+        if( p == NULL )
+            return( POLARSSL_ERR_SSL_MALLOC_FAILED );
+
+        tls->out_buf = p;
+        tls->out_size = size;
+    }
+
+    __movsb( tls->out_buf + tls->out_len, buf, len );
+    tls->out_len += len;
+
+    return( (int) len );
+}
+
+static void ssl_async_write_cb( async_write_t *req, int status )
+{
+    ssl_async_write_req *wr = (ssl_async_write_req *) req;
+    ssl_async_t *tls = wr->tls;
+
+    tls->writes_pending--;
+
+    if( status != 0 && tls->status == 0 )
+        tls->status = status;
+
+    memory_free( wr->data );
+    memory_free( wr );
+}
+
+/*
+ * Queue the output BIO contents on the stream. The write request takes
+ * the buffer over, nothing is copied.
+ */
+static int ssl_async_flush( ssl_async_t *tls )
+{
+    int ret;
+    ssl_async_write_req *wr;
+    async_buf_t buf;
+
+    if( tls->out_len == 0 )
+        return( 0 );
+
+    wr = (ssl_async_write_req *) memory_alloc( sizeof( ssl_async_write_req ) );
+    if( wr == NULL )
+        return( POLARSSL_ERR_SSL_MALLOC_FAILED );
+
+    wr->tls = tls;
+    wr->data = tls->out_buf;
+    buf = async_buf_init( (char *) tls->out_buf, (uint32_t) tls->out_len );
+
+    tls->out_buf = NULL;
+    tls->out_len = 0;
+    tls->out_size = 0;
+
+    if( ( ret = async_write( &wr->req, tls->stream, &buf, 1,
+                             ssl_async_write_cb ) ) != 0 )
+    {
+        memory_free( wr->data );
+        memory_free( wr );
+        return( ret );
+    }
+
+    tls->writes_pending++;
+
+    return( 0 );
+}
+
+/*
+ * Report a fatal error to whoever is waiting: the handshake callback while
+ * handshaking, the read callback afterwards
+ */
+static void ssl_async_fail( ssl_async_t *tls, int status )
+{
+    async_buf_t buf;
+
+    if( tls->status == 0 )
+        tls->status = status;
+
+    async_read_stop( tls->stream );
+
+    if( ! tls->handshake_done )
+    {
+        tls->handshake_done = 1;
+        tls->handshake_cb( tls, status );
+        return;
+    }
+
+    buf = async_buf_init( NULL, 0 );
+    tls->read_cb( tls, status, &buf );
+}
+
+/*
+ * Run the engine over whatever ciphertext is buffered: advance the
+ * handshake, then decrypt application data until the input BIO runs dry
+ */
+static void ssl_async_drive( ssl_async_t *tls )
+{
+    int ret = 0;
+    async_buf_t buf;
+
+    if( ! tls->handshake_done )
+    {
+        while( tls->ssl->state != SSL_HANDSHAKE_OVER )
+        {
+            if( ( ret = ssl_handshake_step( tls->ssl ) ) != 0 )
+                break;
+        }
+
+        if( ret == 0 || ret == POLARSSL_ERR_NET_WANT_READ )
+            ret = ssl_async_flush( tls );
+
+        if( ret != 0 )
+        {
+            if( ret != POLARSSL_ERR_NET_WANT_READ )
+            {
+                /* Let a pending alert out before giving up */
+                ssl_async_flush( tls );
+                ssl_async_fail( tls, ret );
+            }
+
+            return;
+        }
+
+        if( tls->ssl->state != SSL_HANDSHAKE_OVER )
+            return;
+
+        tls->handshake_done = 1;
+        tls->handshake_cb( tls, 0 );
+    }
+
+    while( ! tls->closing && tls->status == 0 )
+    {
+        buf = async_buf_init( NULL, 0 );
+        tls->alloc_cb( tls, SSL_ASYNC_READ_SIZE, &buf );
+
+        if( buf.base == NULL || buf.len == 0 )
+        {
+            ssl_async_fail( tls, POLARSSL_ERR_SSL_MALLOC_FAILED );
+            return;
+        }
+
+        /* Whole records are decrypted straight into the caller's buffer */
+        ret = ssl_readv( tls->ssl, &buf, 1 );
+
+        if( ret >= 0 )
+        {
+            tls->read_cb( tls, ret, &buf );
+            continue;
+        }
+
+        if( ret == POLARSSL_ERR_NET_WANT_READ )
+        {
+            /* Give the buffer back */
+            tls->read_cb( tls, 0, &buf );
+            break;
+        }
+
+        if( ret == POLARSSL_ERR_SSL_PEER_CLOSE_NOTIFY )
+        {
+            async_read_stop( tls->stream );
+            tls->read_cb( tls, ASYNC_EOF, &buf );
+            break;
+        }
+
+        ssl_async_flush( tls );
+        ssl_async_fail( tls, ret );
+        return;
+    }
+
+    /* Renegotiation and alerts may have produced records */
+    if( ( ret = ssl_async_flush( tls ) ) != 0 )
+        ssl_async_fail( tls, ret );
+}
+
+/*
+ * Stream callbacks: reads go straight into the input BIO
+ */
+static void ssl_async_stream_alloc( async_handle_t *handle,
+                                    size_t suggested_size, async_buf_t *buf )
+{
+    ssl_async_t *tls = (ssl_async_t *) handle->data;
+    size_t size;
+    uint8_t *p;
+
+    /* Reclaim what the engine already consumed */
+    if( tls->in_off != 0 )
+    {
+        memmove( tls->in_buf, tls->in_buf + tls->in_off,
+                 tls->in_len - tls->in_off );
+        tls->in_len -= tls->in_off;
+        tls->in_off = 0;
+    }
+
+    if( suggested_size > SSL_BUFFER_LEN )
+        suggested_size = SSL_BUFFER_LEN;
+
+    if( tls->in_size - tls->in_len < suggested_size )
+    {
+        size = tls->in_len + suggested_size;
+
+        p = (uint8_t *) memory_realloc( tls->in_buf, size );
+        if( p == NULL )
+        {
+            *buf = async_buf_init( NULL, 0 );
+            return;
+        }
+
+        tls->in_buf = p;
+        tls->in_size = size;
+    }
+
+    *buf = async_buf_init( (char *) tls->in_buf + tls->in_len,
+                           (uint32_t)( tls->in_size - tls->in_len ) );
+}
+
+static void ssl_async_stream_read( async_stream_t *stream, ssize_t nread,
+                                   const async_buf_t *buf )
+{
+    ssl_async_t *tls = (ssl_async_t *) stream->data;
+
+    ((void) buf);
+
+    if( nread < 0 )
+    {
+        /* Transport error, or EOF without close_notify */
+        ssl_async_fail( tls, (int) nread );
+        return;
+    }
+
+    tls->in_len += nread;
+
+    ssl_async_drive( tls );
+
+    /* Don't keep an input buffer around for idle connections */
+    if( tls->in_off == tls->in_len && tls->in_buf != NULL )
+    {
+        memory_free( tls->in_buf );
+        tls->in_buf = NULL;
+        tls->in_off = 0;
+        tls->in_len = 0;
+        tls->in_size = 0;
+    }
+}
+
+int ssl_async_init( ssl_async_t *tls, ssl_context *ssl,
+                    async_stream_t *stream )
+{
+    __stosb( tls, 0, sizeof( ssl_async_t ) );
+
+    tls->ssl = ssl;
+    tls->stream = stream;
+    stream->data = tls;
+
+    ssl_set_bio( ssl, ssl_async_bio_recv, tls, ssl_async_bio_send, tls );
+
+    return( 0 );
+}
+
+int ssl_async_start( ssl_async_t *tls, ssl_async_handshake_cb handshake_cb,
+                     ssl_async_alloc_cb alloc_cb, ssl_async_read_cb read_cb )
+{
+    int ret;
+
+    tls->handshake_cb = handshake_cb;
+    tls->alloc_cb = alloc_cb;
+    tls->read_cb = read_cb;
+
+    if( ( ret = async_read_start( tls->stream, ssl_async_stream_alloc,
+                                  ssl_async_stream_read ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    /* A client sends its ClientHello right away */
+    ssl_async_drive( tls );
+
+    return( 0 );
+}
+
+int ssl_async_write( ssl_async_t *tls, const async_buf_t bufs[],
+                     uint32_t nbufs )
+{
+    int ret;
+
+    if( tls->status != 0 )
+        return( tls->status );
+
+    if( ! tls->handshake_done || tls->closing )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    /* The output BIO never pushes back, all records are built at once */
+    if( ( ret = ssl_writev( tls->ssl, bufs, (int) nbufs ) ) < 0 )
+        return( ret );
+
+    return( ssl_async_flush( tls ) );
+}
+
+static void ssl_async_closed( async_handle_t *handle )
+{
+    ssl_async_t *tls = (ssl_async_t *) handle->data;
+
+    if( tls->close_cb != NULL )
+        tls->close_cb( tls );
+}
+
+static void ssl_async_shutdown_cb( async_shutdown_t *req, int status )
+{
+    ssl_async_t *tls = (ssl_async_t *) req->data;
+
+    ((void) status);
+
+    async_close( (async_handle_t *) tls->stream, ssl_async_closed );
+}
+
+void ssl_async_close( ssl_async_t *tls, ssl_async_close_cb close_cb )
+{
+    tls->closing = 1;
+    tls->close_cb = close_cb;
+
+    async_read_stop( tls->stream );
+
+    /*
+     * Shut down after close_notify so that it, and every queued record,
+     * reaches the peer before the socket goes away
+     */
+    if( tls->status == 0 && tls->handshake_done &&
+        ssl_close_notify( tls->ssl ) == 0 &&
+        ssl_async_flush( tls ) == 0 )
+    {
+        tls->shutdown_req.data = tls;
+
+        if( async_shutdown( &tls->shutdown_req, tls->stream,
+                            ssl_async_shutdown_cb ) == 0 )
+        {
+            return;
+        }
+    }
+
+    async_close( (async_handle_t *) tls->stream, ssl_async_closed );
+}
+
+void ssl_async_free( ssl_async_t *tls )
+{
+    if( tls->in_buf != NULL )
+        memory_free( tls->in_buf );
+
+    if( tls->out_buf != NULL )
+    {
+        __stosb( tls->out_buf, 0, tls->out_size );
+        memory_free( tls->out_buf );
+    }
+
+    __stosb( tls, 0, sizeof( ssl_async_t ) );
+}
+
+#endif /* POLARSSL_SSL_ASYNC_C */
@@ -0,0 +1,150 @@
+#ifndef POLARSSL_SSL_ASYNC_H
+#define POLARSSL_SSL_ASYNC_H
+
+#include "ssl.h"
+
+/**
+ * \name SECTION: Module settings
+ *
+ * The configuration options you can set for this module are in this section.
+ * Either change them in config.h or define them on the compiler command line.
+ * \{
+ */
+
+#if !defined(SSL_ASYNC_READ_SIZE)
+#define SSL_ASYNC_READ_SIZE     ( SSL_MAX_CONTENT_LEN + 256 )  /*!< Suggested size of plaintext read buffers */
+#endif
+
+/* \} name SECTION: Module settings */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _ssl_async ssl_async_t;
+
+/*
+ * Callbacks, modelled after the stream ones
+ */
+typedef void (*ssl_async_handshake_cb)( ssl_async_t *tls, int status );
+typedef void (*ssl_async_alloc_cb)( ssl_async_t *tls, size_t suggested_size,
+                                    async_buf_t *buf );
+typedef void (*ssl_async_read_cb)( ssl_async_t *tls, ssize_t nread,
+                                   const async_buf_t *buf );
+typedef void (*ssl_async_close_cb)( ssl_async_t *tls );
+
+/**
+ * \brief          TLS connection bound to an async stream
+ *
+ *                 Ciphertext read from the stream lands in an input memory
+ *                 BIO the engine reads from, ciphertext written by the engine
+ *                 collects in an output memory BIO that is handed to
+ *                 async_write() as is. The engine never blocks, so a single
+ *                 loop thread can serve any number of connections.
+ */
+struct _ssl_async
+{
+    void *data;                         /*!< user data                    */
+
+    ssl_context *ssl;                   /*!< configured TLS engine        */
+    async_stream_t *stream;             /*!< underlying connected stream  */
+
+    /*
+     * Input memory BIO (ciphertext received, not yet consumed)
+     */
+    uint8_t *in_buf;
+    size_t in_off;
+    size_t in_len;
+    size_t in_size;
+
+    /*
+     * Output memory BIO (ciphertext produced, not yet queued)
+     */
+    uint8_t *out_buf;
+    size_t out_len;
+    size_t out_size;
+
+    uint32_t writes_pending;            /*!< async_write() in flight      */
+    int handshake_done;
+    int closing;
+    int status;                         /*!< first fatal error, or 0      */
+
+    ssl_async_handshake_cb handshake_cb;
+    ssl_async_alloc_cb alloc_cb;
+    ssl_async_read_cb read_cb;
+    ssl_async_close_cb close_cb;
+
+    async_shutdown_t shutdown_req;
+};
+
+/**
+ * \brief          Bind a TLS context to a connected stream
+ *
+ *                 The context must be fully configured (endpoint, RNG,
+ *                 certificates, ...) except for its BIO, which is set here.
+ *
+ * \param tls      adapter to initialize
+ * \param ssl      TLS context, owned by the caller
+ * \param stream   connected stream (tcp or pipe), its data field is taken
+ *
+ * \return         0 if successful
+ */
+int ssl_async_init( ssl_async_t *tls, ssl_context *ssl,
+                    async_stream_t *stream );
+
+/**
+ * \brief          Start reading from the stream and run the handshake
+ *
+ *                 handshake_cb is called once, with 0 or an error. After a
+ *                 successful handshake decrypted application data is passed
+ *                 to read_cb, in buffers obtained from alloc_cb. nread is
+ *                 ASYNC_EOF once the peer closed the connection, or a
+ *                 negative SSL error code.
+ *
+ * \param tls      adapter
+ * \param handshake_cb  handshake completion callback
+ * \param alloc_cb plaintext buffer allocation callback
+ * \param read_cb  plaintext callback
+ *
+ * \return         0 if successful, or an async_read_start() error
+ */
+int ssl_async_start( ssl_async_t *tls, ssl_async_handshake_cb handshake_cb,
+                     ssl_async_alloc_cb alloc_cb, ssl_async_read_cb read_cb );
+
+/**
+ * \brief          Encrypt and send application data
+ *
+ *                 The data is encrypted right away, so the buffers may be
+ *                 reused as soon as this returns; the resulting records are
+ *                 queued on the stream.
+ *
+ * \param tls      adapter, with its handshake done
+ * \param bufs     buffers holding the data
+ * \param nbufs    number of buffers
+ *
+ * \return         0 if successful, or a negative error code
+ */
+int ssl_async_write( ssl_async_t *tls, const async_buf_t bufs[],
+                     uint32_t nbufs );
+
+/**
+ * \brief          Send close_notify, shut the stream down and close it
+ *
+ * \param tls      adapter
+ * \param close_cb called once the stream is closed, the adapter may then be
+ *                 freed with ssl_async_free()
+ */
+void ssl_async_close( ssl_async_t *tls, ssl_async_close_cb close_cb );
+
+/**
+ * \brief          Release the memory BIOs
+ *
+ * \param tls      adapter, whose stream is closed
+ */
+void ssl_async_free( ssl_async_t *tls );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ssl_async.h */
@@ -7,10 +7,104 @@
 
 #include <stdlib.h>
 
+/*
+ * FNV-1a over the session id. Server generated ids are random, the hash
+ * only has to spread client supplied ones over shards and buckets.
+ */
+static uint32_t ssl_cache_hash( const uint8_t *id, size_t len )
+{
+    uint32_t hash = 0x811C9DC5;
+    size_t i;
+
+    for( i = 0; i < len; i++ )
+    {
+        hash ^= id[i];
+        hash *= 0x01000193;
+    }
+
+    return( hash );
+}
+
+#define SSL_CACHE_SHARD_OF( cache, hash ) \
+    ( &(cache)->shards[( (hash) >> 16 ) & ( SSL_CACHE_SHARDS - 1 )] )
+#define SSL_CACHE_BUCKET_OF( shard, hash ) \
+    ( &(shard)->buckets[(hash) & ( SSL_CACHE_SHARD_BUCKETS - 1 )] )
+
+static int ssl_cache_expired( const ssl_cache_context *cache,
+                              const ssl_cache_entry *entry, time_t t )
+{
+    return( cache->timeout != 0 &&
+            (int) ( t - entry->timestamp ) > cache->timeout );
+}
+
+static ssl_cache_entry *ssl_cache_find( ssl_cache_shard *shard,
+                                        const ssl_session *session,
+                                        uint32_t hash )
+{
+    ssl_cache_entry *cur = *SSL_CACHE_BUCKET_OF( shard, hash );
+
+    for( ; cur != NULL; cur = cur->next )
+    {
+        if( cur->hash == hash &&
+            cur->session.length == session->length &&
+            memcmp( cur->session.id, session->id, session->length ) == 0 )
+            return( cur );
+    }
+
+    return( NULL );
+}
+
+/*
+ * Unlink an entry from its bucket and the age queue and release it.
+ * Must be called with the shard lock held.
+ */
+static void ssl_cache_evict( ssl_cache_shard *shard, ssl_cache_entry *entry )
+{
+    ssl_cache_entry **link = SSL_CACHE_BUCKET_OF( shard, entry->hash );
+
+    while( *link != entry )
+        link = &(*link)->next;
+
+    *link = entry->next;
+    queue_remove( &entry->lru );
+    shard->count--;
+
+    ssl_session_free( &entry->session );
+    memory_free( entry );
+}
+
+/*
+ * Entries are queued in timestamp order, so expired ones are always at
+ * the head of the age queue.
+ */
+static void ssl_cache_expire( ssl_cache_context *cache,
+                              ssl_cache_shard *shard, time_t t )
+{
+    ssl_cache_entry *entry;
+
+    while( ! queue_empty( &shard->lru ) )
+    {
+        entry = QUEUE_DATA( queue_head( &shard->lru ), ssl_cache_entry, lru );
+
+        if( ! ssl_cache_expired( cache, entry, t ) )
+            break;
+
+        ssl_cache_evict( shard, entry );
+    }
+}
+
 void ssl_cache_init( ssl_cache_context *cache )
 {
+    int i;
+
     __stosb( cache, 0, sizeof( ssl_cache_context ) );
 
+    for( i = 0; i < SSL_CACHE_SHARDS; i++ )
+    {
+        mutex_init( &cache->shards[i].lock );
+        queue_init( &cache->shards[i].lru );
+    }
+
     cache->timeout = SSL_CACHE_DEFAULT_TIMEOUT;
     cache->max_entries = SSL_CACHE_DEFAULT_MAX_ENTRIES;
 }
@@ -18,181 +112,129 @@ void ssl_cache_init( ssl_cache_context *cache )
 int ssl_cache_get( void *data, ssl_session *session )
 {
     int ret = 1;
-    time_t t = time( NULL );
+    time_t t;
+    uint32_t hash;
     ssl_cache_context *cache = (ssl_cache_context *) data;
-    ssl_cache_entry *cur, *entry;
+    ssl_cache_shard *shard;
+    ssl_cache_entry *entry;
 
-    cur = cache->chain;
-    entry = NULL;
+    if( session->length > sizeof( session->id ) )
+        return( 1 );
 
-    while( cur != NULL )
-    {
-        entry = cur;
-        cur = cur->next;
+    hash = ssl_cache_hash( session->id, session->length );
+    shard = SSL_CACHE_SHARD_OF( cache, hash );
+    t = time( NULL );
 
-        if( cache->timeout != 0 &&
-            (int) ( t - entry->timestamp ) > cache->timeout )
-            continue;
+    mutex_lock( &shard->lock );
 
-        if( session->ciphersuite != entry->session.ciphersuite ||
-            session->compression != entry->session.compression ||
-            session->length != entry->session.length )
-            continue;
+    entry = ssl_cache_find( shard, session, hash );
+    if( entry == NULL )
+        goto exit;
 
-        if( memcmp( session->id, entry->session.id,
-                    entry->session.length ) != 0 )
-            continue;
+    if( ssl_cache_expired( cache, entry, t ) )
+    {
+        ssl_cache_evict( shard, entry );
+        goto exit;
+    }
+
+    if( session->ciphersuite != entry->session.ciphersuite ||
+        session->compression != entry->session.compression )
+        goto exit;
 
-        __movsb( session->master, entry->session.master, 48 );
+    __movsb( session->master, entry->session.master, 48 );
 
-        session->verify_result = entry->session.verify_result;
+    session->verify_result = entry->session.verify_result;
 
 #if defined(POLARSSL_X509_CRT_PARSE_C)
-        /*
-         * Restore peer certificate (without rest of the original chain)
-         */
-        if( entry->peer_cert.p != NULL )
-        {
-            session->peer_cert =
-                (x509_crt *) memory_alloc( sizeof(x509_crt) );
-
-            if( session->peer_cert == NULL )
-            {
-                ret = 1;
-                goto exit;
-            }
-
-            x509_crt_init( session->peer_cert );
-            if( x509_crt_parse( session->peer_cert, entry->peer_cert.p,
-                                entry->peer_cert.len ) != 0 )
-            {
-                memory_free( session->peer_cert );
-                session->peer_cert = NULL;
-                ret = 1;
-                goto exit;
-            }
-        }
+    /*
+     * Hand out the already parsed peer certificate
+     */
+    x509_crt_release( session->peer_cert );
+    session->peer_cert = x509_crt_ref( entry->session.peer_cert );
 #endif /* POLARSSL_X509_CRT_PARSE_C */
 
-        ret = 0;
-        goto exit;
-    }
+    ret = 0;
 
 exit:
+    mutex_unlock( &shard->lock );
+
     return( ret );
 }
 
 int ssl_cache_set( void *data, const ssl_session *session )
 {
     int ret = 1;
-    time_t t = time( NULL ), oldest = 0;
-    ssl_cache_entry *old = NULL;
+    time_t t;
+    uint32_t hash;
+    int shard_max;
     ssl_cache_context *cache = (ssl_cache_context *) data;
-    ssl_cache_entry *cur, *prv;
-    int count = 0;
+    ssl_cache_shard *shard;
+    ssl_cache_entry *cur, **bucket;
 
-    cur = cache->chain;
-    prv = NULL;
+    if( session->length > sizeof( session->id ) )
+        return( 1 );
 
-    while( cur != NULL )
-    {
-        count++;
-
-        if( cache->timeout != 0 &&
-            (int) ( t - cur->timestamp ) > cache->timeout )
-        {
-            cur->timestamp = t;
-            break; /* expired, reuse this slot, update timestamp */
-        }
+    hash = ssl_cache_hash( session->id, session->length );
+    shard = SSL_CACHE_SHARD_OF( cache, hash );
+    bucket = SSL_CACHE_BUCKET_OF( shard, hash );
+    shard_max = ( cache->max_entries + SSL_CACHE_SHARDS - 1 ) / SSL_CACHE_SHARDS;
+    t = time( NULL );
 
-        if( memcmp( session->id, cur->session.id, cur->session.length ) == 0 )
-            break; /* client reconnected, keep timestamp for session id */
+    mutex_lock( &shard->lock );
 
-        if( oldest == 0 || cur->timestamp < oldest )
-        {
-            oldest = cur->timestamp;
-            old = cur;
-        }
+    ssl_cache_expire( cache, shard, t );
 
-        prv = cur;
-        cur = cur->next;
+    cur = ssl_cache_find( shard, session, hash );
+    if( cur != NULL )
+    {
+        /* client reconnected, keep timestamp for session id */
+        ssl_session_free( &cur->session );
     }
-
-    if( cur == NULL )
+    else
     {
+        if( shard_max == 0 )
+            goto exit;
+
         /*
          * Reuse oldest entry if max_entries reached
          */
-        if( count >= cache->max_entries )
-        {
-            if( old == NULL )
-            {
-                ret = 1;
-                goto exit;
-            }
+        if( shard->count >= shard_max )
+            ssl_cache_evict( shard,
+                QUEUE_DATA( queue_head( &shard->lru ), ssl_cache_entry, lru ) );
 
-            cur = old;
-        }
-        else
-        {
-            /*
-             * max_entries not reached, create new entry
-             */
-            cur = (ssl_cache_entry *)
-                        memory_alloc( sizeof(ssl_cache_entry) );
-            if( cur == NULL )
-            {
-                ret = 1;
-                goto exit;
-            }
-
-            __stosb( cur, 0, sizeof(ssl_cache_entry) );
-
-            if( prv == NULL )
-                cache->chain = cur;
-            else
-                prv->next = cur;
-        }
+        cur = (ssl_cache_entry *) memory_alloc( sizeof(ssl_cache_entry) );
+        if( cur == NULL )
+            goto exit;
+
+        __stosb( cur, 0, sizeof(ssl_cache_entry) );
 
         cur->timestamp = t;
+        cur->hash = hash;
+        cur->next = *bucket;
+        *bucket = cur;
+        queue_insert_tail( &shard->lru, &cur->lru );
+        shard->count++;
     }
 
     __movsb( &cur->session, session, sizeof( ssl_session ) );
 
 #if defined(POLARSSL_X509_CRT_PARSE_C)
     /*
-     * If we're reusing an entry, memory_free its certificate first
+     * Keep the parsed peer certificate, shared with the live session
      */
-    if( cur->peer_cert.p != NULL )
-    {
-        memory_free( cur->peer_cert.p );
-        __stosb( &cur->peer_cert, 0, sizeof(x509_buf) );
-    }
-
-    /*
-     * Store peer certificate
-     */
-    if( session->peer_cert != NULL )
-    {
-        cur->peer_cert.p = (uint8_t *)
-                                memory_alloc( session->peer_cert->raw.len );
-        if( cur->peer_cert.p == NULL )
-        {
-            ret = 1;
-            goto exit;
-        }
-
-        __movsb( cur->peer_cert.p, session->peer_cert->raw.p,
-                session->peer_cert->raw.len );
-        cur->peer_cert.len = session->peer_cert->raw.len;
-
-        cur->session.peer_cert = NULL;
-    }
+    cur->session.peer_cert = x509_crt_ref( session->peer_cert );
 #endif /* POLARSSL_X509_CRT_PARSE_C */
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    cur->session.ticket = NULL;
+    cur->session.ticket_len = 0;
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
     ret = 0;
 
 exit:
+    mutex_unlock( &shard->lock );
+
     return( ret );
 }
 
@@ -212,23 +254,20 @@ void ssl_cache_set_max_entries( ssl_cache_context *cache, int max )
 
 void ssl_cache_free( ssl_cache_context *cache )
 {
-    ssl_cache_entry *cur, *prv;
-
-    cur = cache->chain;
+    ssl_cache_shard *shard;
+    int i;
 
-    while( cur != NULL )
+    for( i = 0; i < SSL_CACHE_SHARDS; i++ )
     {
-        prv = cur;
-        cur = cur->next;
+        shard = &cache->shards[i];
 
-        ssl_session_free( &prv->session );
-
-#if defined(POLARSSL_X509_CRT_PARSE_C)
-        if( prv->peer_cert.p != NULL )
-            memory_free( prv->peer_cert.p );
-#endif /* POLARSSL_X509_CRT_PARSE_C */
+        while( ! queue_empty( &shard->lru ) )
+        {
+            ssl_cache_evict( shard,
+                QUEUE_DATA( queue_head( &shard->lru ), ssl_cache_entry, lru ) );
+        }
 
-        memory_free( prv );
+        mutex_destroy( &shard->lock );
     }
 }
 
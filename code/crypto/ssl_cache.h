@@ -19,6 +19,14 @@
 #define SSL_CACHE_DEFAULT_MAX_ENTRIES      50   /*!< Maximum entries in cache */
 #endif
 
+#if !defined(SSL_CACHE_SHARDS)
+#define SSL_CACHE_SHARDS                   16   /*!< Independently locked shards (power of 2) */
+#endif
+
+#if !defined(SSL_CACHE_SHARD_BUCKETS)
+#define SSL_CACHE_SHARD_BUCKETS            64   /*!< Hash buckets per shard (power of 2) */
+#endif
+
 /* \} name SECTION: Module settings */
 
 #ifdef __cplusplus
@@ -26,6 +34,7 @@ extern "C" {
 #endif
 
 typedef struct _ssl_cache_context ssl_cache_context;
+typedef struct _ssl_cache_shard ssl_cache_shard;
 typedef struct _ssl_cache_entry ssl_cache_entry;
 
 /**
@@ -34,11 +43,22 @@ typedef struct _ssl_cache_entry ssl_cache_entry;
 struct _ssl_cache_entry
 {
     time_t timestamp;           /*!< entry timestamp    */
-    ssl_session session;        /*!< entry session      */
-#if defined(POLARSSL_X509_CRT_PARSE_C)
-    x509_buf peer_cert;         /*!< entry peer_cert    */
-#endif
-    ssl_cache_entry *next;      /*!< chain pointer      */
+    uint32_t hash;              /*!< session id hash    */
+    ssl_session session;        /*!< entry session, peer_cert is kept
+                                     parsed and shared by reference   */
+    ssl_cache_entry *next;      /*!< bucket chain pointer             */
+    QUEUE lru;                  /*!< shard age queue, oldest at head  */
+};
+
+/**
+ * \brief   One independently locked slice of the cache
+ */
+struct _ssl_cache_shard
+{
+    mutex_t lock;                                       /*!< shard lock     */
+    ssl_cache_entry *buckets[SSL_CACHE_SHARD_BUCKETS];  /*!< hash buckets   */
+    QUEUE lru;                                          /*!< age queue      */
+    int count;                                          /*!< entries in use */
 };
 
 /**
@@ -46,7 +66,7 @@ struct _ssl_cache_entry
  */
 struct _ssl_cache_context
 {
-    ssl_cache_entry *chain;     /*!< start of the chain     */
+    ssl_cache_shard shards[SSL_CACHE_SHARDS];   /*!< hashed shards          */
     int timeout;                /*!< cache entry timeout    */
     int max_entries;            /*!< maximum entries        */
 };
@@ -60,7 +80,8 @@ void ssl_cache_init( ssl_cache_context *cache );
 
 /**
  * \brief          Cache get callback implementation
- *                 (Thread-safe if POLARSSL_THREADING_C is enabled)
+ *                 (Thread-safe, only the shard owning the session id is
+ *                 locked)
  *
  * \param data     SSL cache context
  * \param session  session to retrieve entry for
@@ -69,7 +90,8 @@ int ssl_cache_get( void *data, ssl_session *session );
 
 /**
  * \brief          Cache set callback implementation
- *                 (Thread-safe if POLARSSL_THREADING_C is enabled)
+ *                 (Thread-safe, only the shard owning the session id is
+ *                 locked)
  *
  * \param data     SSL cache context
  * \param session  session to store entry for
@@ -88,9 +110,11 @@ int ssl_cache_set( void *data, const ssl_session *session );
 void ssl_cache_set_timeout( ssl_cache_context *cache, int timeout );
 
 /**
- * \brief          Set the cache timeout
+ * \brief          Set the maximum number of entries
  *                 (Default: SSL_CACHE_DEFAULT_MAX_ENTRIES (50))
  *
+ *                 The limit is split evenly between the shards.
+ *
  * \param cache    SSL cache context
  * \param max      cache entry maximum
  */
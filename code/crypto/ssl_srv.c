@@ -250,6 +250,503 @@ static int ssl_parse_truncated_hmac_ext( ssl_context *ssl,
 }
 #endif /* POLARSSL_SSL_TRUNCATED_HMAC */
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+/*
+ * Fill a ticket key slot from raw key material
+ */
+static void ssl_ticket_key_set( ssl_ticket_key *key,
+                                const uint8_t key_name[16],
+                                const uint8_t enc_key[32],
+                                const uint8_t mac_key[32] )
+{
+    __movsb( key->key_name, key_name, 16 );
+    aes_setkey_enc( &key->enc, enc_key );
+    aes_setkey_dec( &key->dec, enc_key );
+    __movsb( key->mac_key, mac_key, 32 );
+    key->generation = time( NULL );
+}
+
+/*
+ * Advance to the next (oldest) slot and make it the active one.
+ * Must be called with the write lock held.
+ */
+static ssl_ticket_key *ssl_ticket_keys_next( ssl_ticket_keys *keys )
+{
+    keys->active = ( keys->active + 1 ) % SSL_TICKET_KEYS;
+
+    if( keys->count < SSL_TICKET_KEYS )
+        keys->count++;
+
+    return( &keys->keys[keys->active] );
+}
+
+/*
+ * Generate a random key in the next slot.
+ * Must be called with the write lock held.
+ */
+static int ssl_ticket_keys_generate( ssl_ticket_keys *keys )
+{
+    int ret;
+    uint8_t buf[16 + 32 + 32];
+
+    if( keys->f_rng == NULL )
+        return( POLARSSL_ERR_SSL_NO_RNG );
+
+    if( ( ret = keys->f_rng( keys->p_rng, buf, sizeof( buf ) ) ) != 0 )
+        return( ret );
+
+    ssl_ticket_key_set( ssl_ticket_keys_next( keys ), buf, buf + 16, buf + 48 );
+
+    __stosb( buf, 0, sizeof( buf ) );
+
+    return( 0 );
+}
+
+int ssl_ticket_keys_init( ssl_ticket_keys *keys,
+                          int (*f_rng)(void *, uint8_t *, size_t),
+                          void *p_rng, int rotation )
+{
+    __stosb( keys, 0, sizeof( ssl_ticket_keys ) );
+
+    async_rwlock_init( &keys->lock );
+
+    keys->active = SSL_TICKET_KEYS - 1;
+    keys->rotation = rotation < 0 ? 0 : rotation;
+    keys->f_rng = f_rng;
+    keys->p_rng = p_rng;
+
+    if( f_rng == NULL )
+        return( 0 );
+
+    return( ssl_ticket_keys_generate( keys ) );
+}
+
+int ssl_ticket_keys_rotate( ssl_ticket_keys *keys )
+{
+    int ret;
+
+    async_rwlock_wrlock( &keys->lock );
+    ret = ssl_ticket_keys_generate( keys );
+    async_rwlock_wrunlock( &keys->lock );
+
+    return( ret );
+}
+
+void ssl_ticket_keys_add( ssl_ticket_keys *keys, const uint8_t key_name[16],
+                          const uint8_t enc_key[32],
+                          const uint8_t mac_key[32] )
+{
+    async_rwlock_wrlock( &keys->lock );
+    ssl_ticket_key_set( ssl_ticket_keys_next( keys ), key_name, enc_key, mac_key );
+    async_rwlock_wrunlock( &keys->lock );
+}
+
+void ssl_ticket_keys_free( ssl_ticket_keys *keys )
+{
+    async_rwlock_destroy( &keys->lock );
+
+    __stosb( keys, 0, sizeof( ssl_ticket_keys ) );
+}
+
+/*
+ * Rotate the active key once it is older than the rotation interval.
+ * The common case only takes the read lock.
+ */
+static void ssl_ticket_keys_check_rotation( ssl_ticket_keys *keys )
+{
+    time_t t;
+    int due;
+
+    if( keys->rotation == 0 )
+        return;
+
+    t = time( NULL );
+
+    async_rwlock_rdlock( &keys->lock );
+    due = keys->count == 0 ||
+          (int) ( t - keys->keys[keys->active].generation ) >= keys->rotation;
+    async_rwlock_rdunlock( &keys->lock );
+
+    if( ! due )
+        return;
+
+    async_rwlock_wrlock( &keys->lock );
+
+    /* Somebody else may have rotated while we were waiting */
+    if( keys->count == 0 ||
+        (int) ( t - keys->keys[keys->active].generation ) >= keys->rotation )
+    {
+        /* On RNG failure, keep sealing with the current key */
+        ssl_ticket_keys_generate( keys );
+    }
+
+    async_rwlock_wrunlock( &keys->lock );
+}
+
+/*
+ * Serialize a session in the following format:
+ *  0   .   n-1     session structure, n = sizeof(ssl_session)
+ *  n   .   n+2     peer_cert length = m (0 if no certificate)
+ *  n+3 .   n+2+m   peer cert ASN.1
+ */
+static int ssl_save_session( const ssl_session *session,
+                             uint8_t *buf, size_t buf_len,
+                             size_t *olen )
+{
+    uint8_t *p = buf;
+    size_t left = buf_len;
+#if defined(POLARSSL_X509_CRT_PARSE_C)
+    size_t cert_len;
+#endif /* POLARSSL_X509_CRT_PARSE_C */
+
+    if( left < sizeof( ssl_session ) )
+        return( POLARSSL_ERR_SSL_CERTIFICATE_TOO_LARGE );
+
+    __movsb( p, session, sizeof( ssl_session ) );
+    p += sizeof( ssl_session );
+    left -= sizeof( ssl_session );
+
+#if defined(POLARSSL_X509_CRT_PARSE_C)
+    if( session->peer_cert == NULL )
+        cert_len = 0;
+    else
+        cert_len = session->peer_cert->raw.len;
+
+    if( left < 3 + cert_len )
+        return( POLARSSL_ERR_SSL_CERTIFICATE_TOO_LARGE );
+
+    *p++ = (uint8_t)( cert_len >> 16 & 0xFF );
+    *p++ = (uint8_t)( cert_len >>  8 & 0xFF );
+    *p++ = (uint8_t)( cert_len       & 0xFF );
+
+    if( session->peer_cert != NULL )
+        __movsb( p, session->peer_cert->raw.p, cert_len );
+
+    p += cert_len;
+#endif /* POLARSSL_X509_CRT_PARSE_C */
+
+    *olen = p - buf;
+
+    return( 0 );
+}
+
+/*
+ * Unserialize session, see ssl_save_session() for format.
+ */
+static int ssl_load_session( ssl_session *session,
+                             const uint8_t *buf, size_t len )
+{
+    const uint8_t *p = buf;
+    const uint8_t * const end = buf + len;
+#if defined(POLARSSL_X509_CRT_PARSE_C)
+    int ret;
+    size_t cert_len;
+#endif /* POLARSSL_X509_CRT_PARSE_C */
+
+    if( p + sizeof( ssl_session ) > end )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    __movsb( session, p, sizeof( ssl_session ) );
+    p += sizeof( ssl_session );
+
+    /* Pointers saved in the sealed state mean nothing here */
+#if defined(POLARSSL_X509_CRT_PARSE_C)
+    session->peer_cert = NULL;
+#endif /* POLARSSL_X509_CRT_PARSE_C */
+    session->ticket = NULL;
+    session->ticket_len = 0;
+
+    if( session->length > sizeof( session->id ) )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+#if defined(POLARSSL_X509_CRT_PARSE_C)
+    if( p + 3 > end )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    cert_len = ( p[0] << 16 ) | ( p[1] << 8 ) | p[2];
+    p += 3;
+
+    if( cert_len != 0 )
+    {
+        if( p + cert_len > end )
+            return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+        session->peer_cert = (x509_crt *) memory_alloc( sizeof( x509_crt ) );
+
+        if( session->peer_cert == NULL )
+            return( POLARSSL_ERR_SSL_MALLOC_FAILED );
+
+        x509_crt_init( session->peer_cert );
+
+        if( ( ret = x509_crt_parse_der( session->peer_cert,
+                                        p, cert_len ) ) != 0 )
+        {
+            x509_crt_release( session->peer_cert );
+            session->peer_cert = NULL;
+            return( ret );
+        }
+
+        p += cert_len;
+    }
+#endif /* POLARSSL_X509_CRT_PARSE_C */
+
+    if( p != end )
+    {
+        ssl_session_free( session );
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+    }
+
+    return( 0 );
+}
+
+/*
+ * Create session ticket, sealed with the active key of the key ring.
+ * Encrypt-then-MAC with AES-256-CBC and HMAC-SHA-256, as recommended by
+ * RFC 5077 section 4:
+ *
+ * struct {
+ *     opaque key_name[16];
+ *     opaque iv[16];
+ *     opaque encrypted_state<0..2^16-1>;
+ *     opaque mac[32];
+ * } ticket;
+ *
+ * (the internal state structure differs, however).
+ */
+static int ssl_write_ticket( ssl_context *ssl, size_t *tlen )
+{
+    int ret;
+    ssl_ticket_keys *keys = ssl->ticket_keys;
+    ssl_ticket_key *key;
+    uint8_t * const start = ssl->out_msg + 10;
+    uint8_t *p = start;
+    uint8_t *state;
+    uint8_t iv[16];
+    size_t clear_len, enc_len, pad_len, i;
+
+    *tlen = 0;
+
+    if( keys == NULL )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    ssl_ticket_keys_check_rotation( keys );
+
+    /* Generate IV (with a copy for aes_crypt) */
+    if( ( ret = ssl->f_rng( ssl->p_rng, p + 16, 16 ) ) != 0 )
+        return( ret );
+
+    __movsb( iv, p + 16, 16 );
+
+    /*
+     * Dump session state
+     *
+     * After the session state itself, we still need room for 16 bytes of
+     * padding and 32 bytes of MAC, so there's only so much room left
+     */
+    state = p + 34;
+    if( ( ret = ssl_save_session( ssl->session_negotiate, state,
+                SSL_MAX_CONTENT_LEN - ( state - ssl->out_msg ) - 48,
+                &clear_len ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    /* Apply PKCS padding */
+    pad_len = 16 - clear_len % 16;
+    enc_len = clear_len + pad_len;
+    for( i = clear_len; i < enc_len; i++ )
+        state[i] = (uint8_t) pad_len;
+
+    async_rwlock_rdlock( &keys->lock );
+
+    if( keys->count == 0 )
+    {
+        ret = POLARSSL_ERR_SSL_BAD_INPUT_DATA;
+        goto exit;
+    }
+
+    key = &keys->keys[keys->active];
+
+    /* Write key name */
+    __movsb( p, key->key_name, 16 );
+    p += 32;
+
+    /* Encrypt */
+    if( ( ret = aes_crypt_cbc( &key->enc, AES_ENCRYPT,
+                               enc_len, iv, state, state ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Write length */
+    *p++ = (uint8_t)( ( enc_len >> 8 ) & 0xFF );
+    *p++ = (uint8_t)( ( enc_len      ) & 0xFF );
+    p = state + enc_len;
+
+    /* Compute and write MAC( key_name + iv + enc_state_len + enc_state ) */
+    sha256_hmac( key->mac_key, 32, start, p - start, p, 0 );
+    p += 32;
+
+    *tlen = p - start;
+
+exit:
+    async_rwlock_rdunlock( &keys->lock );
+
+    return( ret );
+}
+
+/*
+ * Load session ticket (see ssl_write_ticket for structure).
+ * On success *renew is set if the ticket was sealed with a retired key.
+ */
+static int ssl_parse_ticket( ssl_context *ssl,
+                             uint8_t *buf, size_t len, int *renew )
+{
+    int ret, k;
+    ssl_ticket_keys *keys = ssl->ticket_keys;
+    ssl_ticket_key *key = NULL;
+    ssl_session session;
+    uint8_t *key_name = buf;
+    uint8_t *iv = buf + 16;
+    uint8_t *enc_len_p = iv + 16;
+    uint8_t *ticket = enc_len_p + 2;
+    uint8_t *mac;
+    uint8_t computed_mac[32];
+    size_t enc_len, clear_len, i;
+    uint8_t pad_len, diff;
+
+    if( len < 34 || keys == NULL )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    enc_len = ( enc_len_p[0] << 8 ) | enc_len_p[1];
+    mac = ticket + enc_len;
+
+    if( len != enc_len + 66 || enc_len == 0 || enc_len % 16 != 0 )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    async_rwlock_rdlock( &keys->lock );
+
+    /* Key names are not secret, newest key first */
+    for( k = 0; k < keys->count; k++ )
+    {
+        i = ( keys->active + SSL_TICKET_KEYS - k ) % SSL_TICKET_KEYS;
+
+        if( memcmp( key_name, keys->keys[i].key_name, 16 ) == 0 )
+        {
+            key = &keys->keys[i];
+            break;
+        }
+    }
+
+    if( key == NULL )
+    {
+        ret = POLARSSL_ERR_SSL_BAD_INPUT_DATA;
+        goto exit;
+    }
+
+    *renew = ( k != 0 );
+
+    /* Check mac, with constant-time buffer comparison */
+    sha256_hmac( key->mac_key, 32, buf, len - 32, computed_mac, 0 );
+
+    diff = 0;
+    for( i = 0; i < 32; i++ )
+        diff |= mac[i] ^ computed_mac[i];
+
+    /* Now return if ticket is not authentic, since we want to avoid
+     * decrypting arbitrary attacker-chosen data */
+    if( diff != 0 )
+    {
+        ret = POLARSSL_ERR_SSL_INVALID_MAC;
+        goto exit;
+    }
+
+    /* Decrypt */
+    ret = aes_crypt_cbc( &key->dec, AES_DECRYPT, enc_len, iv, ticket, ticket );
+
+exit:
+    async_rwlock_rdunlock( &keys->lock );
+
+    if( ret != 0 )
+        return( ret );
+
+    /* Check PKCS padding */
+    pad_len = ticket[enc_len - 1];
+
+    if( pad_len == 0 || pad_len > 16 )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    for( i = 2; i <= pad_len; i++ )
+        if( ticket[enc_len - i] != pad_len )
+            return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    clear_len = enc_len - pad_len;
+
+    /* Actually load session */
+    if( ( ret = ssl_load_session( &session, ticket, clear_len ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    /* Check if still valid */
+    if( (int) ( time( NULL) - session.start ) > ssl->ticket_lifetime )
+    {
+        ssl_session_free( &session );
+        return( POLARSSL_ERR_SSL_SESSION_TICKET_EXPIRED );
+    }
+
+    /*
+     * Keep the session ID sent by the client, since we MUST send it back to
+     * inform him we're accepting the ticket  (RFC 5077 section 3.4)
+     */
+    session.length = ssl->session_negotiate->length;
+    __movsb( &session.id, ssl->session_negotiate->id, session.length );
+
+    ssl_session_free( ssl->session_negotiate );
+    __movsb( ssl->session_negotiate, &session, sizeof( ssl_session ) );
+
+    /* Zeroize instead of free as we copied the content */
+    __stosb( &session, 0, sizeof( ssl_session ) );
+
+    return( 0 );
+}
+
+static int ssl_parse_session_ticket_ext( ssl_context *ssl,
+                                         uint8_t *buf,
+                                         size_t len )
+{
+    int renew = 0;
+
+    if( ssl->session_tickets == SSL_SESSION_TICKETS_DISABLED ||
+        ssl->ticket_keys == NULL )
+    {
+        return( 0 );
+    }
+
+    /* Remember the client asked us to send a new ticket */
+    ssl->handshake->new_session_ticket = 1;
+
+    if( len == 0 )
+        return( 0 );
+
+    if( ssl->renegotiation != SSL_INITIAL_HANDSHAKE )
+        return( 0 );
+
+    /*
+     * Failures are ok: just ignore the ticket and proceed.
+     */
+    if( ssl_parse_ticket( ssl, buf, len, &renew ) != 0 )
+        return( 0 );
+
+    ssl->handshake->resume = 1;
+
+    /* Only reissue tickets sealed with a retired key */
+    ssl->handshake->new_session_ticket = renew;
+
+    return( 0 );
+}
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
 #if defined(POLARSSL_SSL_ALPN)
 static int ssl_parse_alpn_ext( ssl_context *ssl,
                                const uint8_t *buf, size_t len )
@@ -858,6 +1355,14 @@ static int ssl_parse_client_hello( ssl_context *ssl )
             break;
 #endif /* POLARSSL_SSL_TRUNCATED_HMAC */
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+        case TLS_EXT_SESSION_TICKET:
+            ret = ssl_parse_session_ticket_ext( ssl, ext + 4, ext_size );
+            if( ret != 0 )
+                return( ret );
+            break;
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
 #if defined(POLARSSL_SSL_ALPN)
         case TLS_EXT_ALPN:
             ret = ssl_parse_alpn_ext( ssl, ext + 4, ext_size );
@@ -941,6 +1446,19 @@ static int ssl_parse_client_hello( ssl_context *ssl )
     return( POLARSSL_ERR_SSL_NO_CIPHER_CHOSEN );
 
 have_ciphersuite:
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    /*
+     * A ticket is only good for the ciphersuite it was issued with,
+     * otherwise fall back to a full handshake and a fresh ticket
+     */
+    if( ssl->handshake->resume != 0 &&
+        ssl->session_negotiate->ciphersuite != ciphersuites[i] )
+    {
+        ssl->handshake->resume = 0;
+        ssl->handshake->new_session_ticket = 1;
+    }
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
     ssl->session_negotiate->ciphersuite = ciphersuites[i];
     ssl->transform_negotiate->ciphersuite_info = ciphersuite_info;
     ssl_optimize_checksum( ssl, ssl->transform_negotiate->ciphersuite_info );
@@ -974,6 +1492,29 @@ static void ssl_write_truncated_hmac_ext( ssl_context *ssl,
 }
 #endif /* POLARSSL_SSL_TRUNCATED_HMAC */
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+static void ssl_write_session_ticket_ext( ssl_context *ssl,
+                                          uint8_t *buf,
+                                          size_t *olen )
+{
+    uint8_t *p = buf;
+
+    if( ssl->handshake->new_session_ticket == 0 )
+    {
+        *olen = 0;
+        return;
+    }
+
+    *p++ = (uint8_t)( ( TLS_EXT_SESSION_TICKET >> 8 ) & 0xFF );
+    *p++ = (uint8_t)( ( TLS_EXT_SESSION_TICKET      ) & 0xFF );
+
+    *p++ = 0x00;
+    *p++ = 0x00;
+
+    *olen = 4;
+}
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
 void ssl_write_renegotiation_ext( ssl_context *ssl,
                                          uint8_t *buf,
                                          size_t *olen )
@@ -1142,6 +1683,14 @@ static int ssl_write_server_hello( ssl_context *ssl )
         ssl->state++;
         ssl->session_negotiate->start = time( NULL );
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+        if( ssl->handshake->new_session_ticket != 0 )
+        {
+            ssl->session_negotiate->length = n = 0;
+            __stosb( ssl->session_negotiate->id, 0, 32 );
+        }
+        else
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
         {
             ssl->session_negotiate->length = n = 32;
             if( ( ret = ssl->f_rng( ssl->p_rng, ssl->session_negotiate->id,
@@ -1195,6 +1744,11 @@ static int ssl_write_server_hello( ssl_context *ssl )
     ext_len += olen;
 #endif
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    ssl_write_session_ticket_ext( ssl, p + 2 + ext_len, &olen );
+    ext_len += olen;
+#endif
+
     ssl_write_supported_point_formats_ext( ssl, p + 2 + ext_len, &olen );
     ext_len += olen;
 
@@ -1664,6 +2218,55 @@ int ssl_parse_certificate_verify( ssl_context *ssl )
     return( ret );
 }
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+static int ssl_write_new_session_ticket( ssl_context *ssl )
+{
+    int ret;
+    size_t tlen;
+    uint32_t lifetime = (uint32_t) ssl->ticket_lifetime;
+
+    ssl->out_msgtype = SSL_MSG_HANDSHAKE;
+    ssl->out_msg[0]  = SSL_HS_NEW_SESSION_TICKET;
+
+    /*
+     * struct {
+     *     uint32 ticket_lifetime_hint;
+     *     opaque ticket<0..2^16-1>;
+     * } NewSessionTicket;
+     *
+     * 4  .  7   ticket_lifetime_hint (0 = unspecified)
+     * 8  .  9   ticket_len (n)
+     * 10 .  9+n ticket content
+     */
+    ssl->out_msg[4] = ( lifetime >> 24 ) & 0xFF;
+    ssl->out_msg[5] = ( lifetime >> 16 ) & 0xFF;
+    ssl->out_msg[6] = ( lifetime >>  8 ) & 0xFF;
+    ssl->out_msg[7] = ( lifetime       ) & 0xFF;
+
+    /* An empty ticket tells the client we changed our mind */
+    if( ssl_write_ticket( ssl, &tlen ) != 0 )
+        tlen = 0;
+
+    ssl->out_msg[8] = (uint8_t)( ( tlen >> 8 ) & 0xFF );
+    ssl->out_msg[9] = (uint8_t)( ( tlen      ) & 0xFF );
+
+    ssl->out_msglen = 10 + tlen;
+
+    /*
+     * Morally equivalent to updating ssl->state, but NewSessionTicket and
+     * ChangeCipherSpec share the same state.
+     */
+    ssl->handshake->new_session_ticket = 0;
+
+    if( ( ret = ssl_write_record( ssl ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    return( 0 );
+}
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
 /*
  * SSL handshake -- server side -- single step
  */
@@ -1750,7 +2353,12 @@ int ssl_handshake_server_step( ssl_context *ssl )
          *        Finished
          */
         case SSL_SERVER_CHANGE_CIPHER_SPEC:
-            ret = ssl_write_change_cipher_spec( ssl );
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+            if( ssl->handshake->new_session_ticket != 0 )
+                ret = ssl_write_new_session_ticket( ssl );
+            else
+#endif
+                ret = ssl_write_change_cipher_spec( ssl );
             break;
 
         case SSL_SERVER_FINISHED:
@@ -42,25 +42,25 @@ static int ssl_session_copy( ssl_session *dst, const ssl_session *src )
     __movsb( dst, src, sizeof( ssl_session ) );
 
 #if defined(POLARSSL_X509_CRT_PARSE_C)
-    if( src->peer_cert != NULL )
-    {
-        int ret;
-
-        dst->peer_cert = (x509_crt *) memory_alloc( sizeof(x509_crt) );
-        if( dst->peer_cert == NULL )
-            return( POLARSSL_ERR_SSL_MALLOC_FAILED );
-
-        x509_crt_init( dst->peer_cert );
+    /*
+     * The peer chain is never modified once parsed, share it
+     */
+    dst->peer_cert = x509_crt_ref( src->peer_cert );
+#endif /* POLARSSL_X509_CRT_PARSE_C */
 
-        if( ( ret = x509_crt_parse_der( dst->peer_cert, src->peer_cert->raw.p,
-                                    src->peer_cert->raw.len ) != 0 ) )
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    if( src->ticket != NULL )
+    {
+        dst->ticket = (uint8_t *) memory_alloc( src->ticket_len );
+        if( dst->ticket == NULL )
         {
-            memory_free( dst->peer_cert );
-            dst->peer_cert = NULL;
-            return( ret );
+            dst->ticket_len = 0;
+            return( POLARSSL_ERR_SSL_MALLOC_FAILED );
         }
+
+        __movsb( dst->ticket, src->ticket, src->ticket_len );
     }
-#endif /* POLARSSL_X509_CRT_PARSE_C */
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
 
     return( 0 );
 }
@@ -504,7 +504,12 @@ static int ssl_encrypt_buf( ssl_context *ssl )
 
 #define POLARSSL_SSL_MAX_MAC_SIZE   48
 
-static int ssl_decrypt_buf( ssl_context *ssl )
+/*
+ * Decrypt the record in in_msg into dst, which is either in_msg itself or a
+ * caller buffer with room for the ciphertext plus 256 bytes (the padding
+ * check always scans 256 bytes to stay constant time).
+ */
+static int ssl_decrypt_buf( ssl_context *ssl, uint8_t *dst )
 {
     size_t i;
     size_t padlen = 0, correct = 1;
@@ -545,7 +550,7 @@ static int ssl_decrypt_buf( ssl_context *ssl )
 
         dec_msglen = ssl->in_msglen;
         dec_msg = ssl->in_msg;
-        dec_msg_result = ssl->in_msg;
+        dec_msg_result = dst;
 
         /*
          * Initialize for prepended IV for block cipher in TLS v1.1 and up
@@ -590,7 +595,7 @@ static int ssl_decrypt_buf( ssl_context *ssl )
             return( POLARSSL_ERR_SSL_INTERNAL_ERROR );
         }
 
-        padlen = 1 + ssl->in_msg[ssl->in_msglen - 1];
+        padlen = 1 + dst[ssl->in_msglen - 1];
 
         if( ssl->in_msglen < ssl->transform_in->maclen + padlen )
         {
@@ -626,7 +631,7 @@ static int ssl_decrypt_buf( ssl_context *ssl )
             {
                 real_count &= ( i <= padlen );
                 pad_count += real_count *
-                             ( ssl->in_msg[padding_idx + i] == padlen - 1 );
+                             ( dst[padding_idx + i] == padlen - 1 );
             }
 
             correct &= ( pad_count == padlen ); /* Only 1 on correct padding */
@@ -653,7 +658,7 @@ static int ssl_decrypt_buf( ssl_context *ssl )
     ssl->in_hdr[3] = (uint8_t)( ssl->in_msglen >> 8 );
     ssl->in_hdr[4] = (uint8_t)( ssl->in_msglen      );
 
-    __movsb( tmp, ssl->in_msg + ssl->in_msglen, ssl->transform_in->maclen );
+    __movsb( tmp, dst + ssl->in_msglen, ssl->transform_in->maclen );
     if( ssl->minor_ver > SSL_MINOR_VERSION_0 )
     {
         /*
@@ -676,12 +681,12 @@ static int ssl_decrypt_buf( ssl_context *ssl )
         extra_run &= correct * 0xFF;
 
         md_hmac_update( &ssl->transform_in->md_ctx_dec, ssl->in_ctr, 13 );
-        md_hmac_update( &ssl->transform_in->md_ctx_dec, ssl->in_msg,
+        md_hmac_update( &ssl->transform_in->md_ctx_dec, dst,
                             ssl->in_msglen );
         md_hmac_finish( &ssl->transform_in->md_ctx_dec,
-                            ssl->in_msg + ssl->in_msglen );
+                            dst + ssl->in_msglen );
         for( j = 0; j < extra_run; j++ )
-            md_process( &ssl->transform_in->md_ctx_dec, ssl->in_msg );
+            md_process( &ssl->transform_in->md_ctx_dec, dst );
 
         md_hmac_reset( &ssl->transform_in->md_ctx_dec );
     }
@@ -690,7 +695,7 @@ static int ssl_decrypt_buf( ssl_context *ssl )
         return( POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE );
     }
 
-    if( safer_memcmp( tmp, ssl->in_msg + ssl->in_msglen,
+    if( safer_memcmp( tmp, dst + ssl->in_msglen,
                         ssl->transform_in->maclen ) != 0 )
     {
         correct = 0;
@@ -731,6 +736,274 @@ static int ssl_decrypt_buf( ssl_context *ssl )
     return( 0 );
 }
 
+/*
+ * Record buffers
+ *
+ * in_ctr / out_ctr are only held while a handshake runs or a record is in
+ * flight. In between they go back to a process wide pool of slabs, one free
+ * list per max_fragment_length class, so idle connections cost no buffer
+ * memory and busy ones don't hit the heap for every record. The 8-byte
+ * record counter at the head of each buffer is parked in the context.
+ * Until the pool is ready (async_once() gave up) buffers come straight
+ * from the heap and go back to it.
+ */
+typedef struct _ssl_buffer_slab
+{
+    struct _ssl_buffer_slab *next;
+}
+ssl_buffer_slab;
+
+typedef struct
+{
+    mutex_t lock;
+    ssl_buffer_slab *head;
+    int count;
+}
+ssl_buffer_list;
+
+static ssl_buffer_list ssl_buffer_pool[SSL_MAX_FRAG_LEN_INVALID];
+static async_once_t ssl_buffer_pool_once = ASYNC_ONCE_INIT;
+static volatile int ssl_buffer_pool_ready;
+
+static void ssl_buffer_pool_init( void )
+{
+    int i;
+
+    for( i = 0; i < SSL_MAX_FRAG_LEN_INVALID; i++ )
+        mutex_init( &ssl_buffer_pool[i].lock );
+
+    ssl_buffer_pool_ready = 1;
+}
+
+/*
+ * Usable length of a buffer of the given class. Slabs are allocated 256
+ * bytes larger, for the constant-time padding scan of ssl_decrypt_buf.
+ */
+static size_t ssl_buffer_len( int mfl )
+{
+#if defined(POLARSSL_SSL_MAX_FRAGMENT_LENGTH)
+    return( mfl_code_to_length[mfl] + SSL_BUFFER_LEN - SSL_MAX_CONTENT_LEN );
+#else
+    ((void) mfl);
+    return( SSL_BUFFER_LEN );
+#endif
+}
+
+static uint8_t *ssl_buffer_get( int mfl )
+{
+    ssl_buffer_list *list = &ssl_buffer_pool[mfl];
+    ssl_buffer_slab *slab;
+
+    async_once( &ssl_buffer_pool_once, ssl_buffer_pool_init );
+
+    if( !ssl_buffer_pool_ready )
+        return( (uint8_t *) memory_alloc( ssl_buffer_len( mfl ) + 256 ) );
+
+    mutex_lock( &list->lock );
+
+    slab = list->head;
+    if( slab != NULL )
+    {
+        list->head = slab->next;
+        list->count--;
+    }
+
+    mutex_unlock( &list->lock );
+
+    if( slab == NULL )
+        return( (uint8_t *) memory_alloc( ssl_buffer_len( mfl ) + 256 ) );
+
+    slab->next = NULL;
+
+    return( (uint8_t *) slab );
+}
+
+static void ssl_buffer_put( int mfl, uint8_t *buf )
+{
+    ssl_buffer_list *list = &ssl_buffer_pool[mfl];
+    ssl_buffer_slab *slab = (ssl_buffer_slab *) buf;
+
+    /* Don't let plaintext leak into the next connection */
+    __stosb( buf, 0, ssl_buffer_len( mfl ) + 256 );
+
+    if( !ssl_buffer_pool_ready )
+    {
+        memory_free( buf );
+        return;
+    }
+
+    mutex_lock( &list->lock );
+
+    if( list->count < SSL_BUFFER_POOL_SLABS )
+    {
+        slab->next = list->head;
+        list->head = slab;
+        list->count++;
+        slab = NULL;
+    }
+
+    mutex_unlock( &list->lock );
+
+    if( slab != NULL )
+        memory_free( slab );
+}
+
+/*
+ * Buffers are full size while handshaking and sized by the negotiated
+ * max_fragment_length afterwards
+ */
+static int ssl_in_buf_mfl( const ssl_context *ssl )
+{
+#if defined(POLARSSL_SSL_MAX_FRAGMENT_LENGTH)
+    if( ssl->state == SSL_HANDSHAKE_OVER && ssl->session_in != NULL )
+        return( ssl->session_in->mfl_code );
+#endif /* POLARSSL_SSL_MAX_FRAGMENT_LENGTH */
+
+    ((void) ssl);
+    return( SSL_MAX_FRAG_LEN_NONE );
+}
+
+static int ssl_out_buf_mfl( const ssl_context *ssl )
+{
+#if defined(POLARSSL_SSL_MAX_FRAGMENT_LENGTH)
+    int mfl = ssl->mfl_code;
+
+    if( ssl->state != SSL_HANDSHAKE_OVER )
+        return( SSL_MAX_FRAG_LEN_NONE );
+
+    if( ssl->session_out != NULL &&
+        mfl_code_to_length[ssl->session_out->mfl_code] <
+        mfl_code_to_length[mfl] )
+    {
+        mfl = ssl->session_out->mfl_code;
+    }
+
+    return( mfl );
+#else
+    ((void) ssl);
+    return( SSL_MAX_FRAG_LEN_NONE );
+#endif /* POLARSSL_SSL_MAX_FRAGMENT_LENGTH */
+}
+
+/*
+ * No partial or unconsumed record in the input buffer. While handshaking,
+ * the last handshake message read may still be parsed from in_msg (e.g. a
+ * ClientHello that triggered renegotiation).
+ */
+static int ssl_in_buf_idle( const ssl_context *ssl )
+{
+    return( ssl->in_left == 0 && ssl->in_offt == NULL &&
+            ssl->record_read == 0 &&
+            ( ssl->in_hslen == 0 ||
+              ( ssl->state == SSL_HANDSHAKE_OVER &&
+                ssl->in_hslen >= ssl->in_msglen ) ) );
+}
+
+static void ssl_release_in_buf( ssl_context *ssl )
+{
+    __movsb( ssl->in_ctr_saved, ssl->in_ctr, 8 );
+    ssl_buffer_put( ssl->in_buf_mfl, ssl->in_ctr );
+
+    ssl->in_ctr = NULL;
+    ssl->in_hdr = NULL;
+    ssl->in_iv  = NULL;
+    ssl->in_msg = NULL;
+    ssl->in_buf_len = 0;
+}
+
+static void ssl_release_out_buf( ssl_context *ssl )
+{
+    __movsb( ssl->out_ctr_saved, ssl->out_ctr, 8 );
+    ssl_buffer_put( ssl->out_buf_mfl, ssl->out_ctr );
+
+    ssl->out_ctr = NULL;
+    ssl->out_hdr = NULL;
+    ssl->out_iv  = NULL;
+    ssl->out_msg = NULL;
+}
+
+/*
+ * Make sure in_ctr holds a buffer of the wanted class. A held buffer of
+ * another class is only swapped while idle.
+ */
+static int ssl_acquire_in_buf( ssl_context *ssl )
+{
+    int mfl = ssl_in_buf_mfl( ssl );
+
+    if( ssl->in_ctr != NULL )
+    {
+        if( ssl->in_buf_mfl == mfl || ! ssl_in_buf_idle( ssl ) )
+            return( 0 );
+
+        ssl_release_in_buf( ssl );
+    }
+
+    if( ( ssl->in_ctr = ssl_buffer_get( mfl ) ) == NULL )
+        return( POLARSSL_ERR_SSL_MALLOC_FAILED );
+
+    __movsb( ssl->in_ctr, ssl->in_ctr_saved, 8 );
+
+    ssl->in_buf_mfl = mfl;
+    ssl->in_buf_len = ssl_buffer_len( mfl );
+    ssl->in_hdr = ssl->in_ctr +  8;
+    ssl->in_iv  = ssl->in_ctr + 13;
+    ssl->in_msg = ssl->in_iv;
+
+    if( ssl->transform_in != NULL && ssl->minor_ver >= SSL_MINOR_VERSION_2 )
+    {
+        ssl->in_msg += ssl->transform_in->ivlen -
+                       ssl->transform_in->fixed_ivlen;
+    }
+
+    return( 0 );
+}
+
+static int ssl_acquire_out_buf( ssl_context *ssl )
+{
+    int mfl = ssl_out_buf_mfl( ssl );
+
+    if( ssl->out_ctr != NULL )
+    {
+        if( ssl->out_buf_mfl == mfl || ssl->out_left != 0 )
+            return( 0 );
+
+        ssl_release_out_buf( ssl );
+    }
+
+    if( ( ssl->out_ctr = ssl_buffer_get( mfl ) ) == NULL )
+        return( POLARSSL_ERR_SSL_MALLOC_FAILED );
+
+    __movsb( ssl->out_ctr, ssl->out_ctr_saved, 8 );
+
+    ssl->out_buf_mfl = mfl;
+    ssl->out_hdr = ssl->out_ctr +  8;
+    ssl->out_iv  = ssl->out_ctr + 13;
+    ssl->out_msg = ssl->out_iv;
+
+    if( ssl->transform_out != NULL && ssl->minor_ver >= SSL_MINOR_VERSION_2 )
+    {
+        ssl->out_msg += ssl->transform_out->ivlen -
+                        ssl->transform_out->fixed_ivlen;
+    }
+
+    return( 0 );
+}
+
+/*
+ * Hand idle buffers back to the pool between records
+ */
+static void ssl_release_idle_buffers( ssl_context *ssl )
+{
+    if( ssl->state != SSL_HANDSHAKE_OVER )
+        return;
+
+    if( ssl->in_ctr != NULL && ssl_in_buf_idle( ssl ) )
+        ssl_release_in_buf( ssl );
+
+    if( ssl->out_ctr != NULL && ssl->out_left == 0 )
+        ssl_release_out_buf( ssl );
+}
+
 /*
  * Fill the input message buffer
  */
@@ -739,7 +1012,12 @@ int ssl_fetch_input( ssl_context *ssl, size_t nb_want )
     int ret;
     size_t len;
 
-    if( nb_want > SSL_BUFFER_LEN - 8 )
+    if( ( ret = ssl_acquire_in_buf( ssl ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    if( nb_want > ssl->in_buf_len - 8 )
     {
         return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
     }
@@ -890,7 +1168,7 @@ int ssl_read_record( ssl_context *ssl )
     }
 
     /* Sanity check (outer boundaries) */
-    if( ssl->in_msglen < 1 || ssl->in_msglen > SSL_BUFFER_LEN - 13 )
+    if( ssl->in_msglen < 1 || ssl->in_msglen > ssl->in_buf_len - 13 )
     {
         return( POLARSSL_ERR_SSL_INVALID_RECORD );
     }
@@ -932,9 +1210,23 @@ int ssl_read_record( ssl_context *ssl )
         return( ret );
     }
 
+    /*
+     * Application data may be decrypted straight into the buffer offered
+     * by ssl_readv(), as long as it is large enough (see ssl_decrypt_buf).
+     * in_dst is reset when the record goes through in_msg instead.
+     */
+    if( ssl->in_dst != NULL &&
+        ( ssl->transform_in == NULL ||
+          ssl->in_msgtype != SSL_MSG_APPLICATION_DATA ||
+          ssl->in_dst_len < ssl->in_msglen + 256 ) )
+    {
+        ssl->in_dst = NULL;
+    }
+
     if( !done && ssl->transform_in != NULL )
     {
-        if( ( ret = ssl_decrypt_buf( ssl ) ) != 0 )
+        if( ( ret = ssl_decrypt_buf( ssl, ssl->in_dst != NULL ?
+                                     ssl->in_dst : ssl->in_msg ) ) != 0 )
         {
 #if defined(POLARSSL_SSL_ALERT_MESSAGES)
             if( ret == POLARSSL_ERR_SSL_INVALID_MAC )
@@ -1036,6 +1328,11 @@ int ssl_send_alert_message( ssl_context *ssl,
 {
     int ret;
 
+    if( ( ret = ssl_acquire_out_buf( ssl ) ) != 0 )
+    {
+        return( ret );
+    }
+
     ssl->out_msgtype = SSL_MSG_ALERT;
     ssl->out_msglen = 2;
     ssl->out_msg[0] = level;
@@ -1179,11 +1476,7 @@ int ssl_parse_certificate( ssl_context *ssl )
     }
 
     /* In case we tried to reuse a session but it failed */
-    if( ssl->session_negotiate->peer_cert != NULL )
-    {
-        x509_crt_free( ssl->session_negotiate->peer_cert );
-        memory_free( ssl->session_negotiate->peer_cert );
-    }
+    x509_crt_release( ssl->session_negotiate->peer_cert );
 
     if( ( ssl->session_negotiate->peer_cert = (x509_crt *) memory_alloc(
                     sizeof( x509_crt ) ) ) == NULL )
@@ -1253,10 +1546,18 @@ int ssl_parse_certificate( ssl_context *ssl )
         /*
          * Main check: verify certificate
          */
+#if defined(POLARSSL_X509_CRT_VERIFY_CACHE)
+        ret = x509_crt_verify_cached( ssl->verify_cache,
+                               ssl->session_negotiate->peer_cert,
+                               ssl->ca_chain, ssl->ca_crl, ssl->peer_cn,
+                              &ssl->session_negotiate->verify_result,
+                               ssl->f_vrfy, ssl->p_vrfy );
+#else
         ret = x509_crt_verify( ssl->session_negotiate->peer_cert,
                                ssl->ca_chain, ssl->ca_crl, ssl->peer_cn,
                               &ssl->session_negotiate->verify_result,
                                ssl->f_vrfy, ssl->p_vrfy );
+#endif /* POLARSSL_X509_CRT_VERIFY_CACHE */
 
         /*
          * Secondary checks: always done, but change 'ret' only if it was 0
@@ -1698,7 +1999,6 @@ static int ssl_handshake_init(ssl_context *ssl)
 int ssl_init( ssl_context *ssl )
 {
     int ret;
-    int len = SSL_BUFFER_LEN;
 
     __stosb( ssl, 0, sizeof( ssl_context ) );
 
@@ -1713,33 +2013,14 @@ int ssl_init( ssl_context *ssl )
     ssl_set_ciphersuites( ssl, ssl_list_ciphersuites() );
 
     ssl->renego_max_records = SSL_RENEGO_MAX_RECORDS_DEFAULT;
-    /*
-     * Prepare base structures
-     */
-    ssl->in_ctr = (uint8_t *) memory_alloc( len );
-    ssl->in_hdr = ssl->in_ctr +  8;
-    ssl->in_iv  = ssl->in_ctr + 13;
-    ssl->in_msg = ssl->in_ctr + 13;
-
-    if( ssl->in_ctr == NULL )
-    {
-        return( POLARSSL_ERR_SSL_MALLOC_FAILED );
-    }
-
-    ssl->out_ctr = (uint8_t *) memory_alloc( len );
-    ssl->out_hdr = ssl->out_ctr +  8;
-    ssl->out_iv  = ssl->out_ctr + 13;
-    ssl->out_msg = ssl->out_ctr + 13;
 
-    if( ssl->out_ctr == NULL )
-    {
-        memory_free( ssl->in_ctr );
-        ssl->in_ctr = NULL;
-        return( POLARSSL_ERR_SSL_MALLOC_FAILED );
-    }
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    ssl->ticket_lifetime = SSL_DEFAULT_TICKET_LIFETIME;
+#endif
 
-    __stosb( ssl-> in_ctr, 0, SSL_BUFFER_LEN );
-    __stosb( ssl->out_ctr, 0, SSL_BUFFER_LEN );
+    /*
+     * Record buffers are taken from the pool on first use
+     */
 
     ssl->curve_list = ecp_grp_id_list( );
 
@@ -1767,7 +2048,6 @@ int ssl_session_reset( ssl_context *ssl )
 
     ssl->in_offt = NULL;
 
-    ssl->in_msg = ssl->in_ctr + 13;
     ssl->in_msgtype = 0;
     ssl->in_msglen = 0;
     ssl->in_left = 0;
@@ -1776,7 +2056,6 @@ int ssl_session_reset( ssl_context *ssl )
     ssl->nb_zero = 0;
     ssl->record_read = 0;
 
-    ssl->out_msg = ssl->out_ctr + 13;
     ssl->out_msgtype = 0;
     ssl->out_msglen = 0;
     ssl->out_left = 0;
@@ -1786,8 +2065,14 @@ int ssl_session_reset( ssl_context *ssl )
 
     ssl->renego_records_seen = 0;
 
-    __stosb( ssl->out_ctr, 0, SSL_BUFFER_LEN );
-    __stosb( ssl->in_ctr, 0, SSL_BUFFER_LEN );
+    if( ssl->in_ctr != NULL )
+        ssl_release_in_buf( ssl );
+
+    if( ssl->out_ctr != NULL )
+        ssl_release_out_buf( ssl );
+
+    __stosb( ssl->in_ctr_saved, 0, 8 );
+    __stosb( ssl->out_ctr_saved, 0, 8 );
 
     if( ssl->transform )
     {
@@ -1952,6 +2237,13 @@ void ssl_set_ca_chain( ssl_context *ssl, x509_crt *ca_chain,
     ssl->peer_cn    = peer_cn;
 }
 
+#if defined(POLARSSL_X509_CRT_VERIFY_CACHE)
+void ssl_set_verify_cache( ssl_context *ssl, x509_crt_verify_cache *cache )
+{
+    ssl->verify_cache = cache;
+}
+#endif /* POLARSSL_X509_CRT_VERIFY_CACHE */
+
 int ssl_set_own_cert( ssl_context *ssl, x509_crt *own_cert,
                        pk_context *pk_key )
 {
@@ -2143,6 +2435,23 @@ int ssl_set_truncated_hmac( ssl_context *ssl, int truncate )
 }
 #endif /* POLARSSL_SSL_TRUNCATED_HMAC */
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+void ssl_set_session_tickets( ssl_context *ssl, int use_tickets )
+{
+    ssl->session_tickets = use_tickets;
+}
+
+void ssl_set_session_ticket_lifetime( ssl_context *ssl, int lifetime )
+{
+    ssl->ticket_lifetime = lifetime;
+}
+
+void ssl_set_session_ticket_keys( ssl_context *ssl, ssl_ticket_keys *keys )
+{
+    ssl->ticket_keys = keys;
+}
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
 void ssl_set_renegotiation( ssl_context *ssl, int renegotiation )
 {
     ssl->disable_renegotiation = renegotiation;
@@ -2231,6 +2540,14 @@ int ssl_handshake_step( ssl_context *ssl )
 {
     int ret = POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE;
 
+    if( ( ret = ssl_acquire_in_buf( ssl ) ) != 0 ||
+        ( ret = ssl_acquire_out_buf( ssl ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    ret = POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE;
+
 #if defined(POLARSSL_SSL_CLI_C)
     if( ssl->endpoint == SSL_IS_CLIENT )
         ret = ssl_handshake_client_step( ssl );
@@ -2259,6 +2576,9 @@ int ssl_handshake( ssl_context *ssl )
             break;
     }
 
+    if( ret == 0 )
+        ssl_release_idle_buffers( ssl );
+
     return( ret );
 }
 
@@ -2270,6 +2590,11 @@ static int ssl_write_hello_request( ssl_context *ssl )
 {
     int ret;
 
+    if( ( ret = ssl_acquire_out_buf( ssl ) ) != 0 )
+    {
+        return( ret );
+    }
+
     ssl->out_msglen  = 4;
     ssl->out_msgtype = SSL_MSG_HANDSHAKE;
     ssl->out_msg[0]  = SSL_HS_HELLO_REQUEST;
@@ -2359,12 +2684,37 @@ int ssl_renegotiate( ssl_context *ssl )
 }
 
 /*
- * Receive application data decrypted from the SSL layer
+ * Read a record, offering dst for direct decryption of application data.
+ * Returns 1 in *direct if the record contents landed in dst.
  */
-int ssl_read( ssl_context *ssl, uint8_t *buf, size_t len )
+static int ssl_read_record_into( ssl_context *ssl, uint8_t *dst,
+                                 size_t dst_len, int *direct )
 {
     int ret;
-    size_t n;
+
+    ssl->in_dst = dst;
+    ssl->in_dst_len = dst_len;
+
+    ret = ssl_read_record( ssl );
+
+    *direct = ( ret == 0 && ssl->in_dst != NULL );
+
+    ssl->in_dst = NULL;
+    ssl->in_dst_len = 0;
+
+    return( ret );
+}
+
+/*
+ * Receive application data decrypted from the SSL layer
+ */
+static int ssl_readv_real( ssl_context *ssl, const async_buf_t *iov,
+                           int iovcnt )
+{
+    int ret, i, direct = 0;
+    size_t n, nread = 0;
+    uint8_t *dst = NULL;
+    size_t dst_len = 0;
 
     if( ssl->state != SSL_HANDSHAKE_OVER )
     {
@@ -2376,7 +2726,17 @@ int ssl_read( ssl_context *ssl, uint8_t *buf, size_t len )
 
     if( ssl->in_offt == NULL )
     {
-        if( ( ret = ssl_read_record( ssl ) ) != 0 )
+        /*
+         * A whole record is decrypted in place into the first buffer when it
+         * fits, otherwise it goes through in_msg and gets copied out
+         */
+        if( iovcnt > 0 )
+        {
+            dst = (uint8_t *) iov[0].base;
+            dst_len = iov[0].len;
+        }
+
+        if( ( ret = ssl_read_record_into( ssl, dst, dst_len, &direct ) ) != 0 )
         {
             if( ret == POLARSSL_ERR_SSL_CONN_EOF )
                 return( 0 );
@@ -2388,7 +2748,8 @@ int ssl_read( ssl_context *ssl, uint8_t *buf, size_t len )
             /*
              * OpenSSL sends empty messages to randomize the IV
              */
-            if( ( ret = ssl_read_record( ssl ) ) != 0 ) {
+            if( ( ret = ssl_read_record_into( ssl, dst, dst_len,
+                                              &direct ) ) != 0 ) {
                 if( ret == POLARSSL_ERR_SSL_CONN_EOF )
                     return( 0 );
 
@@ -2437,41 +2798,61 @@ int ssl_read( ssl_context *ssl, uint8_t *buf, size_t len )
             return( POLARSSL_ERR_SSL_UNEXPECTED_MESSAGE );
         }
 
+        if( direct )
+        {
+            /* Already in the caller's buffer, nothing left in in_msg */
+            n = ssl->in_msglen;
+            ssl->in_msglen = 0;
+
+            return( (int) n );
+        }
+
         ssl->in_offt = ssl->in_msg;
     }
 
-    n = ( len < ssl->in_msglen )
-        ? len : ssl->in_msglen;
+    for( i = 0; i < iovcnt && ssl->in_msglen != 0; i++ )
+    {
+        n = ( iov[i].len < ssl->in_msglen )
+            ? iov[i].len : ssl->in_msglen;
 
-    __movsb( buf, ssl->in_offt, n );
-    ssl->in_msglen -= n;
+        __movsb( iov[i].base, ssl->in_offt, n );
+        ssl->in_msglen -= n;
+        ssl->in_offt += n;
+        nread += n;
+    }
 
     if( ssl->in_msglen == 0 )
         /* all bytes consumed  */
         ssl->in_offt = NULL;
-    else
-        /* more data available */
-        ssl->in_offt += n;
 
-    return( (int) n );
+    return( (int) nread );
+}
+
+int ssl_readv( ssl_context *ssl, const async_buf_t *iov, int iovcnt )
+{
+    int ret = ssl_readv_real( ssl, iov, iovcnt );
+
+    ssl_release_idle_buffers( ssl );
+
+    return( ret );
+}
+
+int ssl_read( ssl_context *ssl, uint8_t *buf, size_t len )
+{
+    async_buf_t iov;
+
+    iov.base = (char *) buf;
+    iov.len = (ULONG)( len < SSL_IOV_MAX_LEN ? len : SSL_IOV_MAX_LEN );
+
+    return( ssl_readv( ssl, &iov, 1 ) );
 }
 
 /*
- * Send application data to be encrypted by the SSL layer
+ * Largest plaintext that fits in one outgoing record
  */
-int ssl_write( ssl_context *ssl, const uint8_t *buf, size_t len )
+static size_t ssl_get_max_out_len( const ssl_context *ssl )
 {
-    int ret;
-    size_t n;
-    uint32_t max_len = SSL_MAX_CONTENT_LEN;
-
-    if( ssl->state != SSL_HANDSHAKE_OVER )
-    {
-        if( ( ret = ssl_handshake( ssl ) ) != 0 )
-        {
-            return( ret );
-        }
-    }
+    size_t max_len = SSL_MAX_CONTENT_LEN;
 
 #if defined(POLARSSL_SSL_MAX_FRAGMENT_LENGTH)
     /*
@@ -2489,28 +2870,271 @@ int ssl_write( ssl_context *ssl, const uint8_t *buf, size_t len )
     }
 #endif /* POLARSSL_SSL_MAX_FRAGMENT_LENGTH */
 
-    n = ( len < max_len) ? len : max_len;
+    return( max_len );
+}
+
+/*
+ * Move an iovec cursor forward by len bytes
+ */
+static void ssl_iov_advance( const async_buf_t *iov, int iovcnt,
+                             int *idx, size_t *off, size_t len )
+{
+    size_t n;
+
+    while( *idx < iovcnt )
+    {
+        n = iov[*idx].len - *off;
+
+        if( len < n )
+        {
+            *off += len;
+            return;
+        }
+
+        len -= n;
+        (*idx)++;
+        *off = 0;
+    }
+}
+
+/*
+ * Build one application data record of len bytes straight from the caller's
+ * buffers: the plaintext is MACed and fed to the cipher piece by piece, which
+ * writes the ciphertext into out_msg. Only the MAC and the padding go through
+ * a stack buffer, the plaintext is never gathered into out_msg first.
+ *
+ * That takes a CBC suite with an explicit IV (TLS 1.1 and later). Otherwise
+ * the plaintext is copied into out_msg and the record goes through
+ * ssl_write_record(), as ssl_write() did before.
+ */
+static int ssl_encrypt_iov( ssl_context *ssl, const async_buf_t *iov,
+                            int iovcnt, int *idx, size_t *off, size_t len )
+{
+    int ret;
+    size_t i, n, olen, padlen;
+    size_t ivlen = ssl->transform_out->ivlen;
+    size_t maclen = ssl->transform_out->maclen;
+    const uint8_t *src;
+    uint8_t *dst;
+    uint8_t trailer[POLARSSL_SSL_MAX_MAC_SIZE + 256];
+
+    if( ( ret = ssl_acquire_out_buf( ssl ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    if( ssl->minor_ver < SSL_MINOR_VERSION_2 ||
+        ssl->transform_out->cipher_ctx_enc.cipher_info->mode !=
+                                                       POLARSSL_MODE_CBC )
+    {
+        for( i = 0; i < len && *idx < iovcnt; i += n )
+        {
+            n = iov[*idx].len - *off;
+            if( n > len - i )
+                n = len - i;
+
+            __movsb( ssl->out_msg + i,
+                     (const uint8_t *) iov[*idx].base + *off, n );
+
+            ssl_iov_advance( iov, iovcnt, idx, off, n );
+        }
+
+        ssl->out_msglen  = i;
+        ssl->out_msgtype = SSL_MSG_APPLICATION_DATA;
+
+        return( ssl_write_record( ssl ) );
+    }
+
+    ssl->out_msgtype = SSL_MSG_APPLICATION_DATA;
+
+    /* The header doubles as MAC input, with the plaintext length */
+    ssl->out_hdr[0] = (uint8_t) ssl->out_msgtype;
+    ssl->out_hdr[1] = (uint8_t) ssl->major_ver;
+    ssl->out_hdr[2] = (uint8_t) ssl->minor_ver;
+    ssl->out_hdr[3] = (uint8_t)( len >> 8 );
+    ssl->out_hdr[4] = (uint8_t)( len      );
+
+    /*
+     * Generate the explicit IV
+     */
+    if( ( ret = ssl->f_rng( ssl->p_rng, ssl->transform_out->iv_enc,
+                            ivlen ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    __movsb( ssl->out_iv, ssl->transform_out->iv_enc, ivlen );
+
+    if( ( ret = cipher_reset( &ssl->transform_out->cipher_ctx_enc ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    if( ( ret = cipher_set_iv( &ssl->transform_out->cipher_ctx_enc,
+                               ssl->transform_out->iv_enc, ivlen ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    md_hmac_update( &ssl->transform_out->md_ctx_enc, ssl->out_ctr, 13 );
+
+    padlen = ivlen - ( len + maclen + 1 ) % ivlen;
+    if( padlen == ivlen )
+        padlen = 0;
+
+    dst = ssl->out_iv + ivlen;
+
+    while( len > 0 && *idx < iovcnt )
+    {
+        n = iov[*idx].len - *off;
+        if( n > len )
+            n = len;
+
+        src = (const uint8_t *) iov[*idx].base + *off;
+
+        md_hmac_update( &ssl->transform_out->md_ctx_enc, src, n );
+
+        if( ( ret = cipher_update( &ssl->transform_out->cipher_ctx_enc,
+                                   src, n, dst, &olen ) ) != 0 )
+        {
+            return( ret );
+        }
+
+        dst += olen;
+        len -= n;
+
+        ssl_iov_advance( iov, iovcnt, idx, off, n );
+    }
+
+    /*
+     * MAC and padding close the record
+     */
+    md_hmac_finish( &ssl->transform_out->md_ctx_enc, trailer );
+    md_hmac_reset( &ssl->transform_out->md_ctx_enc );
+
+    for( i = 0; i <= padlen; i++ )
+        trailer[maclen + i] = (uint8_t) padlen;
+
+    if( ( ret = cipher_update( &ssl->transform_out->cipher_ctx_enc,
+                               trailer, maclen + padlen + 1,
+                               dst, &olen ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    dst += olen;
+
+    if( ( ret = cipher_finish( &ssl->transform_out->cipher_ctx_enc,
+                               dst, &olen ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    dst += olen;
+
+    ssl->out_msglen = dst - ssl->out_iv;
+    ssl->out_hdr[3] = (uint8_t)( ssl->out_msglen >> 8 );
+    ssl->out_hdr[4] = (uint8_t)( ssl->out_msglen      );
+
+    for( i = 8; i > 0; i-- )
+        if( ++ssl->out_ctr[i - 1] != 0 )
+            break;
+
+    /* The loops goes to its end iff the counter is wrapping */
+    if( i == 0 )
+    {
+        return( POLARSSL_ERR_SSL_COUNTER_WRAPPING );
+    }
+
+    ssl->out_left = 5 + ssl->out_msglen;
+
+    return( 0 );
+}
+
+/*
+ * Send application data to be encrypted by the SSL layer
+ */
+static int ssl_writev_real( ssl_context *ssl, const async_buf_t *iov,
+                            int iovcnt )
+{
+    int ret, i, idx = 0;
+    size_t n, off = 0, total = 0, written = 0;
+    size_t max_len;
+
+    if( ssl->state != SSL_HANDSHAKE_OVER )
+    {
+        if( ( ret = ssl_handshake( ssl ) ) != 0 )
+        {
+            return( ret );
+        }
+    }
+
+    max_len = ssl_get_max_out_len( ssl );
+
+    for( i = 0; i < iovcnt; i++ )
+        total += iov[i].len;
+
+    if( total > SSL_IOV_MAX_LEN )
+        total = SSL_IOV_MAX_LEN;
 
     if( ssl->out_left != 0 )
     {
+        /*
+         * The pending record was built from the head of the same buffers
+         * by the call that returned WANT_WRITE, count it once it is out
+         */
         if( ( ret = ssl_flush_output( ssl ) ) != 0 )
         {
             return( ret );
         }
+
+        written = ( total < max_len ) ? total : max_len;
+        ssl_iov_advance( iov, iovcnt, &idx, &off, written );
+
+        if( written == total )
+            return( (int) written );
     }
-    else
+
+    /*
+     * Emit as many records as needed. On failure, whatever was already
+     * sent is reported first, the error shows up again on the next call.
+     */
+    do
     {
-        ssl->out_msglen  = n;
-        ssl->out_msgtype = SSL_MSG_APPLICATION_DATA;
-        __movsb( ssl->out_msg, buf, n );
+        n = total - written;
+        if( n > max_len )
+            n = max_len;
 
-        if( ( ret = ssl_write_record( ssl ) ) != 0 )
+        if( ( ret = ssl_encrypt_iov( ssl, iov, iovcnt, &idx, &off, n ) ) != 0 ||
+            ( ret = ssl_flush_output( ssl ) ) != 0 )
         {
-            return( ret );
+            return( written != 0 ? (int) written : ret );
         }
+
+        written += n;
     }
+    while( written < total );
 
-    return( (int) n );
+    return( (int) written );
+}
+
+int ssl_writev( ssl_context *ssl, const async_buf_t *iov, int iovcnt )
+{
+    int ret = ssl_writev_real( ssl, iov, iovcnt );
+
+    ssl_release_idle_buffers( ssl );
+
+    return( ret );
+}
+
+int ssl_write( ssl_context *ssl, const uint8_t *buf, size_t len )
+{
+    async_buf_t iov;
+
+    iov.base = (char *) buf;
+    iov.len = (ULONG)( len < SSL_IOV_MAX_LEN ? len : SSL_IOV_MAX_LEN );
+
+    return( ssl_writev( ssl, &iov, 1 ) );
 }
 
 /*
@@ -2535,6 +3159,8 @@ int ssl_close_notify( ssl_context *ssl )
         }
     }
 
+    ssl_release_idle_buffers( ssl );
+
     return( ret );
 }
 
@@ -2602,10 +3228,14 @@ void ssl_handshake_free( ssl_handshake_params *handshake )
 void ssl_session_free( ssl_session *session )
 {
 #if defined(POLARSSL_X509_CRT_PARSE_C)
-    if( session->peer_cert != NULL )
+    x509_crt_release( session->peer_cert );
+#endif
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    if( session->ticket != NULL )
     {
-        x509_crt_free( session->peer_cert );
-        memory_free( session->peer_cert );
+        __stosb( session->ticket, 0, session->ticket_len );
+        memory_free( session->ticket );
     }
 #endif
 
@@ -2619,16 +3249,10 @@ void ssl_free( ssl_context *ssl )
 {
 
     if( ssl->out_ctr != NULL )
-    {
-        __stosb( ssl->out_ctr, 0, SSL_BUFFER_LEN );
-        memory_free( ssl->out_ctr );
-    }
+        ssl_release_out_buf( ssl );
 
     if( ssl->in_ctr != NULL )
-    {
-        __stosb( ssl->in_ctr, 0, SSL_BUFFER_LEN );
-        memory_free( ssl->in_ctr );
-    }
+        ssl_release_in_buf( ssl );
 
     if( ssl->transform )
     {
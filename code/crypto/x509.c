@@ -363,6 +363,48 @@ int x509_load_file( const char *path, uint8_t **buf, size_t *n )
     return( 0 );
 }
 
+/*
+ * Map a whole file read-only. The view is not NUL terminated.
+ */
+int x509_map_file( const char *path, uint8_t **view, size_t *n )
+{
+    HANDLE hFile, hMapping;
+    DWORD size;
+
+    hFile = fn_CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+    if( hFile == INVALID_HANDLE_VALUE )
+        return( POLARSSL_ERR_X509_FILE_IO_ERROR );
+
+    size = fn_GetFileSize( hFile, NULL );
+    if( size == INVALID_FILE_SIZE || size == 0 )
+    {
+        fn_CloseHandle( hFile );
+        return( POLARSSL_ERR_X509_FILE_IO_ERROR );
+    }
+
+    hMapping = fn_CreateFileMappingA( hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+    fn_CloseHandle( hFile );
+    if( hMapping == NULL )
+        return( POLARSSL_ERR_X509_FILE_IO_ERROR );
+
+    /* The view keeps the mapping alive */
+    *view = (uint8_t *) fn_MapViewOfFile( hMapping, FILE_MAP_READ, 0, 0, 0 );
+    fn_CloseHandle( hMapping );
+    if( *view == NULL )
+        return( POLARSSL_ERR_X509_FILE_IO_ERROR );
+
+    *n = (size_t) size;
+
+    return( 0 );
+}
+
+void x509_unmap_file( uint8_t *view )
+{
+    if( view != NULL )
+        fn_UnmapViewOfFile( view );
+}
+
 #define POLARSSL_ERR_DEBUG_BUF_TOO_SMALL    -2
 
 #define SAFE_SNPRINTF()                         \
@@ -252,6 +252,8 @@ int x509_get_serial( uint8_t **p, const uint8_t *end,
 int x509_get_ext( uint8_t **p, const uint8_t *end,
                   x509_buf *ext, int tag );
 int x509_load_file( const char *path, uint8_t **buf, size_t *n );
+int x509_map_file( const char *path, uint8_t **view, size_t *n );
+void x509_unmap_file( uint8_t *view );
 int x509_key_size_helper( char *buf, size_t size, const char *name );
 int x509_string_to_names( asn1_named_data **head, const char *name );
 int x509_set_extension( asn1_named_data **head, const char *oid, size_t oid_len,
@@ -123,16 +123,124 @@ static int x509_get_crl_entry_ext( uint8_t **p,
     return( 0 );
 }
 
+#if defined(POLARSSL_X509_CRL_INDEX)
+/*
+ * Serial numbers are ordered by length first, then bytewise. Not numeric
+ * order for non-minimal encodings, but lookups only need a total order
+ * consistent with the exact length + memcmp match.
+ */
+static int x509_crl_serial_cmp( const uint8_t *a, size_t alen,
+                                const uint8_t *b, size_t blen )
+{
+    if( alen != blen )
+        return( alen < blen ? -1 : 1 );
+
+    return( memcmp( a, b, alen ) );
+}
+
+#define X509_CRL_INDEX_CMP( a, b ) \
+    x509_crl_serial_cmp( (a)->serial, (a)->serial_len, \
+                         (b)->serial, (b)->serial_len )
+
+static int x509_crl_index_add( x509_crl *crl, size_t *size,
+                               const x509_crl_entry *entry,
+                               const uint8_t *end )
+{
+    x509_crl_index_entry *index;
+
+    if( crl->index_len == *size )
+    {
+        *size = ( *size == 0 ) ? 64 : *size * 2;
+
+        index = (x509_crl_index_entry *) memory_realloc( crl->index,
+                                *size * sizeof( x509_crl_index_entry ) );
+        if( index == NULL )
+            return( POLARSSL_ERR_X509_MALLOC_FAILED );
+
+        crl->index = index;
+    }
+
+    index = &crl->index[crl->index_len++];
+    index->serial = entry->serial.p;
+    index->serial_len = entry->serial.len;
+    index->end = end;
+
+    return( 0 );
+}
+
+static void x509_crl_index_sift( x509_crl_index_entry *index,
+                                 size_t root, size_t n )
+{
+    size_t child;
+    x509_crl_index_entry tmp;
+
+    while( ( child = 2 * root + 1 ) < n )
+    {
+        if( child + 1 < n &&
+            X509_CRL_INDEX_CMP( &index[child], &index[child + 1] ) < 0 )
+            child++;
+
+        if( X509_CRL_INDEX_CMP( &index[root], &index[child] ) >= 0 )
+            return;
+
+        tmp = index[root];
+        index[root] = index[child];
+        index[child] = tmp;
+        root = child;
+    }
+}
+
+/*
+ * Heapsort: in place, no recursion and no worst case on CRLs that are
+ * already (nearly) sorted, as most issuers emit them
+ */
+static void x509_crl_index_sort( x509_crl *crl )
+{
+    size_t i, n = crl->index_len;
+    x509_crl_index_entry tmp;
+
+    for( i = n / 2; i > 0; i-- )
+        x509_crl_index_sift( crl->index, i - 1, n );
+
+    for( i = n; i > 1; i-- )
+    {
+        tmp = crl->index[0];
+        crl->index[0] = crl->index[i - 1];
+        crl->index[i - 1] = tmp;
+
+        x509_crl_index_sift( crl->index, 0, i - 1 );
+    }
+}
+
+/*
+ * The revocationDate is read back from the DER on a match only
+ */
+static int x509_crl_index_date( const x509_crl_index_entry *index,
+                                x509_time *date )
+{
+    uint8_t *p = (uint8_t *) index->serial + index->serial_len;
+
+    return( x509_get_time( &p, index->end, date ) );
+}
+#endif /* POLARSSL_X509_CRL_INDEX */
+
 /*
  * X.509 CRL Entries
+ *
+ * In compact mode the entries are only validated and indexed, no list
+ * node is allocated.
  */
 static int x509_get_entries( uint8_t **p,
                              const uint8_t *end,
-                             x509_crl_entry *entry )
+                             x509_crl *crl, int compact )
 {
     int ret;
     size_t entry_len;
-    x509_crl_entry *cur_entry = entry;
+    x509_crl_entry *cur_entry = &crl->entry;
+#if defined(POLARSSL_X509_CRL_INDEX)
+    x509_crl_entry tmp_entry;
+    size_t index_size = 0;
+#endif
 
     if( *p == end )
         return( 0 );
@@ -159,6 +267,16 @@ static int x509_get_entries( uint8_t **p,
             return( ret );
         }
 
+#if defined(POLARSSL_X509_CRL_INDEX)
+        if( compact )
+        {
+            __stosb( (uint8_t *) &tmp_entry, 0, sizeof( x509_crl_entry ) );
+            cur_entry = &tmp_entry;
+        }
+#else
+        ((void) compact);
+#endif
+
         cur_entry->raw.tag = **p;
         cur_entry->raw.p = *p;
         cur_entry->raw.len = len2;
@@ -175,6 +293,15 @@ static int x509_get_entries( uint8_t **p,
                                             &cur_entry->entry_ext ) ) != 0 )
             return( ret );
 
+#if defined(POLARSSL_X509_CRL_INDEX)
+        if( ( ret = x509_crl_index_add( crl, &index_size,
+                                        cur_entry, end2 ) ) != 0 )
+            return( ret );
+
+        if( compact )
+            continue;
+#endif
+
         if ( *p < end )
         {
             cur_entry->next = memory_alloc( sizeof( x509_crl_entry ) );
@@ -191,94 +318,16 @@ static int x509_get_entries( uint8_t **p,
 }
 
 /*
- * Parse one or more CRLs and add them to the chained list
+ * Parse the DER CRL held in crl->raw, which is released on error
  */
-int x509_crl_parse( x509_crl *chain, const uint8_t *buf, size_t buflen )
+static int x509_crl_parse_der( x509_crl *crl, int compact )
 {
     int ret;
     size_t len;
     uint8_t *p, *end;
-    x509_crl *crl;
-#if defined(POLARSSL_PEM_PARSE_C)
-    size_t use_len;
-    pem_context pem;
-#endif
-
-    crl = chain;
-
-    /*
-     * Check for valid input
-     */
-    if( crl == NULL || buf == NULL )
-        return( POLARSSL_ERR_X509_BAD_INPUT_DATA );
 
-    while( crl->version != 0 && crl->next != NULL )
-        crl = crl->next;
-
-    /*
-     * Add new CRL on the end of the chain if needed.
-     */
-    if ( crl->version != 0 && crl->next == NULL)
-    {
-        crl->next = (x509_crl *) memory_alloc( sizeof( x509_crl ) );
-
-        if( crl->next == NULL )
-        {
-            x509_crl_free( crl );
-            return( POLARSSL_ERR_X509_MALLOC_FAILED );
-        }
-
-        crl = crl->next;
-        x509_crl_init( crl );
-    }
-
-#if defined(POLARSSL_PEM_PARSE_C)
-    pem_init( &pem );
-    ret = pem_read_buffer( &pem,
-                           "-----BEGIN X509 CRL-----",
-                           "-----END X509 CRL-----",
-                           buf, NULL, 0, &use_len );
-
-    if( ret == 0 )
-    {
-        /*
-         * Was PEM encoded
-         */
-        buflen -= use_len;
-        buf += use_len;
-
-        /*
-         * Steal PEM buffer
-         */
-        p = pem.buf;
-        pem.buf = NULL;
-        len = pem.buflen;
-        pem_free( &pem );
-    }
-    else if( ret != POLARSSL_ERR_PEM_NO_HEADER_FOOTER_PRESENT )
-    {
-        pem_free( &pem );
-        return( ret );
-    }
-    else
-#endif /* POLARSSL_PEM_PARSE_C */
-    {
-        /*
-         * nope, copy the raw DER data
-         */
-        p = (uint8_t *) memory_alloc( len = buflen );
-
-        if( p == NULL )
-            return( POLARSSL_ERR_X509_MALLOC_FAILED );
-
-        __movsb( p, buf, buflen );
-
-        buflen = 0;
-    }
-
-    crl->raw.p = p;
-    crl->raw.len = len;
-    end = p + len;
+    p = crl->raw.p;
+    end = p + crl->raw.len;
 
     /*
      * CertificateList  ::=  SEQUENCE  {
@@ -393,12 +442,16 @@ int x509_crl_parse( x509_crl *chain, const uint8_t *buf, size_t buflen )
      *                                   -- if present, MUST be v2
      *                        } OPTIONAL
      */
-    if( ( ret = x509_get_entries( &p, end, &crl->entry ) ) != 0 )
+    if( ( ret = x509_get_entries( &p, end, crl, compact ) ) != 0 )
     {
         x509_crl_free( crl );
         return( ret );
     }
 
+#if defined(POLARSSL_X509_CRL_INDEX)
+    x509_crl_index_sort( crl );
+#endif
+
     /*
      * crlExtensions          EXPLICIT Extensions OPTIONAL
      *                              -- if present, MUST be v2
@@ -453,6 +506,112 @@ int x509_crl_parse( x509_crl *chain, const uint8_t *buf, size_t buflen )
                 POLARSSL_ERR_ASN1_LENGTH_MISMATCH );
     }
 
+    return( 0 );
+}
+
+/*
+ * Return the unused CRL at the end of the chain, adding one if needed
+ */
+static x509_crl *x509_crl_chain_tail( x509_crl *chain )
+{
+    x509_crl *crl = chain;
+
+    while( crl->version != 0 && crl->next != NULL )
+        crl = crl->next;
+
+    /*
+     * Add new CRL on the end of the chain if needed.
+     */
+    if ( crl->version != 0 && crl->next == NULL)
+    {
+        crl->next = (x509_crl *) memory_alloc( sizeof( x509_crl ) );
+
+        if( crl->next == NULL )
+        {
+            x509_crl_free( crl );
+            return( NULL );
+        }
+
+        crl = crl->next;
+        x509_crl_init( crl );
+    }
+
+    return( crl );
+}
+
+/*
+ * Parse one or more CRLs and add them to the chained list
+ */
+int x509_crl_parse( x509_crl *chain, const uint8_t *buf, size_t buflen )
+{
+    int ret;
+    size_t len;
+    uint8_t *p;
+    x509_crl *crl;
+#if defined(POLARSSL_PEM_PARSE_C)
+    size_t use_len;
+    pem_context pem;
+#endif
+
+    /*
+     * Check for valid input
+     */
+    if( chain == NULL || buf == NULL )
+        return( POLARSSL_ERR_X509_BAD_INPUT_DATA );
+
+    if( ( crl = x509_crl_chain_tail( chain ) ) == NULL )
+        return( POLARSSL_ERR_X509_MALLOC_FAILED );
+
+#if defined(POLARSSL_PEM_PARSE_C)
+    pem_init( &pem );
+    ret = pem_read_buffer( &pem,
+                           "-----BEGIN X509 CRL-----",
+                           "-----END X509 CRL-----",
+                           buf, NULL, 0, &use_len );
+
+    if( ret == 0 )
+    {
+        /*
+         * Was PEM encoded
+         */
+        buflen -= use_len;
+        buf += use_len;
+
+        /*
+         * Steal PEM buffer
+         */
+        p = pem.buf;
+        pem.buf = NULL;
+        len = pem.buflen;
+        pem_free( &pem );
+    }
+    else if( ret != POLARSSL_ERR_PEM_NO_HEADER_FOOTER_PRESENT )
+    {
+        pem_free( &pem );
+        return( ret );
+    }
+    else
+#endif /* POLARSSL_PEM_PARSE_C */
+    {
+        /*
+         * nope, copy the raw DER data
+         */
+        p = (uint8_t *) memory_alloc( len = buflen );
+
+        if( p == NULL )
+            return( POLARSSL_ERR_X509_MALLOC_FAILED );
+
+        __movsb( p, buf, buflen );
+
+        buflen = 0;
+    }
+
+    crl->raw.p = p;
+    crl->raw.len = len;
+
+    if( ( ret = x509_crl_parse_der( crl, 0 ) ) != 0 )
+        return( ret );
+
     if( buflen > 0 )
     {
         crl->next = (x509_crl *) memory_alloc( sizeof( x509_crl ) );
@@ -492,6 +651,104 @@ int x509_crl_parse_file( x509_crl *chain, const char *path )
     return( ret );
 }
 
+#if defined(POLARSSL_X509_CRL_INDEX)
+/*
+ * Map a DER CRL file and parse it in place
+ */
+int x509_crl_parse_file_mapped( x509_crl *chain, const char *path )
+{
+    int ret;
+    size_t size;
+    uint8_t *view;
+    x509_crl *crl;
+
+    if( chain == NULL || path == NULL )
+        return( POLARSSL_ERR_X509_BAD_INPUT_DATA );
+
+    if( ( ret = x509_map_file( path, &view, &size ) ) != 0 )
+        return( ret );
+
+    /*
+     * PEM has to be decoded into the heap anyway, and the PEM reader
+     * needs the NUL terminated copy x509_crl_parse_file() makes
+     */
+    if( view[0] != ( ASN1_CONSTRUCTED | ASN1_SEQUENCE ) )
+    {
+        x509_unmap_file( view );
+        return( x509_crl_parse_file( chain, path ) );
+    }
+
+    if( ( crl = x509_crl_chain_tail( chain ) ) == NULL )
+    {
+        x509_unmap_file( view );
+        return( POLARSSL_ERR_X509_MALLOC_FAILED );
+    }
+
+    crl->raw.p = view;
+    crl->raw.len = size;
+    crl->mapped = 1;
+
+    return( x509_crl_parse_der( crl, 1 ) );
+}
+#endif /* POLARSSL_X509_CRL_INDEX */
+
+/*
+ * Return 1 if the serial number is on the CRL, revoked as of now
+ */
+int x509_crl_serial_revoked( const x509_crl *crl,
+                             const uint8_t *serial, size_t len )
+{
+    const x509_crl_entry *cur = &crl->entry;
+#if defined(POLARSSL_X509_CRL_INDEX)
+    size_t lo = 0, hi = crl->index_len, mid;
+    x509_time date;
+
+    if( crl->index != NULL )
+    {
+        /* Lower bound, duplicate serials are checked in turn */
+        while( lo < hi )
+        {
+            mid = lo + ( hi - lo ) / 2;
+
+            if( x509_crl_serial_cmp( crl->index[mid].serial,
+                                     crl->index[mid].serial_len,
+                                     serial, len ) < 0 )
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        for( ; lo < crl->index_len; lo++ )
+        {
+            if( x509_crl_serial_cmp( crl->index[lo].serial,
+                                     crl->index[lo].serial_len,
+                                     serial, len ) != 0 )
+                break;
+
+            if( x509_crl_index_date( &crl->index[lo], &date ) == 0 &&
+                x509_time_expired( &date ) )
+                return( 1 );
+        }
+
+        return( 0 );
+    }
+#endif /* POLARSSL_X509_CRL_INDEX */
+
+    while( cur != NULL && cur->serial.len != 0 )
+    {
+        if( len == cur->serial.len &&
+            memcmp( serial, cur->serial.p, len ) == 0 )
+        {
+            if( x509_time_expired( &cur->revocation_date ) )
+                return( 1 );
+        }
+
+        cur = cur->next;
+    }
+
+    return( 0 );
+}
+
 #define POLARSSL_ERR_DEBUG_BUF_TOO_SMALL    -2
 
 #define SAFE_SNPRINTF()                         \
@@ -524,6 +781,11 @@ int x509_crl_info( char *buf, size_t size, const char *prefix,
     char *p;
     const char *desc;
     const x509_crl_entry *entry;
+#if defined(POLARSSL_X509_CRL_INDEX)
+    size_t i;
+    x509_buf serial;
+    x509_time date;
+#endif
 
     p = buf;
     n = size;
@@ -570,6 +832,32 @@ int x509_crl_info( char *buf, size_t size, const char *prefix,
         entry = entry->next;
     }
 
+#if defined(POLARSSL_X509_CRL_INDEX)
+    /*
+     * Compact CRLs only have their index
+     */
+    for( i = 0; crl->entry.raw.len == 0 && i < crl->index_len; i++ )
+    {
+        serial.tag = ASN1_INTEGER;
+        serial.p = (uint8_t *) crl->index[i].serial;
+        serial.len = crl->index[i].serial_len;
+
+        if( x509_crl_index_date( &crl->index[i], &date ) != 0 )
+            __stosb( (uint8_t *) &date, 0, sizeof( x509_time ) );
+
+        ret = fn__snprintf(p, n, "\n%sserial number: ", prefix );
+        SAFE_SNPRINTF();
+
+        ret = x509_serial_gets( p, n, &serial );
+        SAFE_SNPRINTF();
+
+        ret = fn__snprintf(p, n, " revocation date: %04d-%02d-%02d %02d:%02d:%02d",
+                   date.year, date.mon, date.day,
+                   date.hour, date.min, date.sec );
+        SAFE_SNPRINTF();
+    }
+#endif /* POLARSSL_X509_CRL_INDEX */
+
     ret = fn__snprintf(p, n, "\n%ssigned using  : ", prefix);
     SAFE_SNPRINTF();
 
@@ -629,6 +917,17 @@ void x509_crl_free( x509_crl *crl )
             memory_free( entry_prv );
         }
 
+#if defined(POLARSSL_X509_CRL_INDEX)
+        if( crl_cur->index != NULL )
+            memory_free( crl_cur->index );
+
+        if( crl_cur->mapped )
+        {
+            x509_unmap_file( crl_cur->raw.p );
+            crl_cur->raw.p = NULL;
+        }
+#endif /* POLARSSL_X509_CRL_INDEX */
+
         if( crl_cur->raw.p != NULL )
         {
             __stosb( crl_cur->raw.p, 0, crl_cur->raw.len );
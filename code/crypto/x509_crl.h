@@ -66,6 +66,18 @@ typedef struct _x509_crl_entry
 }
 x509_crl_entry;
 
+/**
+ * Revocation index entry, pointing into the raw CRL data.
+ */
+typedef struct _x509_crl_index_entry
+{
+    const uint8_t *serial;      /**< The serial number (INTEGER contents). */
+    size_t serial_len;
+
+    const uint8_t *end;         /**< End of the entry; revocationDate follows the serial. */
+}
+x509_crl_index_entry;
+
 /**
  * Certificate revocation list structure.
  * Every CRL may have multiple entries.
@@ -94,6 +106,12 @@ typedef struct _x509_crl
     md_type_t sig_md;           /**< Internal representation of the MD algorithm of the signature algorithm, e.g. POLARSSL_MD_SHA256 */
     pk_type_t sig_pk            /**< Internal representation of the Public Key algorithm of the signature algorithm, e.g. POLARSSL_PK_RSA */;
 
+#if defined(POLARSSL_X509_CRL_INDEX)
+    x509_crl_index_entry *index;    /**< Entries sorted by serial number. */
+    size_t index_len;
+    int mapped;                     /**< raw is a read-only file view. */
+#endif
+
     struct _x509_crl *next;
 }
 x509_crl;
@@ -121,6 +139,39 @@ int x509_crl_parse( x509_crl *chain, const uint8_t *buf, size_t buflen );
  */
 int x509_crl_parse_file( x509_crl *chain, const char *path );
 
+#if defined(POLARSSL_X509_CRL_INDEX)
+/**
+ * \brief          Map a CRL file and add it to the chained list
+ *
+ *                 A DER CRL is parsed in place from the read-only view, with
+ *                 no copy and no per-entry allocation: only the sorted
+ *                 serial index is built, the entry list stays empty. The
+ *                 view lives until x509_crl_free(). PEM files are decoded
+ *                 as by x509_crl_parse_file().
+ *
+ * \param chain    points to the start of the chain
+ * \param path     filename to map the CRL from
+ *
+ * \return         0 if successful, or a specific X509 or PEM error code
+ */
+int x509_crl_parse_file_mapped( x509_crl *chain, const char *path );
+#endif /* POLARSSL_X509_CRL_INDEX */
+
+/**
+ * \brief          Check whether a serial number is revoked by a CRL
+ *
+ *                 Uses the sorted index when present (O(log n)), the entry
+ *                 list otherwise.
+ *
+ * \param crl      a single CRL (the chain is not walked)
+ * \param serial   serial number, as in x509_crt.serial
+ * \param len      length of the serial number
+ *
+ * \return         1 if listed with a revocation date in the past, 0 otherwise
+ */
+int x509_crl_serial_revoked( const x509_crl *crl,
+                             const uint8_t *serial, size_t len );
+
 /**
  * \brief          Returns an informational string about the CRL.
  *
@@ -8,6 +8,12 @@
 #if defined(POLARSSL_PEM_PARSE_C)
 #include "pem.h"
 #endif
+#if defined(POLARSSL_X509_CRT_PARALLEL_LOAD)
+#include "base64.h"
+#endif
+#if defined(POLARSSL_X509_CRT_VERIFY_CACHE)
+#include "sha256.h"
+#endif
 
 /*
  *  Version  ::=  INTEGER  {  v1(0), v2(1), v3(2)  }
@@ -866,6 +872,400 @@ int x509_crt_parse_file( x509_crt *chain, const char *path )
     return( ret );
 }
 
+#if defined(POLARSSL_X509_CRT_PARALLEL_LOAD)
+#define X509_PEM_BEGIN_CRT      "-----BEGIN CERTIFICATE-----"
+#define X509_PEM_END_CRT        "-----END CERTIFICATE-----"
+
+/*
+ * A certificate found in a file: DER, or the base64 body of a PEM block
+ */
+typedef struct
+{
+    const uint8_t *p;
+    size_t len;
+    int pem;
+    x509_crt *crt;                  /* parsed, not linked yet */
+    int ret;
+}
+x509_crt_load_block;
+
+typedef struct
+{
+    const char *path;
+    uint8_t *view;
+    size_t size;
+    int ret;                        /* file error, if any     */
+    x509_crt_load_block *blocks;
+    size_t count;
+    size_t first;                   /* index of blocks[0] in the loader */
+}
+x509_crt_load_file;
+
+typedef struct
+{
+    x509_crt_load_file *files;
+    size_t nfiles;
+    x509_crt_load_block **blocks;   /* every block, in file order */
+    size_t nblocks;
+    int phase;                      /* 0: map and split, 1: parse */
+    volatile long next;             /* next job, taken by the workers */
+}
+x509_crt_loader;
+
+static const uint8_t *x509_memfind( const uint8_t *p, const uint8_t *end,
+                                    const char *s, size_t len )
+{
+    for( ; (size_t) ( end - p ) >= len; p++ )
+    {
+        if( *p == (uint8_t) *s && memcmp( p, s, len ) == 0 )
+            return( p );
+    }
+
+    return( NULL );
+}
+
+static int x509_crt_load_add( x509_crt_load_file *file, const uint8_t *p,
+                              size_t len, int pem )
+{
+    x509_crt_load_block *blocks;
+
+    /* Grow by doubling, starting at 8 */
+    if( ( file->count & ( file->count - 1 ) ) == 0 &&
+        ( file->count == 0 || file->count >= 8 ) )
+    {
+        blocks = (x509_crt_load_block *) memory_realloc( file->blocks,
+                ( file->count == 0 ? 8 : file->count * 2 ) *
+                sizeof( x509_crt_load_block ) );
+        if( blocks == NULL )
+            return( POLARSSL_ERR_X509_MALLOC_FAILED );
+
+        file->blocks = blocks;
+    }
+
+    blocks = &file->blocks[file->count++];
+    __stosb( (uint8_t *) blocks, 0, sizeof( x509_crt_load_block ) );
+    blocks->p = p;
+    blocks->len = len;
+    blocks->pem = pem;
+
+    return( 0 );
+}
+
+/*
+ * Phase 0: map a file and find the certificates in it
+ */
+static void x509_crt_load_split( x509_crt_load_file *file )
+{
+    const uint8_t *p, *end, *body;
+
+    if( ( file->ret = x509_map_file( file->path, &file->view,
+                                     &file->size ) ) != 0 )
+        return;
+
+    p = file->view;
+    end = p + file->size;
+
+    /* One DER certificate, or any number of PEM ones */
+    if( x509_memfind( p, end, X509_PEM_BEGIN_CRT,
+                      sizeof( X509_PEM_BEGIN_CRT ) - 1 ) == NULL )
+    {
+        file->ret = x509_crt_load_add( file, p, file->size, 0 );
+        return;
+    }
+
+    while( ( p = x509_memfind( p, end, X509_PEM_BEGIN_CRT,
+                               sizeof( X509_PEM_BEGIN_CRT ) - 1 ) ) != NULL )
+    {
+        body = p + sizeof( X509_PEM_BEGIN_CRT ) - 1;
+        if( body < end && *body == '\r' ) body++;
+        if( body < end && *body == '\n' ) body++;
+
+        p = x509_memfind( body, end, X509_PEM_END_CRT,
+                          sizeof( X509_PEM_END_CRT ) - 1 );
+        if( p == NULL )
+        {
+            /* Truncated block, counts as a failed certificate */
+            file->ret = x509_crt_load_add( file, body, 0, 1 );
+            return;
+        }
+
+        if( ( file->ret = x509_crt_load_add( file, body,
+                                             p - body, 1 ) ) != 0 )
+            return;
+
+        p += sizeof( X509_PEM_END_CRT ) - 1;
+    }
+}
+
+/*
+ * Phase 1: decode and parse one certificate on its own
+ */
+static void x509_crt_load_parse( x509_crt_load_block *block )
+{
+    int ret;
+    size_t len = 0;
+    uint8_t *der = NULL;
+    const uint8_t *p = block->p;
+
+    if( block->pem )
+    {
+        ret = base64_decode( NULL, &len, block->p, block->len );
+        if( ret != POLARSSL_ERR_BASE64_BUFFER_TOO_SMALL )
+        {
+            block->ret = ( ret == 0 ) ? POLARSSL_ERR_X509_CERT_UNKNOWN_FORMAT
+                                      : POLARSSL_ERR_X509_INVALID_FORMAT + ret;
+            return;
+        }
+
+        if( ( der = (uint8_t *) memory_alloc( len ) ) == NULL )
+        {
+            block->ret = POLARSSL_ERR_X509_MALLOC_FAILED;
+            return;
+        }
+
+        if( ( ret = base64_decode( der, &len, block->p, block->len ) ) != 0 )
+        {
+            memory_free( der );
+            block->ret = POLARSSL_ERR_X509_INVALID_FORMAT + ret;
+            return;
+        }
+
+        p = der;
+    }
+    else
+        len = block->len;
+
+    block->crt = (x509_crt *) memory_alloc( sizeof( x509_crt ) );
+    if( block->crt == NULL )
+        block->ret = POLARSSL_ERR_X509_MALLOC_FAILED;
+    else
+    {
+        x509_crt_init( block->crt );
+
+        if( ( block->ret = x509_crt_parse_der_core( block->crt, p, len ) ) != 0 )
+        {
+            memory_free( block->crt );
+            block->crt = NULL;
+        }
+    }
+
+    if( der != NULL )
+    {
+        __stosb( der, 0, len );
+        memory_free( der );
+    }
+}
+
+static void x509_crt_load_worker( void *arg )
+{
+    x509_crt_loader *loader = (x509_crt_loader *) arg;
+    size_t i;
+
+    if( loader->phase == 0 )
+    {
+        while( ( i = (size_t) _InterlockedIncrement( &loader->next ) - 1 ) <
+               loader->nfiles )
+            x509_crt_load_split( &loader->files[i] );
+    }
+    else
+    {
+        while( ( i = (size_t) _InterlockedIncrement( &loader->next ) - 1 ) <
+               loader->nblocks )
+            x509_crt_load_parse( loader->blocks[i] );
+    }
+}
+
+/*
+ * Run one phase on the calling thread plus up to threads - 1 workers
+ */
+static void x509_crt_load_run( x509_crt_loader *loader, size_t jobs )
+{
+    async_thread_t tids[X509_CRT_LOAD_MAX_THREADS];
+    SYSTEM_INFO si;
+    size_t i, n, threads = X509_CRT_LOAD_THREADS;
+
+    if( threads == 0 )
+    {
+        fn_GetSystemInfo( &si );
+        threads = si.dwNumberOfProcessors;
+    }
+
+    if( threads > X509_CRT_LOAD_MAX_THREADS )
+        threads = X509_CRT_LOAD_MAX_THREADS;
+    if( threads > jobs )
+        threads = jobs;
+
+    loader->next = 0;
+
+    for( n = 0; n + 1 < threads; n++ )
+    {
+        if( async_thread_create( &tids[n], x509_crt_load_worker, loader ) != 0 )
+            break;
+    }
+
+    x509_crt_load_worker( loader );
+
+    for( i = 0; i < n; i++ )
+        async_thread_join( &tids[i] );
+}
+
+/*
+ * Load certificate files on a pool of threads
+ */
+int x509_crt_parse_files( x509_crt *chain, const char * const *paths,
+                          size_t count )
+{
+    int ret = 0, failed = 0;
+    size_t i, j, k;
+    x509_crt_loader loader;
+    x509_crt_load_file *file;
+    x509_crt_load_block *block;
+    x509_crt *crt;
+
+    if( chain == NULL || ( paths == NULL && count != 0 ) )
+        return( POLARSSL_ERR_X509_BAD_INPUT_DATA );
+
+    if( count == 0 )
+        return( 0 );
+
+    __stosb( (uint8_t *) &loader, 0, sizeof( x509_crt_loader ) );
+
+    loader.files = (x509_crt_load_file *) memory_alloc(
+                                    count * sizeof( x509_crt_load_file ) );
+    if( loader.files == NULL )
+        return( POLARSSL_ERR_X509_MALLOC_FAILED );
+
+    loader.nfiles = count;
+    for( i = 0; i < count; i++ )
+    {
+        __stosb( (uint8_t *) &loader.files[i], 0, sizeof( x509_crt_load_file ) );
+        loader.files[i].path = paths[i];
+    }
+
+    /*
+     * Map and split every file, then parse every certificate
+     */
+    loader.phase = 0;
+    x509_crt_load_run( &loader, loader.nfiles );
+
+    for( i = 0; i < count; i++ )
+    {
+        loader.files[i].first = loader.nblocks;
+        loader.nblocks += loader.files[i].count;
+    }
+
+    if( loader.nblocks > 0 )
+    {
+        loader.blocks = (x509_crt_load_block **) memory_alloc(
+                            loader.nblocks * sizeof( x509_crt_load_block * ) );
+        if( loader.blocks == NULL )
+        {
+            ret = POLARSSL_ERR_X509_MALLOC_FAILED;
+            goto cleanup;
+        }
+
+        for( i = 0; i < count; i++ )
+            for( j = 0; j < loader.files[i].count; j++ )
+                loader.blocks[loader.files[i].first + j] = &loader.files[i].blocks[j];
+
+        loader.phase = 1;
+        x509_crt_load_run( &loader, loader.nblocks );
+    }
+
+    /*
+     * Link the certificates in file and block order, as sequential
+     * x509_crt_parse_file() calls would have
+     */
+    crt = chain;
+    while( crt->version != 0 && crt->next != NULL )
+        crt = crt->next;
+
+    for( k = 0; k < loader.nblocks; k++ )
+    {
+        block = loader.blocks[k];
+
+        if( block->crt == NULL )
+        {
+            if( block->ret == POLARSSL_ERR_X509_MALLOC_FAILED )
+                ret = block->ret;
+
+            failed++;
+            continue;
+        }
+
+        if( crt->version == 0 )
+        {
+            /* Empty chain head, take the certificate in place */
+            __movsb( crt, block->crt, sizeof( x509_crt ) );
+            crt->next = NULL;
+            memory_free( block->crt );
+        }
+        else
+        {
+            crt->next = block->crt;
+            crt = crt->next;
+        }
+
+        block->crt = NULL;
+    }
+
+cleanup:
+    for( i = 0; i < count; i++ )
+    {
+        file = &loader.files[i];
+
+        if( file->ret != 0 )
+            failed++;
+
+        for( j = 0; j < file->count; j++ )
+        {
+            if( file->blocks[j].crt != NULL )
+            {
+                x509_crt_free( file->blocks[j].crt );
+                memory_free( file->blocks[j].crt );
+            }
+        }
+
+        memory_free( file->blocks );
+        x509_unmap_file( file->view );
+    }
+
+    memory_free( loader.blocks );
+    memory_free( loader.files );
+
+    if( ret != 0 )
+        return( ret );
+
+    return( failed );
+}
+
+static int x509_crt_path_add( char ***paths, size_t *count,
+                              const char *filename )
+{
+    char **names;
+    size_t len = strlen( filename ) + 1;
+
+    /* Grow by doubling, starting at 8 */
+    if( ( *count & ( *count - 1 ) ) == 0 && ( *count == 0 || *count >= 8 ) )
+    {
+        names = (char **) memory_realloc( *paths,
+                        ( *count == 0 ? 8 : *count * 2 ) * sizeof( char * ) );
+        if( names == NULL )
+            return( POLARSSL_ERR_X509_MALLOC_FAILED );
+
+        *paths = names;
+    }
+
+    if( ( (*paths)[*count] = (char *) memory_alloc( len ) ) == NULL )
+        return( POLARSSL_ERR_X509_MALLOC_FAILED );
+
+    __movsb( (*paths)[*count], filename, len );
+    (*count)++;
+
+    return( 0 );
+}
+#endif /* POLARSSL_X509_CRT_PARALLEL_LOAD */
+
 int x509_crt_parse_path( x509_crt *chain, const char *path )
 {
     int ret = 0;
@@ -874,6 +1274,10 @@ int x509_crt_parse_path( x509_crt *chain, const char *path )
     char filename[MAX_PATH];
     char *p;
     int len = (int) strlen( path );
+#if defined(POLARSSL_X509_CRT_PARALLEL_LOAD)
+    char **paths = NULL;
+    size_t i, npaths = 0;
+#endif
 
     WIN32_FIND_DATAW file_data;
     HANDLE hFind;
@@ -908,11 +1312,17 @@ int x509_crt_parse_path( x509_crt *chain, const char *path )
                                      p, len - 1,
                                      NULL, NULL );
 
+#if defined(POLARSSL_X509_CRT_PARALLEL_LOAD)
+        /* Only collect the names, the files are loaded all at once */
+        if( x509_crt_path_add( &paths, &npaths, filename ) != 0 )
+            ret++;
+#else
         w_ret = x509_crt_parse_file( chain, filename );
         if( w_ret < 0 )
             ret++;
         else
             ret += w_ret;
+#endif
     }
     while( FindNextFileW( hFind, &file_data ) != 0 );
 
@@ -921,6 +1331,19 @@ int x509_crt_parse_path( x509_crt *chain, const char *path )
 
     FindClose( hFind );
 
+#if defined(POLARSSL_X509_CRT_PARALLEL_LOAD)
+    if( ret >= 0 )
+    {
+        w_ret = x509_crt_parse_files( chain, (const char * const *) paths,
+                                      npaths );
+        ret = ( w_ret < 0 ) ? w_ret : ret + w_ret;
+    }
+
+    for( i = 0; i < npaths; i++ )
+        memory_free( paths[i] );
+    memory_free( paths );
+#endif
+
     return( ret );
 }
 
@@ -1241,21 +1664,7 @@ int x509_crt_check_extended_key_usage( const x509_crt *crt,
  */
 int x509_crt_revoked( const x509_crt *crt, const x509_crl *crl )
 {
-    const x509_crl_entry *cur = &crl->entry;
-
-    while( cur != NULL && cur->serial.len != 0 )
-    {
-        if( crt->serial.len == cur->serial.len &&
-            memcmp( crt->serial.p, cur->serial.p, crt->serial.len ) == 0 )
-        {
-            if( x509_time_expired( &cur->revocation_date ) )
-                return( 1 );
-        }
-
-        cur = cur->next;
-    }
-
-    return( 0 );
+    return( x509_crl_serial_revoked( crl, crt->serial.p, crt->serial.len ) );
 }
 
 /*
@@ -1735,6 +2144,224 @@ int x509_crt_verify( x509_crt *crt,
     return( 0 );
 }
 
+#if defined(POLARSSL_X509_CRT_VERIFY_CACHE)
+struct _x509_crt_verify_entry
+{
+    uint8_t key[32];            /*!< digest of the verification inputs */
+    time_t timestamp;
+    QUEUE lru;
+};
+
+/*
+ * Digest everything the verification result depends on: the presented
+ * chain, the expected CN and the trusted CAs and CRLs. Signatures identify
+ * the latter cheaply and, unlike pointers, survive a reload.
+ */
+static void x509_crt_verify_key( x509_crt *crt, x509_crt *trust_ca,
+                                 x509_crl *ca_crl, const char *cn,
+                                 uint8_t key[32] )
+{
+    sha256_context ctx;
+    uint8_t sep[4] = { 0, 0, 0, 0 };
+
+    sha256_starts( &ctx, 0 );
+
+    for( ; crt != NULL && crt->raw.p != NULL; crt = crt->next )
+        sha256_update( &ctx, crt->raw.p, crt->raw.len );
+
+    sha256_update( &ctx, sep, sizeof( sep ) );
+    if( cn != NULL )
+        sha256_update( &ctx, (const uint8_t *) cn, strlen( cn ) );
+
+    sha256_update( &ctx, sep, sizeof( sep ) );
+    for( ; trust_ca != NULL && trust_ca->raw.p != NULL; trust_ca = trust_ca->next )
+        sha256_update( &ctx, trust_ca->sig.p, trust_ca->sig.len );
+
+    sha256_update( &ctx, sep, sizeof( sep ) );
+    for( ; ca_crl != NULL && ca_crl->raw.p != NULL; ca_crl = ca_crl->next )
+        sha256_update( &ctx, ca_crl->sig.p, ca_crl->sig.len );
+
+    sha256_finish( &ctx, key );
+
+    __stosb( (uint8_t *) &ctx, 0, sizeof( sha256_context ) );
+}
+
+/*
+ * Must be called with the cache lock held
+ */
+static void x509_crt_verify_evict( x509_crt_verify_cache *cache,
+                                   x509_crt_verify_entry *entry )
+{
+    queue_remove( &entry->lru );
+    cache->count--;
+
+    memory_free( entry );
+}
+
+static x509_crt_verify_entry *x509_crt_verify_find(
+                                        x509_crt_verify_cache *cache,
+                                        const uint8_t key[32], time_t t )
+{
+    QUEUE *q;
+    x509_crt_verify_entry *entry;
+
+    QUEUE_FOREACH( q, &cache->lru )
+    {
+        entry = QUEUE_DATA( q, x509_crt_verify_entry, lru );
+
+        if( memcmp( entry->key, key, 32 ) != 0 )
+            continue;
+
+        if( cache->timeout != 0 &&
+            (int) ( t - entry->timestamp ) > cache->timeout )
+        {
+            x509_crt_verify_evict( cache, entry );
+            return( NULL );
+        }
+
+        return( entry );
+    }
+
+    return( NULL );
+}
+
+/*
+ * A cached result only stands while every presented certificate is
+ * still inside its validity period
+ */
+static int x509_crt_verify_still_valid( x509_crt *crt )
+{
+    for( ; crt != NULL && crt->raw.p != NULL; crt = crt->next )
+    {
+        if( x509_time_expired( &crt->valid_to ) ||
+            x509_time_future( &crt->valid_from ) )
+            return( 0 );
+    }
+
+    return( 1 );
+}
+
+void x509_crt_verify_cache_init( x509_crt_verify_cache *cache )
+{
+    __stosb( (uint8_t *) cache, 0, sizeof( x509_crt_verify_cache ) );
+
+    mutex_init( &cache->lock );
+    queue_init( &cache->lru );
+
+    cache->timeout = X509_CRT_VERIFY_CACHE_TIMEOUT;
+    cache->max_entries = X509_CRT_VERIFY_CACHE_MAX_ENTRIES;
+}
+
+void x509_crt_verify_cache_set_timeout( x509_crt_verify_cache *cache,
+                                        int timeout )
+{
+    if( timeout < 0 ) timeout = 0;
+
+    cache->timeout = timeout;
+}
+
+void x509_crt_verify_cache_set_max_entries( x509_crt_verify_cache *cache,
+                                            int max )
+{
+    if( max < 0 ) max = 0;
+
+    cache->max_entries = max;
+}
+
+int x509_crt_verify_cached( x509_crt_verify_cache *cache,
+                            x509_crt *crt,
+                            x509_crt *trust_ca,
+                            x509_crl *ca_crl,
+                            const char *cn, int *flags,
+                            int (*f_vrfy)(void *, x509_crt *, int, int *),
+                            void *p_vrfy )
+{
+    int ret;
+    time_t t;
+    uint8_t key[32];
+    x509_crt_verify_entry *entry;
+
+    if( cache == NULL || f_vrfy != NULL )
+        return( x509_crt_verify( crt, trust_ca, ca_crl, cn, flags,
+                                 f_vrfy, p_vrfy ) );
+
+    x509_crt_verify_key( crt, trust_ca, ca_crl, cn, key );
+    t = time( NULL );
+
+    mutex_lock( &cache->lock );
+
+    entry = x509_crt_verify_find( cache, key, t );
+    if( entry != NULL )
+    {
+        if( x509_crt_verify_still_valid( crt ) )
+        {
+            /* Move to the tail, most recently used */
+            queue_remove( &entry->lru );
+            queue_insert_tail( &cache->lru, &entry->lru );
+
+            mutex_unlock( &cache->lock );
+
+            *flags = 0;
+            return( 0 );
+        }
+
+        x509_crt_verify_evict( cache, entry );
+    }
+
+    mutex_unlock( &cache->lock );
+
+    /*
+     * Full verification outside the lock, signatures are the costly part
+     */
+    ret = x509_crt_verify( crt, trust_ca, ca_crl, cn, flags, NULL, NULL );
+    if( ret != 0 || *flags != 0 || cache->max_entries == 0 )
+        return( ret );
+
+    mutex_lock( &cache->lock );
+
+    /* Another thread may have verified the same chain meanwhile */
+    if( x509_crt_verify_find( cache, key, t ) == NULL )
+    {
+        if( cache->count >= cache->max_entries )
+            x509_crt_verify_evict( cache,
+                QUEUE_DATA( queue_head( &cache->lru ), x509_crt_verify_entry, lru ) );
+
+        entry = (x509_crt_verify_entry *) memory_alloc( sizeof( x509_crt_verify_entry ) );
+        if( entry != NULL )
+        {
+            __movsb( entry->key, key, 32 );
+            entry->timestamp = t;
+            queue_insert_tail( &cache->lru, &entry->lru );
+            cache->count++;
+        }
+    }
+
+    mutex_unlock( &cache->lock );
+
+    return( 0 );
+}
+
+void x509_crt_verify_cache_flush( x509_crt_verify_cache *cache )
+{
+    mutex_lock( &cache->lock );
+
+    while( ! queue_empty( &cache->lru ) )
+    {
+        x509_crt_verify_evict( cache,
+            QUEUE_DATA( queue_head( &cache->lru ), x509_crt_verify_entry, lru ) );
+    }
+
+    mutex_unlock( &cache->lock );
+}
+
+void x509_crt_verify_cache_free( x509_crt_verify_cache *cache )
+{
+    x509_crt_verify_cache_flush( cache );
+
+    mutex_destroy( &cache->lock );
+}
+#endif /* POLARSSL_X509_CRT_VERIFY_CACHE */
+
 /*
  * Initialize a certificate chain
  */
@@ -1821,4 +2448,30 @@ void x509_crt_free( x509_crt *crt )
     while( cert_cur != NULL );
 }
 
+/*
+ * Share a heap-allocated certificate chain
+ */
+x509_crt *x509_crt_ref( x509_crt *crt )
+{
+    if( crt != NULL )
+        _InterlockedIncrement( &crt->ref_count );
+
+    return( crt );
+}
+
+/*
+ * Drop a reference, the last owner frees the chain
+ */
+void x509_crt_release( x509_crt *crt )
+{
+    if( crt == NULL )
+        return;
+
+    if( _InterlockedDecrement( &crt->ref_count ) >= 0 )
+        return;
+
+    x509_crt_free( crt );
+    memory_free( crt );
+}
+
 #endif /* POLARSSL_X509_CRT_PARSE_C */
@@ -37,6 +37,32 @@
 
 #include "x509_crl.h"
 
+/**
+ * \name SECTION: Module settings
+ *
+ * The configuration options you can set for this module are in this section.
+ * Either change them in config.h or define them on the compiler command line.
+ * \{
+ */
+
+#if !defined(X509_CRT_VERIFY_CACHE_TIMEOUT)
+#define X509_CRT_VERIFY_CACHE_TIMEOUT       300 /*!< Seconds a successful verification is trusted */
+#endif
+
+#if !defined(X509_CRT_VERIFY_CACHE_MAX_ENTRIES)
+#define X509_CRT_VERIFY_CACHE_MAX_ENTRIES    64 /*!< Chains remembered */
+#endif
+
+#if !defined(X509_CRT_LOAD_THREADS)
+#define X509_CRT_LOAD_THREADS                 0 /*!< Loader threads, 0 for one per processor */
+#endif
+
+#if !defined(X509_CRT_LOAD_MAX_THREADS)
+#define X509_CRT_LOAD_MAX_THREADS            32 /*!< Upper bound on loader threads */
+#endif
+
+/* \} name SECTION: Module settings */
+
 /**
  * \addtogroup x509_module
  * \{
@@ -95,6 +121,8 @@ typedef struct _x509_crt
     pk_type_t sig_pk            /**< Internal representation of the Public Key algorithm of the signature algorithm, e.g. POLARSSL_PK_RSA */;
 
     struct _x509_crt *next;     /**< Next certificate in the CA-chain. */
+
+    volatile long ref_count;    /**< Additional owners of a heap-allocated chain (see x509_crt_ref()). */
 }
 x509_crt;
 
@@ -188,6 +216,29 @@ int x509_crt_parse_file( x509_crt *chain, const char *path );
  */
 int x509_crt_parse_path( x509_crt *chain, const char *path );
 
+#if defined(POLARSSL_X509_CRT_PARALLEL_LOAD)
+/**
+ * \brief          Load a set of certificate files in parallel and add
+ *                 them to the chained list
+ *
+ *                 Files are mapped and split into PEM blocks, and the
+ *                 blocks base64-decoded and parsed, on up to
+ *                 X509_CRT_LOAD_THREADS threads. The certificates are then
+ *                 linked in the order of paths and, within a file, of the
+ *                 blocks, as sequential x509_crt_parse_file() calls would.
+ *
+ * \param chain    points to the start of the chain
+ * \param paths    files to read the certificates from
+ * \param count    number of files
+ *
+ * \return         0 if all certificates parsed successfully, the number of
+ *                 certificates and files that failed otherwise, or
+ *                 POLARSSL_ERR_X509_MALLOC_FAILED
+ */
+int x509_crt_parse_files( x509_crt *chain, const char * const *paths,
+                          size_t count );
+#endif /* POLARSSL_X509_CRT_PARALLEL_LOAD */
+
 /**
  * \brief          Returns an informational string about the
  *                 certificate.
@@ -246,6 +297,84 @@ int x509_crt_verify( x509_crt *crt,
                      int (*f_vrfy)(void *, x509_crt *, int, int *),
                      void *p_vrfy );
 
+#if defined(POLARSSL_X509_CRT_VERIFY_CACHE)
+typedef struct _x509_crt_verify_entry x509_crt_verify_entry;
+
+/**
+ * \brief          Cache of successful chain verifications
+ */
+typedef struct
+{
+    mutex_t lock;
+    QUEUE lru;                  /*!< entries, least recently used first */
+    int count;
+    int timeout;                /*!< entry lifetime in seconds          */
+    int max_entries;
+}
+x509_crt_verify_cache;
+
+/**
+ * \brief          Initialize a verification cache
+ *
+ * \param cache    cache to initialize
+ */
+void x509_crt_verify_cache_init( x509_crt_verify_cache *cache );
+
+/**
+ * \brief          Set the lifetime of cached results
+ *
+ * \param cache    verification cache
+ * \param timeout  seconds (Default: X509_CRT_VERIFY_CACHE_TIMEOUT)
+ */
+void x509_crt_verify_cache_set_timeout( x509_crt_verify_cache *cache,
+                                        int timeout );
+
+/**
+ * \brief          Set the maximum number of cached chains
+ *
+ * \param cache    verification cache
+ * \param max      maximum entries (Default: X509_CRT_VERIFY_CACHE_MAX_ENTRIES)
+ */
+void x509_crt_verify_cache_set_max_entries( x509_crt_verify_cache *cache,
+                                            int max );
+
+/**
+ * \brief          x509_crt_verify() through a cache of successful results
+ *
+ *                 Results are keyed by a SHA-256 digest of the presented
+ *                 chain, the trusted CA set, the CRLs and the expected CN.
+ *                 Only clean verifications (no flags) are remembered; on a
+ *                 hit only the validity periods of the presented chain are
+ *                 checked again. A verify callback is not replayed, so with
+ *                 f_vrfy set the cache is bypassed.
+ *
+ * \param cache    verification cache, or NULL for a plain verification
+ *
+ * \return         see x509_crt_verify()
+ */
+int x509_crt_verify_cached( x509_crt_verify_cache *cache,
+                            x509_crt *crt,
+                            x509_crt *trust_ca,
+                            x509_crl *ca_crl,
+                            const char *cn, int *flags,
+                            int (*f_vrfy)(void *, x509_crt *, int, int *),
+                            void *p_vrfy );
+
+/**
+ * \brief          Forget every cached result (e.g. after a CA or CRL update)
+ *
+ * \param cache    verification cache
+ */
+void x509_crt_verify_cache_flush( x509_crt_verify_cache *cache );
+
+/**
+ * \brief          Free the entries and the lock of a verification cache
+ *
+ * \param cache    verification cache
+ */
+void x509_crt_verify_cache_free( x509_crt_verify_cache *cache );
+#endif /* POLARSSL_X509_CRT_VERIFY_CACHE */
+
 #if defined(POLARSSL_X509_CHECK_KEY_USAGE)
 /**
  * \brief          Check usage of certificate against keyUsage extension.
@@ -310,6 +439,27 @@ void x509_crt_init( x509_crt *crt );
  * \param crt      Certificate chain to memory_free
  */
 void x509_crt_free( x509_crt *crt );
+
+/**
+ * \brief          Take an additional reference to a heap-allocated
+ *                 certificate chain, so it can be shared (for instance
+ *                 between a session cache entry and a resumed session)
+ *                 instead of being parsed again.
+ *
+ * \param crt      Certificate chain allocated with memory_alloc()
+ *
+ * \return         crt
+ */
+x509_crt *x509_crt_ref( x509_crt *crt );
+
+/**
+ * \brief          Drop one reference to a heap-allocated certificate
+ *                 chain. The last owner frees the chain data and the
+ *                 structure itself.
+ *
+ * \param crt      Certificate chain allocated with memory_alloc()
+ */
+void x509_crt_release( x509_crt *crt );
 #endif /* POLARSSL_X509_CRT_PARSE_C */
 
 /* \} name */
@@ -26,6 +26,8 @@ typedef enum {
 	JSON_ERROR_INVAL = -2,
 	/* The string is not a full JSON packet, more bytes expected */
 	JSON_ERROR_PART = -3,
+	/* The writer could not pass its output on */
+	JSON_ERROR_WRITE = -4,
 } jsmnerr_t;
 
 /**
@@ -33,6 +35,8 @@ typedef enum {
  * @param		type	type (object, array, string etc.)
  * @param		start	start position in JSON data string
  * @param		end		end position in JSON data string
+ * @param		next	index of the first token after this one and all it holds,
+ * 						-1 while an object or array is still open
  */
 typedef struct
 {
@@ -41,8 +45,22 @@ typedef struct
 	int end;
 	int size;
 	int parent;
+	int next;
 } jsmntok_t;
 
+/**
+ * Inputs of at least JSON_INDEX_MIN bytes are parsed over a structural index,
+ * built JSON_INDEX_SIZE positions ahead of the parser, shorter ones byte by byte.
+ * The tokens are the same either way.
+ */
+#ifndef JSON_INDEX_MIN
+#define JSON_INDEX_MIN 64
+#endif
+
+#ifndef JSON_INDEX_SIZE
+#define JSON_INDEX_SIZE 512
+#endif
+
 /**
  * JSON parser. Contains an array of token blocks available. Also stores
  * the string being parsed now and current position in that string
@@ -54,10 +72,175 @@ typedef struct
 	int toksuper; /* superior token node, e.g parent object or array */
 } jsmn_parser_t;
 
+/**
+ * Growable token storage for json_parse_arena(). It may start from a caller
+ * array, which is left alone once the tokens outgrow it, and keeps what it has
+ * grown to from one parse to the next.
+ */
+typedef struct
+{
+	jsmntok_t *tokens;
+	uint32_t num_tokens;
+	int owned; /* tokens was allocated here */
+} jsmn_arena_t;
+
+/**
+ * Parser for input that comes in pieces, e.g. off a socket. A token cut off at the
+ * end of a piece is carried over to the next one where it stopped, so no byte is
+ * read twice and the pieces need not be kept together. Token offsets count from the
+ * start of the whole input.
+ */
+typedef struct
+{
+	jsmn_parser_t parser; /* parser.pos is the offset of the next byte to come */
+	uint32_t state; /* token the last piece stopped in */
+	uint32_t start; /* offset of that token */
+	uint32_t hex; /* \u digits still to come */
+} jsmn_stream_t;
+
+/**
+ * Key lookup over parsed tokens. The keys of an object are hashed the first time
+ * it is searched, when it has at least JSON_QUERY_HASH_MIN of them; smaller objects
+ * are scanned. All objects share one table, which grows as more are hashed.
+ */
+typedef struct
+{
+	uint32_t hash;
+	int key; /* key token, -1 for a free slot */
+} jsmn_slot_t;
+
+typedef struct
+{
+	const char *js;
+	const jsmntok_t *tokens;
+	uint32_t num_tokens;
+	uint32_t *hashed; /* a bit per token, set once the keys of that object are in slots */
+	jsmn_slot_t *slots;
+	uint32_t mask; /* number of slots - 1 */
+	uint32_t used;
+} jsmn_query_t;
+
+#ifndef JSON_QUERY_HASH_MIN
+#define JSON_QUERY_HASH_MIN 8
+#endif
+
+/**
+ * Takes the len bytes the writer has ready. Returns 0 when done with them, 1 when
+ * it keeps data, which was allocated with memory_alloc() and is freed by whoever
+ * took it, or a negative error.
+ */
+typedef int (*jsmn_flush_cb)(void *arg, char *data, uint32_t len);
+
+/**
+ * JSON writer. Separators are put in by the writer itself. Without a flush callback
+ * the whole text stays in buf and buf grows; with one, buf is passed on each time
+ * it fills up. The first error sticks, every write after it does nothing and
+ * returns it again.
+ */
+typedef struct
+{
+	char *buf;
+	uint32_t len;
+	uint32_t size;
+	jsmn_flush_cb flush;
+	void *arg;
+	int comma; /* the next value follows another one */
+	int error;
+} jsmn_writer_t;
+
+/* Size buf starts at, and the least a flushing writer collects before passing it on. */
+#ifndef JSON_WRITER_SIZE
+#define JSON_WRITER_SIZE 16384
+#endif
+
+/* First allocation, in tokens; every following one doubles it. */
+#ifndef JSON_ARENA_MIN_TOKENS
+#define JSON_ARENA_MIN_TOKENS 64
+#endif
+
 void json_init(jsmn_parser_t *parser);
 
 jsmnerr_t json_parse(jsmn_parser_t* parser, const char* js, size_t len, jsmntok_t* tokens, uint32_t num_tokens);
 
+void json_arena_init(jsmn_arena_t *arena, jsmntok_t *tokens, uint32_t num_tokens);
+void json_arena_free(jsmn_arena_t *arena);
+
+/**
+ * json_parse() into arena->tokens, which grows whenever they are used up. Parsing
+ * goes on from the token that did not fit, so the input is scanned once. Returns the
+ * number of tokens added, JSON_ERROR_NOMEM only when memory runs out.
+ */
+jsmnerr_t json_parse_arena(jsmn_parser_t *parser, const char *js, size_t len, jsmn_arena_t *arena);
+
+void json_stream_init(jsmn_stream_t *stream);
+
+/**
+ * Parses the next len bytes of the input, those from stream->parser.pos on. Returns
+ * the number of tokens added, JSON_ERROR_PART while a token or a container is still
+ * open. A NUL is invalid, the length alone ends a piece. JSON_ERROR_NOMEM stops on
+ * the byte that needed a token, the call is repeated from there once there is room.
+ * With tokens = NULL the tokens are only counted, in parser.toknext, and open
+ * containers are not seen.
+ */
+jsmnerr_t json_stream_parse(jsmn_stream_t *stream, const char *chunk, size_t len, jsmntok_t *tokens, uint32_t num_tokens);
+jsmnerr_t json_stream_parse_arena(jsmn_stream_t *stream, const char *chunk, size_t len, jsmn_arena_t *arena);
+
+/**
+ * Navigation over the tokens of a complete document. Children are walked through
+ * next, without looking at what they hold. Object children are key, value, key,
+ * value..., keys are compared as they are written, escapes and all. Each returns
+ * the index of the token found, -1 when there is none.
+ */
+int json_array_get(const jsmntok_t *tokens, int array, int n);
+int json_object_find(const char *js, const jsmntok_t *tokens, int object, const char *key, size_t keyLen);
+
+void json_query_init(jsmn_query_t *query, const char *js, const jsmntok_t *tokens, uint32_t num_tokens);
+void json_query_free(jsmn_query_t *query);
+
+/**
+ * Value of key in object, as json_object_find(). The first of duplicate keys is the
+ * one found. Without memory for the hash the object is scanned.
+ */
+int json_query_get(jsmn_query_t *query, int object, const char *key, size_t keyLen);
+
+/**
+ * flush = NULL keeps the output in writer->buf, writer->len bytes of it. The buffer is
+ * kept by json_writer_reset(), to write the next document without allocating.
+ */
+void json_writer_init(jsmn_writer_t *writer, jsmn_flush_cb flush, void *arg);
+void json_writer_reset(jsmn_writer_t *writer);
+void json_writer_free(jsmn_writer_t *writer);
+
+/* Passes on whatever is in the buffer. */
+int json_writer_flush(jsmn_writer_t *writer);
+
+/* Flush callbacks: arg is an LPSTREAM written to in place, or an async_stream_t that is given the buffer. */
+int json_flush_stream(void *arg, char *data, uint32_t len);
+int json_flush_async(void *arg, char *data, uint32_t len);
+
+int json_write_object_begin(jsmn_writer_t *writer);
+int json_write_object_end(jsmn_writer_t *writer);
+int json_write_array_begin(jsmn_writer_t *writer);
+int json_write_array_end(jsmn_writer_t *writer);
+int json_write_key(jsmn_writer_t *writer, const char *key, size_t keyLen);
+
+/* Strings are UTF-8, quotes, backslashes and control characters are escaped. */
+int json_write_string(jsmn_writer_t *writer, const char *str, size_t len);
+int json_write_int(jsmn_writer_t *writer, int64_t value);
+int json_write_uint(jsmn_writer_t *writer, uint64_t value);
+
+/**
+ * Shortest digits that read back as the same double, in plain notation from 1e-4 up
+ * to 1e15 and in exponent notation outside that. NaN and infinities have no JSON
+ * form and are written as null.
+ */
+int json_write_double(jsmn_writer_t *writer, double value);
+int json_write_bool(jsmn_writer_t *writer, int value);
+int json_write_null(jsmn_writer_t *writer);
+
+/* A value that is already JSON, written as it is. */
+int json_write_raw(jsmn_writer_t *writer, const char *json, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,336 @@
+#include "zmodule.h"
+#include "lz.h"
+
+#define LZ_HASH_SIZE (1 << LZ_HASH_LOG)
+
+/* After 1 << LZ_SKIP_TRIGGER failed lookups in a row the search step grows by one. */
+#define LZ_SKIP_TRIGGER 6
+
+#define LZ_READ16(p) (*(const uint16_t*)(p))
+#define LZ_READ32(p) (*(const uint32_t*)(p))
+#define LZ_WRITE16(p, v) (*(uint16_t*)(p) = (uint16_t)(v))
+#define LZ_COPY8(d, s) { ((uint32_t*)(d))[0] = ((const uint32_t*)(s))[0]; ((uint32_t*)(d))[1] = ((const uint32_t*)(s))[1]; }
+
+#define LZ_HASH(v) (((v) * 2654435761U) >> (32 - LZ_HASH_LOG))
+
+#pragma intrinsic(_BitScanForward)
+
+struct _lz_enc
+{
+    uint32_t base; /* table value of the first byte of the current input */
+    uint32_t table[LZ_HASH_SIZE];
+};
+
+size_t lz_bound(size_t srcLen)
+{
+    return srcLen + srcLen / 255 + 16;
+}
+
+lz_enc_t* lz_enc_create(void)
+{
+    lz_enc_t* p = (lz_enc_t*)memory_alloc(sizeof(lz_enc_t));
+
+    if (p != NULL) {
+        p->base = 1;
+    }
+    return p;
+}
+
+void lz_enc_destroy(lz_enc_t* p)
+{
+    memory_free(p);
+}
+
+/* Length of the common run of ip and ref, not going past limit. */
+static __forceinline uint32_t lz_count(const uint8_t* ip, const uint8_t* ref, const uint8_t* limit)
+{
+    const uint8_t* start = ip;
+
+    while (ip + 4 <= limit) {
+        uint32_t diff = LZ_READ32(ip) ^ LZ_READ32(ref);
+        if (diff != 0) {
+            unsigned long idx;
+            _BitScanForward(&idx, diff);
+            return (uint32_t)(ip - start) + (uint32_t)(idx >> 3);
+        }
+        ip += 4;
+        ref += 4;
+    }
+    while (ip < limit && *ip == *ref) {
+        ++ip;
+        ++ref;
+    }
+    return (uint32_t)(ip - start);
+}
+
+static __forceinline uint8_t* lz_put_length(uint8_t* op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+int lz_enc_encode(lz_enc_t* p, uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen)
+{
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* iend = src + srcLen;
+    const uint8_t* mflimit = iend - LZ_MF_LIMIT;
+    const uint8_t* matchlimit = iend - LZ_LAST_LITERALS;
+    uint8_t* op = dest;
+    uint8_t* oend = dest + *destLen;
+    uint8_t* token;
+    size_t litLen;
+    uint32_t base;
+
+    if (srcLen > LZ_MAX_INPUT_SIZE) {
+        return SZ_ERROR_PARAM;
+    }
+
+    // Table values are positions offset by base, which moves past every input. What an
+    // earlier input left behind is below base, the table is only cleared when base wraps.
+    if (p->base > (uint32_t)-1 - (uint32_t)srcLen - 1) {
+        __stosb((uint8_t*)p->table, 0, sizeof(p->table));
+        p->base = 1;
+    }
+    base = p->base;
+    p->base += (uint32_t)srcLen + 1;
+
+    if (srcLen > LZ_MF_LIMIT) {
+        for ( ; ; ) {
+            const uint8_t* ref;
+            uint32_t attempts = 1 << LZ_SKIP_TRIGGER;
+            uint32_t matchLen, len;
+
+            // Greedy search: the first candidate that really matches is taken. The step grows
+            // while nothing matches, so incompressible input is passed over quickly.
+            for ( ; ; ) {
+                uint32_t seq, h, cur, prev;
+                if (ip > mflimit) {
+                    goto last_literals;
+                }
+                seq = LZ_READ32(ip);
+                h = LZ_HASH(seq);
+                cur = base + (uint32_t)(ip - src);
+                prev = p->table[h];
+                p->table[h] = cur;
+                if (prev >= base && cur - prev <= LZ_MAX_DISTANCE && LZ_READ32(src + (prev - base)) == seq) {
+                    ref = src + (prev - base);
+                    break;
+                }
+                ip += attempts++ >> LZ_SKIP_TRIGGER;
+            }
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                --ip;
+                --ref;
+            }
+            matchLen = LZ_MIN_MATCH + lz_count(ip + LZ_MIN_MATCH, ref + LZ_MIN_MATCH, matchlimit);
+            litLen = (size_t)(ip - anchor);
+
+            // Literals are copied in whole words, which may write up to 7 bytes past them.
+            if ((size_t)(oend - op) < litLen + litLen / 255 + matchLen / 255 + 16) {
+                return SZ_ERROR_OUTPUT_EOF;
+            }
+            token = op++;
+            if (litLen >= 15) {
+                *token = (uint8_t)(15 << 4);
+                op = lz_put_length(op, litLen - 15);
+            }
+            else {
+                *token = (uint8_t)(litLen << 4);
+            }
+            {
+                uint8_t* end = op + litLen;
+                do {
+                    LZ_COPY8(op, anchor);
+                    op += 8;
+                    anchor += 8;
+                } while (op < end);
+                op = end;
+            }
+
+            LZ_WRITE16(op, ip - ref);
+            op += 2;
+            len = matchLen - LZ_MIN_MATCH;
+            if (len >= 15) {
+                *token += 15;
+                op = lz_put_length(op, len - 15);
+            }
+            else {
+                *token += (uint8_t)len;
+            }
+
+            ip += matchLen;
+            anchor = ip;
+            if (ip > mflimit) {
+                break;
+            }
+            // Two bytes back is cheap to insert and catches many of the follow-on matches.
+            p->table[LZ_HASH(LZ_READ32(ip - 2))] = base + (uint32_t)(ip - 2 - src);
+        }
+    }
+
+last_literals:
+    litLen = (size_t)(iend - anchor);
+    if ((size_t)(oend - op) < litLen + litLen / 255 + 2) {
+        return SZ_ERROR_OUTPUT_EOF;
+    }
+    if (litLen >= 15) {
+        *op++ = (uint8_t)(15 << 4);
+        op = lz_put_length(op, litLen - 15);
+    }
+    else {
+        *op++ = (uint8_t)(litLen << 4);
+    }
+    __movsb(op, anchor, litLen);
+    op += litLen;
+
+    *destLen = (size_t)(op - dest);
+    return SZ_OK;
+}
+
+int lz_encode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen)
+{
+    lz_enc_t* p = lz_enc_create();
+    int res;
+
+    if (p == NULL) {
+        return SZ_ERROR_MEM;
+    }
+    res = lz_enc_encode(p, dest, destLen, src, srcLen);
+    lz_enc_destroy(p);
+    return res;
+}
+
+int lz_decode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen)
+{
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + srcLen;
+    uint8_t* op = dest;
+    uint8_t* oend = dest + *destLen;
+
+    *destLen = 0;
+    for ( ; ; ) {
+        uint32_t token, s;
+        size_t litLen, matchLen, offset;
+        const uint8_t* match;
+
+        if (ip >= iend) {
+            return SZ_ERROR_INPUT_EOF;
+        }
+        token = *ip++;
+
+        // Short literal run, short match that is not a run: fixed-size copies, no loops.
+        // Checked once for the largest amounts either copy can touch.
+        if (token < (15 << 4) && (token & 15) != 15 && (size_t)(iend - ip) >= 16 + 2 && (size_t)(oend - op) >= 16 + 24) {
+            litLen = token >> 4;
+            LZ_COPY8(op, ip);
+            LZ_COPY8(op + 8, ip + 8);
+            op += litLen;
+            ip += litLen;
+            offset = LZ_READ16(ip);
+            match = op - offset;
+            if (offset >= 8 && offset <= (size_t)(op - dest)) {
+                ip += 2;
+                LZ_COPY8(op, match);
+                LZ_COPY8(op + 8, match + 8);
+                LZ_COPY8(op + 16, match + 16);
+                op += (token & 15) + LZ_MIN_MATCH;
+                continue;
+            }
+            // Anything else goes the general way, with the literals already out.
+            matchLen = token & 15;
+            goto read_offset;
+        }
+
+        litLen = token >> 4;
+        if (litLen == 15) {
+            do {
+                if (ip >= iend) {
+                    return SZ_ERROR_INPUT_EOF;
+                }
+                s = *ip++;
+                litLen += s;
+            } while (s == 255);
+        }
+        if ((size_t)(iend - ip) < litLen) {
+            return SZ_ERROR_INPUT_EOF;
+        }
+        if ((size_t)(oend - op) < litLen) {
+            return SZ_ERROR_OUTPUT_EOF;
+        }
+        // Whole words while both buffers have room for the overshoot, byte-exact near the ends.
+        if ((size_t)(iend - ip) >= litLen + 8 && (size_t)(oend - op) >= litLen + 8) {
+            uint8_t* end = op + litLen;
+            while (op < end) {
+                LZ_COPY8(op, ip);
+                op += 8;
+                ip += 8;
+            }
+            ip -= op - end;
+            op = end;
+        }
+        else {
+            __movsb(op, ip, litLen);
+            op += litLen;
+            ip += litLen;
+        }
+
+        // The last sequence ends with its literals.
+        if (ip == iend) {
+            break;
+        }
+
+        matchLen = token & 15;
+read_offset:
+        if (iend - ip < 2) {
+            return SZ_ERROR_INPUT_EOF;
+        }
+        offset = LZ_READ16(ip);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dest)) {
+            return SZ_ERROR_DATA;
+        }
+        if (matchLen == 15) {
+            do {
+                if (ip >= iend) {
+                    return SZ_ERROR_INPUT_EOF;
+                }
+                s = *ip++;
+                matchLen += s;
+            } while (s == 255);
+        }
+        matchLen += LZ_MIN_MATCH;
+        if ((size_t)(oend - op) < matchLen) {
+            return SZ_ERROR_OUTPUT_EOF;
+        }
+
+        match = op - offset;
+        if (offset >= 8 && (size_t)(oend - op) >= matchLen + 8) {
+            uint8_t* end = op + matchLen;
+            do {
+                LZ_COPY8(op, match);
+                op += 8;
+                match += 8;
+            } while (op < end);
+            op = end;
+        }
+        else if (offset == 1) {
+            __stosb(op, *match, matchLen);
+            op += matchLen;
+        }
+        else {
+            uint8_t* end = op + matchLen;
+            do {
+                *op++ = *match++;
+            } while (op < end);
+        }
+    }
+
+    *destLen = (size_t)(op - dest);
+    return SZ_OK;
+}
@@ -0,0 +1,47 @@
+#ifndef __0LIB_LZ_H_
+#define __0LIB_LZ_H_
+
+/* Fast LZ77 codec, for when LZMA is too slow. Greedy matching over a hash table
+   on the encoder side, byte-aligned tokens that decode with word copies.
+
+   A block is a sequence of
+
+     uint8_t  token            literal count in the high nibble, match length - LZ_MIN_MATCH in the low one
+     [uint8_t ...]             literal count - 15 in 255-steps, when the nibble is 15
+     literals
+     uint16_t offset           1 .. LZ_MAX_DISTANCE back from the match
+     [uint8_t ...]             match length - LZ_MIN_MATCH - 15 in 255-steps, when the nibble is 15
+
+   The last sequence stops after its literals. The last LZ_LAST_LITERALS bytes are
+   always literals and no match starts in the last LZ_MF_LIMIT bytes, so the decoder
+   may copy in whole words without looking at the end of the buffer each time.
+
+   Return codes are those of lzma.h. */
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_DISTANCE 65535
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT 12
+#define LZ_MAX_INPUT_SIZE 0x7E000000
+
+/* log2 of the number of hash table entries, 4 bytes each. */
+#ifndef LZ_HASH_LOG
+#define LZ_HASH_LOG 14
+#endif
+
+typedef struct _lz_enc lz_enc_t;
+
+size_t lz_bound(size_t srcLen);
+
+/* Reusable encoder. The hash table is kept from one call to the next and is not
+   cleared in between, entries left by an earlier input are told apart by position. */
+lz_enc_t* lz_enc_create(void);
+int lz_enc_encode(lz_enc_t* p, uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen);
+void lz_enc_destroy(lz_enc_t* p);
+
+int lz_encode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen);
+
+/* *destLen is the size of dest on input and the decoded size on output. */
+int lz_decode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen);
+
+#endif // __0LIB_LZ_H_
@@ -72,7 +72,8 @@ typedef struct _CMatchFinder
     CLzRef *hash;
     CLzRef *son;
     uint32_t hashMask;
-    //  uint32_t cutValue;
+    uint32_t cutValue;
+    int btMode;
 
     uint8_t *bufferBase;
     ISeqInStream *stream;
@@ -89,12 +90,11 @@ typedef struct _CMatchFinder
     uint32_t fixedHashSize;
     uint32_t hashSizeSum;
     uint32_t numSons;
+    uint32_t numRefs;
     int result;
     uint32_t crc[256];
 } CMatchFinder;
 
-typedef void * CLzmaEncHandle;
-
 /*
 Conditions:
   Mf_GetNumAvailableBytes_Func must be called before each Mf_GetMatchLen_Func.
@@ -236,6 +236,7 @@ static void MatchFinder_FreeThisClassMemory(CMatchFinder *p)
 {
     memory_free(p->hash);
     p->hash = 0;
+    p->numRefs = 0;
 }
 
 void MatchFinder_Free(CMatchFinder *p)
@@ -293,19 +294,23 @@ int MatchFinder_Create(CMatchFinder *p, uint32_t historySize, uint32_t keepAddBu
         }
 
         {
-            uint32_t prevSize = p->hashSizeSum + p->numSons;
             uint32_t newSize;
             p->historySize = historySize;
             p->hashSizeSum = hs;
             p->cyclicBufferSize = newCyclicBufferSize;
-            p->numSons = newCyclicBufferSize * 2;
+            p->numSons = p->btMode ? newCyclicBufferSize * 2 : newCyclicBufferSize;
             newSize = p->hashSizeSum + p->numSons;
-            if (p->hash != 0 && prevSize == newSize)
+            /* a reused encoder keeps its tables while they are large enough */
+            if (p->hash != 0 && newSize <= p->numRefs)
+            {
+                p->son = p->hash + p->hashSizeSum;
                 return 1;
+            }
             MatchFinder_FreeThisClassMemory(p);
             p->hash = AllocRefs(newSize);
             if (p->hash != 0)
             {
+                p->numRefs = newSize;
                 p->son = p->hash + p->hashSizeSum;
                 return 1;
             }
@@ -354,6 +359,20 @@ void MatchFinder_Init(CMatchFinder *p)
     MatchFinder_SetLimits(p);
 }
 
+/* Starts the match finder after numPrimed bytes of preset dictionary, whose tables
+   (hash and son, as left by running over the dictionary) are copied from refs. */
+static void MatchFinder_InitPrimed(CMatchFinder *p, const CLzRef *refs, uint32_t numPrimed)
+{
+    __movsb((uint8_t *)p->hash, (const uint8_t *)refs, (size_t)(p->hashSizeSum + p->numSons) * sizeof(CLzRef));
+    p->cyclicBufferPos = numPrimed;
+    p->buffer = p->bufferBase + numPrimed;
+    p->pos = p->streamPos = p->cyclicBufferSize + numPrimed;
+    p->result = SZ_OK;
+    p->streamEndWasReached = 0;
+    MatchFinder_ReadBlock(p);
+    MatchFinder_SetLimits(p);
+}
+
 static uint32_t MatchFinder_GetSubValue(CMatchFinder *p)
 {
     return (p->pos - p->historySize - 1) & kNormalizeMask;
@@ -544,7 +563,7 @@ static void MatchFinder_MovePos(CMatchFinder *p) { MOVE_POS; }
 #define GET_MATCHES_HEADER(minLen) GET_MATCHES_HEADER2(minLen, return 0)
 #define SKIP_HEADER(minLen)        GET_MATCHES_HEADER2(minLen, continue)
 
-#define MF_PARAMS(p) p->pos, p->buffer, p->son, p->cyclicBufferPos, p->cyclicBufferSize, 1 << 30
+#define MF_PARAMS(p) p->pos, p->buffer, p->son, p->cyclicBufferPos, p->cyclicBufferSize, p->cutValue
 
 #define GET_MATCHES_FOOTER(offset, maxLen) \
     offset = (uint32_t)(GetMatchesSpec1(lenLimit, curMatch, MF_PARAMS(p), \
@@ -733,14 +752,22 @@ static void Hc4_MatchFinder_Skip(CMatchFinder *p, uint32_t num)
     while (--num != 0);
 }
 
-void MatchFinder_CreateVTable(IMatchFinder *vTable)
+void MatchFinder_CreateVTable(CMatchFinder *p, IMatchFinder *vTable)
 {
     vTable->Init = (Mf_Init_Func)MatchFinder_Init;
     vTable->GetIndexByte = (Mf_GetIndexByte_Func)MatchFinder_GetIndexByte;
     vTable->GetNumAvailableBytes = (Mf_GetNumAvailableBytes_Func)MatchFinder_GetNumAvailableBytes;
     vTable->GetPointerToCurrentPos = (Mf_GetPointerToCurrentPos_Func)MatchFinder_GetPointerToCurrentPos;
-    vTable->GetMatches = (Mf_GetMatches_Func)Bt4_MatchFinder_GetMatches;
-    vTable->Skip = (Mf_Skip_Func)Bt4_MatchFinder_Skip;
+    if (p->btMode)
+    {
+        vTable->GetMatches = (Mf_GetMatches_Func)Bt4_MatchFinder_GetMatches;
+        vTable->Skip = (Mf_Skip_Func)Bt4_MatchFinder_Skip;
+    }
+    else
+    {
+        vTable->GetMatches = (Mf_GetMatches_Func)Hc4_MatchFinder_GetMatches;
+        vTable->Skip = (Mf_Skip_Func)Hc4_MatchFinder_Skip;
+    }
 }
 
 
@@ -769,13 +796,18 @@ void MatchFinder_CreateVTable(IMatchFinder *vTable)
 
 void LzmaEncProps_Normalize(CLzmaEncProps *p)
 {
+  int level = p->level;
+  if (level < 0) level = 5;
+  if (level > 9) level = 9;
+  p->level = level;
+  if (p->dictSize == 0) p->dictSize = (level <= 5 ? (1 << (level * 2 + 14)) : (level == 6 ? (1 << 25) : (1 << 26)));
   if (p->lc < 0) p->lc = 3;
   if (p->lp < 0) p->lp = 0;
   if (p->pb < 0) p->pb = 2;
-  if (p->fb < 0) p->fb = 128;
-//   if (p->mc == 0) {
-//       p->mc = 16 + (p->fb >> 1);
-//   }
+  if (p->fb < 0) p->fb = (level < 7 ? 32 : 64);
+  if (p->btMode < 0) p->btMode = (level < 5 ? 0 : 1);
+  if (p->mc == 0) p->mc = (16 + (p->fb >> 1)) >> (p->btMode ? 0 : 1);
+  if (p->numThreads < 0) p->numThreads = (p->btMode ? 2 : 1);
 }
 
 uint32_t LzmaEncProps_GetDictSize(const CLzmaEncProps *props2)
@@ -925,13 +957,229 @@ typedef struct
   uint32_t state;
 } CSaveState;
 
+/* Pipelined match finder: a second thread runs the binary tree match finder ahead of
+   the parser and hands over its results in batches through a ring. The tree sees the
+   same sequence of positions as in the single-threaded mode, so the output is identical. */
+
+#define kMtBatchSize (1 << 14)
+#define kMtNumBatches 16
+#define kMtRecordMaxSize (1 + LZMA_MATCH_LEN_MAX * 2 + 2)
+#define kMtMinInputSize (1 << 18)
+
+typedef struct _CMatchFinderMt
+{
+    CMatchFinder *mf;
+
+    /* consumer side */
+    const uint8_t *pointerToCurPos;
+    size_t numAvail;
+    const uint32_t *cur;
+    const uint32_t *curLimit;
+    uint32_t consumerBatch;
+
+    /* producer side */
+    size_t numPositions;
+    uint32_t *batches;
+    async_sem_t freeSem;
+    async_sem_t filledSem;
+    async_thread_t thread;
+    int threadCreated;
+    volatile long stop;
+} CMatchFinderMt;
+
+static void MatchFinderMt_Thread(void *arg)
+{
+    CMatchFinderMt *p = (CMatchFinderMt *)arg;
+    size_t left = p->numPositions;
+    uint32_t producerBatch = 0;
+
+    while (left != 0 && p->stop == 0)
+    {
+        uint32_t *batch;
+        uint32_t used = 1;
+
+        async_sem_wait(&p->freeSem);
+        if (p->stop != 0)
+            break;
+
+        /* each record is the GetMatches() count followed by the pairs */
+        batch = p->batches + (size_t)(producerBatch++ & (kMtNumBatches - 1)) * kMtBatchSize;
+        while (left != 0 && used + kMtRecordMaxSize <= kMtBatchSize)
+        {
+            uint32_t num = Bt4_MatchFinder_GetMatches(p->mf, batch + used + 1);
+            batch[used] = num;
+            used += num + 1;
+            left--;
+        }
+        batch[0] = used;
+        async_sem_post(&p->filledSem);
+    }
+}
+
+static void MatchFinderMt_Construct(CMatchFinderMt *p)
+{
+    p->batches = 0;
+    p->threadCreated = 0;
+}
+
+static void MatchFinderMt_StopThread(CMatchFinderMt *p)
+{
+    if (p->threadCreated)
+    {
+        p->stop = 1;
+        async_sem_post(&p->freeSem);
+        async_thread_join(&p->thread);
+        async_sem_destroy(&p->freeSem);
+        async_sem_destroy(&p->filledSem);
+        p->threadCreated = 0;
+    }
+}
+
+static void MatchFinderMt_Destruct(CMatchFinderMt *p)
+{
+    MatchFinderMt_StopThread(p);
+    memory_free(p->batches);
+    p->batches = 0;
+}
+
+static int MatchFinderMt_Create(CMatchFinderMt *p, CMatchFinder *mf)
+{
+    p->mf = mf;
+    if (p->batches == 0)
+    {
+        p->batches = (uint32_t *)memory_alloc((size_t)kMtNumBatches * kMtBatchSize * sizeof(uint32_t));
+        if (p->batches == 0)
+            return 0;
+    }
+    return 1;
+}
+
+static int MatchFinderMt_StartThread(CMatchFinderMt *p)
+{
+    if (async_sem_init(&p->freeSem, kMtNumBatches) != 0)
+        return 0;
+    if (async_sem_init(&p->filledSem, 0) != 0)
+    {
+        async_sem_destroy(&p->freeSem);
+        return 0;
+    }
+    p->stop = 0;
+    if (async_thread_create(&p->thread, MatchFinderMt_Thread, p) != 0)
+    {
+        async_sem_destroy(&p->freeSem);
+        async_sem_destroy(&p->filledSem);
+        return 0;
+    }
+    p->threadCreated = 1;
+    return 1;
+}
+
+static void MatchFinderMt_Init(CMatchFinderMt *p)
+{
+    CMatchFinder *mf = p->mf;
+
+    MatchFinderMt_StopThread(p);
+    MatchFinder_Init(mf);
+    p->pointerToCurPos = mf->buffer;
+    p->numAvail = (mf->streamPos - mf->pos) + mf->directInputRem;
+    p->numPositions = p->numAvail;
+    p->cur = p->curLimit = 0;
+    p->consumerBatch = 0;
+
+    /* without a thread the match finder simply runs inline */
+    if (p->numPositions != 0)
+        MatchFinderMt_StartThread(p);
+}
+
+static const uint32_t *MatchFinderMt_NextRecord(CMatchFinderMt *p)
+{
+    const uint32_t *record;
+    const uint32_t *batch;
+
+    if (p->cur == p->curLimit)
+    {
+        if (p->curLimit != 0)
+            async_sem_post(&p->freeSem);
+        async_sem_wait(&p->filledSem);
+        batch = p->batches + (size_t)(p->consumerBatch++ & (kMtNumBatches - 1)) * kMtBatchSize;
+        p->cur = batch + 1;
+        p->curLimit = batch + batch[0];
+    }
+    record = p->cur;
+    p->cur += record[0] + 1;
+    return record;
+}
+
+static uint8_t MatchFinderMt_GetIndexByte(CMatchFinderMt *p, int32_t index)
+{
+    return p->pointerToCurPos[index];
+}
+
+static uint32_t MatchFinderMt_GetNumAvailableBytes(CMatchFinderMt *p)
+{
+    return (p->numAvail > (uint32_t)0xFFFFFFFF) ? (uint32_t)0xFFFFFFFF : (uint32_t)p->numAvail;
+}
+
+static const uint8_t *MatchFinderMt_GetPointerToCurrentPos(CMatchFinderMt *p)
+{
+    return p->pointerToCurPos;
+}
+
+static uint32_t MatchFinderMt_GetMatches(CMatchFinderMt *p, uint32_t *distances)
+{
+    const uint32_t *src;
+    uint32_t num, i;
+
+    if (p->numAvail == 0)
+        return 0;
+    if (p->threadCreated)
+    {
+        src = MatchFinderMt_NextRecord(p);
+        num = src[0];
+        for (i = 0; i < num; i++)
+            distances[i] = src[i + 1];
+    }
+    else
+        num = Bt4_MatchFinder_GetMatches(p->mf, distances);
+    p->pointerToCurPos++;
+    p->numAvail--;
+    return num;
+}
+
+static void MatchFinderMt_Skip(CMatchFinderMt *p, uint32_t num)
+{
+    do
+    {
+        if (p->numAvail == 0)
+            break;
+        if (p->threadCreated)
+            MatchFinderMt_NextRecord(p);
+        else
+            Bt4_MatchFinder_Skip(p->mf, 1);
+        p->pointerToCurPos++;
+        p->numAvail--;
+    }
+    while (--num != 0);
+}
+
+static void MatchFinderMt_CreateVTable(IMatchFinder *vTable)
+{
+    vTable->Init = (Mf_Init_Func)MatchFinderMt_Init;
+    vTable->GetIndexByte = (Mf_GetIndexByte_Func)MatchFinderMt_GetIndexByte;
+    vTable->GetNumAvailableBytes = (Mf_GetNumAvailableBytes_Func)MatchFinderMt_GetNumAvailableBytes;
+    vTable->GetPointerToCurrentPos = (Mf_GetPointerToCurrentPos_Func)MatchFinderMt_GetPointerToCurrentPos;
+    vTable->GetMatches = (Mf_GetMatches_Func)MatchFinderMt_GetMatches;
+    vTable->Skip = (Mf_Skip_Func)MatchFinderMt_Skip;
+}
+
 typedef struct
 {
   IMatchFinder matchFinder;
   void *matchFinderObj;
 
-//  bool_t mtMode;
-//  CMatchFinderMt matchFinderMt;
+  bool_t multiThread;
+  bool_t mtMode;
+  CMatchFinderMt matchFinderMt;
 
   CMatchFinder matchFinderBase;
 
@@ -989,14 +1237,20 @@ typedef struct
   uint64_t nowPos64;
   uint32_t matchPriceCount;
   bool_t finished;
+  bool_t writeEndMark;
 
   int result;
   uint32_t dictSize;
+  uint32_t dictSizeProps;
 //  uint32_t matchFinderCycles;
 
   int needInit;
 
   CSaveState saveState;
+
+  /* preset dictionary followed by the message, the input of lzma_enc_encode_dict() */
+  uint8_t *primeBuf;
+  size_t primeBufSize;
 } CLzmaEnc;
 
 
@@ -1010,7 +1264,6 @@ int LzmaEnc_SetProps(CLzmaEncHandle pp, const CLzmaEncProps *props2)
       props.dictSize > ((uint32_t)1 << kDicLogSizeMaxCompress) || props.dictSize > ((uint32_t)1 << 30))
     return SZ_ERROR_PARAM;
   p->dictSize = props.dictSize;
-//  p->matchFinderCycles = props.mc;
   {
     unsigned fb = props.fb;
     if (fb < 5)
@@ -1022,8 +1275,10 @@ int LzmaEnc_SetProps(CLzmaEncHandle pp, const CLzmaEncProps *props2)
   p->lc = props.lc;
   p->lp = props.lp;
   p->pb = props.pb;
-  
-//  p->matchFinderBase.cutValue = props.mc;
+  p->matchFinderBase.btMode = props.btMode;
+  p->matchFinderBase.cutValue = props.mc;
+  /* the pipelined match finder runs the binary tree */
+  p->multiThread = (props.numThreads > 1 && props.btMode);
 
   return SZ_OK;
 }
@@ -2049,7 +2304,8 @@ static int Flush(CLzmaEnc *p, uint32_t nowPos)
 {
   /* ReleaseMFStream(); */
   p->finished = TRUE;
-  WriteEndMarker(p, nowPos & p->pbMask);
+  if (p->writeEndMark)
+    WriteEndMarker(p, nowPos & p->pbMask);
   RangeEnc_FlushData(&p->rc);
   RangeEnc_FlushStream(&p->rc);
   return CheckErrors(p);
@@ -2105,6 +2361,43 @@ void LzmaEnc_FreeLits(CLzmaEnc *p)
   p->saveState.litProbs = 0;
 }
 
+/* Copies the adaptive model of the encoder; dest->litProbs must hold (0x300 << lclp) entries */
+static void LzmaEnc_SaveState(const CLzmaEnc *p, CSaveState *dest)
+{
+  dest->lenEnc = p->lenEnc;
+  dest->repLenEnc = p->repLenEnc;
+  dest->state = p->state;
+  __movsb((uint8_t *)dest->isMatch, (const uint8_t *)p->isMatch, sizeof(p->isMatch));
+  __movsb((uint8_t *)dest->isRep, (const uint8_t *)p->isRep, sizeof(p->isRep));
+  __movsb((uint8_t *)dest->isRepG0, (const uint8_t *)p->isRepG0, sizeof(p->isRepG0));
+  __movsb((uint8_t *)dest->isRepG1, (const uint8_t *)p->isRepG1, sizeof(p->isRepG1));
+  __movsb((uint8_t *)dest->isRepG2, (const uint8_t *)p->isRepG2, sizeof(p->isRepG2));
+  __movsb((uint8_t *)dest->isRep0Long, (const uint8_t *)p->isRep0Long, sizeof(p->isRep0Long));
+  __movsb((uint8_t *)dest->posSlotEncoder, (const uint8_t *)p->posSlotEncoder, sizeof(p->posSlotEncoder));
+  __movsb((uint8_t *)dest->posEncoders, (const uint8_t *)p->posEncoders, sizeof(p->posEncoders));
+  __movsb((uint8_t *)dest->posAlignEncoder, (const uint8_t *)p->posAlignEncoder, sizeof(p->posAlignEncoder));
+  __movsb((uint8_t *)dest->reps, (const uint8_t *)p->reps, sizeof(p->reps));
+  __movsb((uint8_t *)dest->litProbs, (const uint8_t *)p->litProbs, ((size_t)0x300 << p->lclp) * sizeof(uint32_t));
+}
+
+static void LzmaEnc_RestoreState(CLzmaEnc *p, const CSaveState *src)
+{
+  p->lenEnc = src->lenEnc;
+  p->repLenEnc = src->repLenEnc;
+  p->state = src->state;
+  __movsb((uint8_t *)p->isMatch, (const uint8_t *)src->isMatch, sizeof(p->isMatch));
+  __movsb((uint8_t *)p->isRep, (const uint8_t *)src->isRep, sizeof(p->isRep));
+  __movsb((uint8_t *)p->isRepG0, (const uint8_t *)src->isRepG0, sizeof(p->isRepG0));
+  __movsb((uint8_t *)p->isRepG1, (const uint8_t *)src->isRepG1, sizeof(p->isRepG1));
+  __movsb((uint8_t *)p->isRepG2, (const uint8_t *)src->isRepG2, sizeof(p->isRepG2));
+  __movsb((uint8_t *)p->isRep0Long, (const uint8_t *)src->isRep0Long, sizeof(p->isRep0Long));
+  __movsb((uint8_t *)p->posSlotEncoder, (const uint8_t *)src->posSlotEncoder, sizeof(p->posSlotEncoder));
+  __movsb((uint8_t *)p->posEncoders, (const uint8_t *)src->posEncoders, sizeof(p->posEncoders));
+  __movsb((uint8_t *)p->posAlignEncoder, (const uint8_t *)src->posAlignEncoder, sizeof(p->posAlignEncoder));
+  __movsb((uint8_t *)p->reps, (const uint8_t *)src->reps, sizeof(p->reps));
+  __movsb((uint8_t *)p->litProbs, (const uint8_t *)src->litProbs, ((size_t)0x300 << p->lclp) * sizeof(uint32_t));
+}
+
 static int LzmaEnc_CodeOneBlock(CLzmaEnc *p, bool_t useLimits, uint32_t maxPackSize, uint32_t maxUnpackSize)
 {
   uint32_t nowPos32, startPos32;
@@ -2291,7 +2584,17 @@ static int LzmaEnc_Alloc(CLzmaEnc *p, uint32_t keepWindowSize)
     if (!MatchFinder_Create(&p->matchFinderBase, p->dictSize, beforeSize, p->numFastBytes, LZMA_MATCH_LEN_MAX))
       return SZ_ERROR_MEM;
     p->matchFinderObj = &p->matchFinderBase;
-    MatchFinder_CreateVTable(&p->matchFinder);
+    MatchFinder_CreateVTable(&p->matchFinderBase, &p->matchFinder);
+
+  /* the pipelined match finder reads straight from the input, small inputs do not pay for a thread */
+  p->mtMode = (p->multiThread && p->matchFinderBase.directInput && p->matchFinderBase.directInputRem >= kMtMinInputSize);
+  if (p->mtMode)
+  {
+    if (!MatchFinderMt_Create(&p->matchFinderMt, &p->matchFinderBase))
+      return SZ_ERROR_MEM;
+    p->matchFinderObj = &p->matchFinderMt;
+    MatchFinderMt_CreateVTable(&p->matchFinder);
+  }
   return SZ_OK;
 }
 
@@ -2482,24 +2785,31 @@ int LzmaEnc_MemEncode(CLzmaEncHandle pp, uint8_t *dest, size_t *destLen, const u
 
 void lzma_encprops_init(CLzmaEncProps *p)
 {
-    //  p->mc = 0;
-    p->lc = p->lp = p->pb = p->fb = -1;
+    p->level = 5;
+    p->dictSize = p->mc = 0;
+    p->lc = p->lp = p->pb = p->fb = p->btMode = -1;
+    p->numThreads = -1;
 }
 
 
-int lzma_encode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, const CLzmaEncProps* props, uint8_t* propsEncoded, size_t* propsSize)
+CLzmaEncHandle lzma_enc_create(void)
 {
-    int res;
     CLzmaEnc *p = (CLzmaEnc*)memory_alloc(sizeof(CLzmaEnc));
+    uint32_t i;
+
+    if (p == NULL) {
+        return NULL;
+    }
 
     p->rc.outStream = 0;
     p->rc.bufBase = 0;
 
-    uint32_t i;
     p->matchFinderBase.bufferBase = 0;
     p->matchFinderBase.directInput = 0;
     p->matchFinderBase.hash = 0;
     p->matchFinderBase.bigHash = 0;
+    p->mtMode = FALSE;
+    MatchFinderMt_Construct(&p->matchFinderMt);
 
     for (i = 0; i < 256; i++) {
         uint32_t r = i;
@@ -2513,7 +2823,7 @@ int lzma_encode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLe
     {
         CLzmaEncProps props;
         lzma_encprops_init(&props);
-        LzmaEnc_SetProps(p, &props);
+        lzma_enc_set_props(p, &props);
     }
 
     LzmaEnc_FastPosInit(p->g_FastPos);
@@ -2538,42 +2848,102 @@ int lzma_encode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLe
     
     p->litProbs = 0;
     p->saveState.litProbs = 0;
-    
-    res = LzmaEnc_SetProps(p, props);
-    if (res == SZ_OK) {
-        uint32_t dictSize = p->dictSize;
-        if (*propsSize < LZMA_PROPS_SIZE) {
-            res = SZ_ERROR_PARAM;
-        }
-        else {
-            *propsSize = LZMA_PROPS_SIZE;
-            propsEncoded[0] = (uint8_t)((p->pb * 5 + p->lp) * 9 + p->lc);
+    p->writeEndMark = TRUE;
+    return p;
+}
 
-            for (i = 11; i <= 30; ++i) {
-                if (dictSize <= ((uint32_t)2 << i)) {
-                    dictSize = (2 << i);
-                    break;
-                }
-                if (dictSize <= ((uint32_t)3 << i)) {
-                    dictSize = (3 << i);
-                    break;
-                }
-            }
+int lzma_enc_set_props(CLzmaEncHandle pp, const CLzmaEncProps* props)
+{
+    CLzmaEnc *p = (CLzmaEnc*)pp;
+    RINOK(LzmaEnc_SetProps(p, props));
+    p->dictSizeProps = p->dictSize;
+    return SZ_OK;
+}
+
+int lzma_enc_encode(CLzmaEncHandle pp, uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, uint8_t* propsEncoded, size_t* propsSize)
+{
+    CLzmaEnc *p = (CLzmaEnc*)pp;
+    uint32_t dictSize = p->dictSizeProps;
+    uint32_t srcLenRounded = dictSize;
+    uint32_t i;
+    int res;
 
-            for (i = 0; i < 4; ++i) {
-                propsEncoded[1 + i] = (uint8_t)(dictSize >> (8 * i));
+    if (*propsSize < LZMA_PROPS_SIZE) {
+        return SZ_ERROR_PARAM;
+    }
+
+    // A window larger than the input is never filled. The smallest size the header can
+    // hold that covers the input is enough, and keeps the tables of a small message small.
+    if (srcLen < dictSize) {
+        for (i = 11; i <= 30; ++i) {
+            if (srcLen <= ((size_t)2 << i)) {
+                srcLenRounded = ((uint32_t)2 << i);
+                break;
+            }
+            if (srcLen <= ((size_t)3 << i)) {
+                srcLenRounded = ((uint32_t)3 << i);
+                break;
             }
-            res = SZ_OK;
         }
-        if (res == SZ_OK) {
-            res = LzmaEnc_MemEncode(p, dest, destLen, src, srcLen);
+        if (srcLenRounded < dictSize) {
+            dictSize = srcLenRounded;
+        }
+    }
+    p->dictSize = dictSize;
+
+    *propsSize = LZMA_PROPS_SIZE;
+    propsEncoded[0] = (uint8_t)((p->pb * 5 + p->lp) * 9 + p->lc);
+    for (i = 11; i <= 30; ++i) {
+        if (dictSize <= ((uint32_t)2 << i)) {
+            dictSize = (2 << i);
+            break;
+        }
+        if (dictSize <= ((uint32_t)3 << i)) {
+            dictSize = (3 << i);
+            break;
         }
     }
+    for (i = 0; i < 4; ++i) {
+        propsEncoded[1 + i] = (uint8_t)(dictSize >> (8 * i));
+    }
+
+    res = LzmaEnc_MemEncode(p, dest, destLen, src, srcLen);
+
+    // Nothing of the input may be touched once the call returns.
+    MatchFinderMt_StopThread(&p->matchFinderMt);
+    p->matchFinderBase.directInput = 0;
+    p->matchFinderBase.bufferBase = 0;
+    return res;
+}
+
+void lzma_enc_destroy(CLzmaEncHandle pp)
+{
+    CLzmaEnc *p = (CLzmaEnc*)pp;
 
+    if (p == NULL) {
+        return;
+    }
+    MatchFinderMt_Destruct(&p->matchFinderMt);
     MatchFinder_Free(&p->matchFinderBase);
     LzmaEnc_FreeLits(p);
     RangeEnc_Free(&p->rc);
+    memory_free(p->primeBuf);
     memory_free(p);
+}
+
+int lzma_encode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, const CLzmaEncProps* props, uint8_t* propsEncoded, size_t* propsSize)
+{
+    CLzmaEncHandle p = lzma_enc_create();
+    int res;
+
+    if (p == NULL) {
+        return SZ_ERROR_MEM;
+    }
+    res = lzma_enc_set_props(p, props);
+    if (res == SZ_OK) {
+        res = lzma_enc_encode(p, dest, destLen, src, srcLen, propsEncoded, propsSize);
+    }
+    lzma_enc_destroy(p);
     return res;
 }
 
@@ -2604,6 +2974,28 @@ int lzma_encode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLe
 
 #define TREE_6_DECODE(probs, i) TREE_DECODE(probs, (1 << 6), i)
 
+/* Bits of literals and tree symbols are close to random, a mispredicted branch per
+   bit costs more than computing both outcomes. mask is all ones for a 1 bit. */
+#define GET_BIT_MASK(p, i) ttt = *(p); NORMALIZE; bound = (range >> kNumBitModelTotalBits) * ttt; \
+mask = 0 - (uint32_t)(code >= bound); \
+range = (bound & ~mask) | ((range - bound) & mask); code -= bound & mask; \
+*(p) = (uint32_t)(ttt + (((kBitModelTotal - ttt) >> kNumMoveBits) & ~mask) - ((ttt >> kNumMoveBits) & mask)); \
+i = (i + i) + (mask & 1);
+#define TREE_GET_BIT_MASK(probs, i) { GET_BIT_MASK((probs + i), i); }
+#define TREE_DECODE_3_MASK(probs, i) \
+{ i = 1; TREE_GET_BIT_MASK(probs, i); TREE_GET_BIT_MASK(probs, i); TREE_GET_BIT_MASK(probs, i); i -= 8; }
+#define TREE_DECODE_8_MASK(probs, i) \
+{ i = 1; TREE_GET_BIT_MASK(probs, i); TREE_GET_BIT_MASK(probs, i); TREE_GET_BIT_MASK(probs, i); TREE_GET_BIT_MASK(probs, i); \
+  TREE_GET_BIT_MASK(probs, i); TREE_GET_BIT_MASK(probs, i); TREE_GET_BIT_MASK(probs, i); TREE_GET_BIT_MASK(probs, i); i -= 256; }
+#define TREE_6_DECODE_MASK(probs, i) \
+{ i = 1; TREE_GET_BIT_MASK(probs, i); TREE_GET_BIT_MASK(probs, i); TREE_GET_BIT_MASK(probs, i); \
+  TREE_GET_BIT_MASK(probs, i); TREE_GET_BIT_MASK(probs, i); TREE_GET_BIT_MASK(probs, i); i -= 64; }
+#define MATCHED_LIT_BIT_MASK(probs, i) \
+{ uint32_t* probLit; matchByte <<= 1; bit = (matchByte & offs); probLit = probs + offs + bit + i; \
+  GET_BIT_MASK(probLit, i); offs &= bit ^ ~mask; }
+
+#define LZMA_COPY8(dest, src) (*(uint64_t*)(dest) = *(const uint64_t*)(src))
+
 #define UPDATE_0_CHECK range = bound;
 #define UPDATE_1_CHECK range -= bound; code -= bound;
 
@@ -2616,6 +3008,8 @@ int lzma_encode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLe
 #define kLenNumHighBits 8
 #define kLenNumHighSymbols (1 << kLenNumHighBits)
 
+#define LenChoice 0
+#define LenChoice2 (LenChoice + 1)
 #define LenLow 2
 #define LenMid (LenLow + (kNumPosStatesMax << 3))
 #define LenHigh (LenMid + (kNumPosStatesMax << 3))
@@ -2658,133 +3052,87 @@ int lzma_encode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLe
 StopCompilingDueBUG
 #endif
 
-#pragma intrinsic(_byteswap_ulong)
-
-int lzma_decode(uint8_t* outBuffer, uint32_t* pOutSize, const uint8_t* inBuffer, uint32_t inSize, ELzmaStatus* status)
-{
-    const uint8_t* realSrc = inBuffer + 5;
-    int res = SZ_OK;
-    uint32_t outSize = *pOutSize;
-    uint32_t lc, lp, pb;
-    uint8_t d = *inBuffer;
-    uint32_t* probs;
-    const uint8_t* buf;
-    uint32_t range = 0xFFFFFFFF, code;
-    uint32_t dicPos = 0;
-    uint32_t processedPos = 0;
-    uint32_t checkDicSize = 0;
-    uint32_t state = 0;
-    uint32_t rep0 = 1, rep1 = 1, rep2 = 1, rep3 = 1;
-    uint32_t remainLen = 0;
-    uint32_t dicSize;
-
-    *pOutSize = 0;
-    if (inSize < 10) {
-        return SZ_ERROR_INPUT_EOF;
-    }
-    inSize -= 10;
-
-    dicSize = *(uint32_t*)(inBuffer + 1);
-    lc = d % 9;
-    d /= 9;
-    pb = d / 5;
-    lp = d % 5;
+#define NORMALIZE_CHECK if (range < kTopValue) { if (buf >= bufLimit) return DUMMY_ERROR; range <<= 8; code = (code << 8) | (*buf++); }
 
-    probs = (uint32_t*)memory_alloc(((uint32_t)LZMA_BASE_SIZE + (LZMA_LIT_SIZE << (lc + lp))) << 2);
+#define IF_BIT_0_CHECK(p) ttt = *(p); NORMALIZE_CHECK; bound = (range >> kNumBitModelTotalBits) * ttt; if (code < bound)
+#define GET_BIT2_CHECK(p, i, A0, A1) IF_BIT_0_CHECK(p) \
+{ UPDATE_0_CHECK; i = (i + i); A0; } else \
+{ UPDATE_1_CHECK; i = (i + i) + 1; A1; }
+#define GET_BIT_CHECK(p, i) GET_BIT2_CHECK(p, i, ; , ;)
+#define TREE_DECODE_CHECK(probs, limit, i) \
+{ i = 1; do { GET_BIT_CHECK(probs + i, i) } while (i < limit); i -= limit; }
 
-    *status = LZMA_STATUS_NOT_SPECIFIED;
+#define LZMA_DIC_MIN (1 << 12)
 
-    if (realSrc[0] != 0) {
-        res = SZ_ERROR_DATA;
-        goto end;
-    }
-    code = _byteswap_ulong(*(uint32_t*)(realSrc + 1));
+#pragma intrinsic(_byteswap_ulong)
 
-    realSrc += RC_INIT_SIZE;
+/* First pass of the decoder: decodes symbols while at least LZMA_REQUIRED_INPUT_MAX
+   bytes of input are left before bufLimit. A match that does not fit below limit
+   is left in remainLen and finished by LzmaDec_WriteRem. lc, lpMask and pbMask come
+   as arguments so that a call with constants gets a loop of its own. */
+static __forceinline int LzmaDec_DecodeRealT(CLzmaDec* p, size_t limit, const uint8_t* bufLimit, uint32_t lc, uint32_t lpMask, uint32_t pbMask)
+{
+    uint32_t* probs = p->probs;
+    uint32_t state = p->state;
+    uint32_t rep0 = p->reps[0], rep1 = p->reps[1], rep2 = p->reps[2], rep3 = p->reps[3];
+    uint8_t* dic = p->dic;
+    size_t dicBufSize = p->dicBufSize;
+    size_t dicPos = p->dicPos;
+    uint32_t processedPos = p->processedPos;
+    uint32_t checkDicSize = p->checkDicSize;
+    uint32_t len = 0;
+    const uint8_t* buf = p->buf;
+    uint32_t range = p->range;
+    uint32_t code = p->code;
 
-    __stosd((unsigned long*)probs, kBitModelTotal >> 1, Literal + ((uint32_t)LZMA_LIT_SIZE << (lc + lp)));
+    do {
+        uint32_t* prob;
+        uint32_t bound;
+        uint32_t ttt;
+        uint32_t posState = processedPos & pbMask;
+
+        prob = probs + IsMatch + (state << kNumPosBitsMax) + posState;
+        IF_BIT_0(prob) {
+            uint32_t symbol;
+            UPDATE_0(prob);
+            prob = probs + Literal;
+            if (checkDicSize != 0 || processedPos != 0) {
+                prob += (LZMA_LIT_SIZE * (((processedPos & lpMask) << lc) + (dic[(dicPos == 0 ? dicBufSize : dicPos) - 1] >> (8 - lc))));
+            }
 
-    while (remainLen != kMatchSpecLenStart) {
-        if (dicPos >= outSize) {
-            if (remainLen == 0 && code == 0) {
-                *status = LZMA_STATUS_MAYBE_FINISHED_WITHOUT_MARK;
+            if (state < kNumLitStates) {
+                uint32_t mask;
+                state -= (state < 4) ? state : 3;
+                TREE_DECODE_8_MASK(prob, symbol);
             }
             else {
-                *status = LZMA_STATUS_NOT_FINISHED;
-            }            
-            res = SZ_OK;
-            goto end;
+                uint32_t matchByte = dic[(dicPos - rep0) + ((dicPos < rep0) ? dicBufSize : 0)];
+                uint32_t offs = 0x100;
+                uint32_t bit, mask;
+                state -= (state < 10) ? 3 : 6;
+                symbol = 1;
+                MATCHED_LIT_BIT_MASK(prob, symbol);
+                MATCHED_LIT_BIT_MASK(prob, symbol);
+                MATCHED_LIT_BIT_MASK(prob, symbol);
+                MATCHED_LIT_BIT_MASK(prob, symbol);
+                MATCHED_LIT_BIT_MASK(prob, symbol);
+                MATCHED_LIT_BIT_MASK(prob, symbol);
+                MATCHED_LIT_BIT_MASK(prob, symbol);
+                MATCHED_LIT_BIT_MASK(prob, symbol);
+                symbol -= 0x100;
+            }
+            dic[dicPos++] = (uint8_t)symbol;
+            processedPos++;
+            continue;
         }
-
-        {
-            size_t processed;
-            const uint8_t* bufLimit = realSrc;
-
-            if (inSize >= LZMA_REQUIRED_INPUT_MAX) {
-                bufLimit += inSize - LZMA_REQUIRED_INPUT_MAX;
+        else {
+            UPDATE_1(prob);
+            prob = probs + IsRep + state;
+            IF_BIT_0(prob) {
+                UPDATE_0(prob);
+                state += kNumStates;
+                prob = probs + LenCoder;
             }
-            buf = realSrc;
-            do {
-                size_t limit2 = outSize;
-                if (checkDicSize == 0) {
-                    uint32_t rem = dicSize - processedPos;
-                    if (outSize - dicPos > rem) {
-                        limit2 = dicPos + rem;
-                    }
-                }
-                {
-                    uint32_t pbMask = ((uint32_t)1 << pb) - 1;
-                    uint32_t lpMask = ((uint32_t)1 << lp) - 1;
-                    uint32_t len = 0;
-
-                    do {
-                        uint32_t* prob;
-                        uint32_t bound;
-                        uint32_t ttt;
-                        uint32_t posState = processedPos & pbMask;
-
-                        prob = probs + IsMatch + (state << kNumPosBitsMax) + posState;
-                        IF_BIT_0(prob) {
-                            uint32_t symbol;
-                            UPDATE_0(prob);
-                            prob = probs + Literal;
-                            if (checkDicSize != 0 || processedPos != 0) {
-                                prob += (LZMA_LIT_SIZE * (((processedPos & lpMask) << lc) + (outBuffer[(dicPos == 0 ? outSize : dicPos) - 1] >> (8 - lc))));
-                            }
-
-                            if (state < kNumLitStates) {
-                                state -= (state < 4) ? state : 3;
-                                symbol = 1;
-                                do {
-                                    GET_BIT(prob + symbol, symbol)
-                                } while (symbol < 0x100);
-                            }
-                            else {
-                                uint32_t matchByte = outBuffer[(dicPos - rep0) + ((dicPos < rep0) ? outSize : 0)];
-                                uint32_t offs = 0x100;
-                                state -= (state < 10) ? 3 : 6;
-                                symbol = 1;
-                                do {
-                                    uint32_t bit;
-                                    uint32_t* probLit;
-                                    matchByte <<= 1;
-                                    bit = (matchByte & offs);
-                                    probLit = prob + offs + bit + symbol;
-                                    GET_BIT2(probLit, symbol, offs &= ~bit, offs &= bit)
-                                } while (symbol < 0x100);
-                            }
-                            outBuffer[dicPos++] = (uint8_t)symbol;
-                            processedPos++;
-                            continue;
-                        }
-                else {
-                    UPDATE_1(prob);
-                    prob = probs + IsRep + state;
-                    IF_BIT_0(prob) {
-                        UPDATE_0(prob);
-                        state += kNumStates;
-                        prob = probs + LenCoder;
-                    }
             else {
                 UPDATE_1(prob);
                 if (checkDicSize == 0 && processedPos == 0) {
@@ -2796,7 +3144,7 @@ int lzma_decode(uint8_t* outBuffer, uint32_t* pOutSize, const uint8_t* inBuffer,
                     prob = probs + IsRep0Long + (state << kNumPosBitsMax) + posState;
                     IF_BIT_0(prob) {
                         UPDATE_0(prob);
-                        outBuffer[dicPos] = outBuffer[(dicPos - rep0) + ((dicPos < rep0) ? outSize : 0)];
+                        dic[dicPos] = dic[(dicPos - rep0) + ((dicPos < rep0) ? dicBufSize : 0)];
                         ++dicPos;
                         ++processedPos;
                         state = state < kNumLitStates ? 9 : 11;
@@ -2812,57 +3160,56 @@ int lzma_decode(uint8_t* outBuffer, uint32_t* pOutSize, const uint8_t* inBuffer,
                         UPDATE_0(prob);
                         distance = rep1;
                     }
-        else {
-            UPDATE_1(prob);
-            prob = probs + IsRepG2 + state;
-            IF_BIT_0(prob) {
-                UPDATE_0(prob);
-                distance = rep2;
-            }
-    else {
-        UPDATE_1(prob);
-        distance = rep3;
-        rep3 = rep2;
-    }
-    rep2 = rep1;
-        }
-        rep1 = rep0;
-        rep0 = distance;
+                    else {
+                        UPDATE_1(prob);
+                        prob = probs + IsRepG2 + state;
+                        IF_BIT_0(prob) {
+                            UPDATE_0(prob);
+                            distance = rep2;
+                        }
+                        else {
+                            UPDATE_1(prob);
+                            distance = rep3;
+                            rep3 = rep2;
+                        }
+                        rep2 = rep1;
+                    }
+                    rep1 = rep0;
+                    rep0 = distance;
                 }
                 state = state < kNumLitStates ? 8 : 11;
                 prob = probs + RepLenCoder;
             }
             {
-                uint32_t limit = 8, offset;
-                uint32_t* probLen = prob;
+                uint32_t* probLen = prob + LenChoice;
+                uint32_t mask;
                 IF_BIT_0(probLen) {
                     UPDATE_0(probLen);
-                    probLen += LenLow + (posState << 3);
-                    offset = 0;
+                    probLen = prob + LenLow + (posState << kLenNumLowBits);
+                    TREE_DECODE_3_MASK(probLen, len);
+                }
+                else {
+                    UPDATE_1(probLen);
+                    probLen = prob + LenChoice2;
+                    IF_BIT_0(probLen) {
+                        UPDATE_0(probLen);
+                        probLen = prob + LenMid + (posState << kLenNumMidBits);
+                        TREE_DECODE_3_MASK(probLen, len);
+                        len += kLenNumLowSymbols;
+                    }
+                    else {
+                        UPDATE_1(probLen);
+                        probLen = prob + LenHigh;
+                        TREE_DECODE_8_MASK(probLen, len);
+                        len += kLenNumLowSymbols + kLenNumMidSymbols;
+                    }
                 }
-        else {
-            UPDATE_1(probLen);
-            probLen += 1;
-            offset = kLenNumLowSymbols;
-            IF_BIT_0(probLen) {
-                UPDATE_0(probLen);
-                probLen = prob + LenMid + (posState << 3);
-            }
-    else {
-        UPDATE_1(probLen);
-        probLen = prob + LenHigh;
-        offset += kLenNumMidSymbols;
-        limit = (1 << kLenNumHighBits);
-    }
-        }
-        TREE_DECODE(probLen, limit, len);
-        len += offset;
             }
 
             if (state >= kNumStates) {
-                uint32_t distance;
+                uint32_t distance, mask;
                 prob = probs + PosSlot + ((len < kNumLenToPosStates ? len : kNumLenToPosStates - 1) << kNumPosSlotBits);
-                TREE_6_DECODE(prob, distance);
+                TREE_6_DECODE_MASK(prob, distance);
                 if (distance >= kStartPosModelIndex) {
                     uint32_t posSlot = distance;
                     int numDirectBits = (int)(((distance >> 1) - 1));
@@ -2883,7 +3230,7 @@ int lzma_decode(uint8_t* outBuffer, uint32_t* pOutSize, const uint8_t* inBuffer,
                         numDirectBits -= kNumAlignBits;
                         do {
                             NORMALIZE
-                                range >>= 1;                                          
+                            range >>= 1;
                             {
                                 uint32_t t;
                                 code -= range;
@@ -2914,118 +3261,1528 @@ int lzma_decode(uint8_t* outBuffer, uint32_t* pOutSize, const uint8_t* inBuffer,
                 rep0 = distance + 1;
                 if (checkDicSize == 0) {
                     if (distance >= processedPos) {
-                        res = SZ_ERROR_DATA;
-                        goto end;
+                        return SZ_ERROR_DATA;
                     }
                 }
                 else if (distance >= checkDicSize) {
-                    res = SZ_ERROR_DATA;
-                    goto end;
+                    return SZ_ERROR_DATA;
                 }
                 state = (state < kNumStates + kNumLitStates) ? kNumLitStates : kNumLitStates + 3;
             }
+
             len += kMatchMinLen;
 
-            if (outSize == dicPos) {
+            if (limit == dicPos) {
                 return SZ_ERROR_DATA;
             }
             {
-                size_t rem = outSize - dicPos;
+                size_t rem = limit - dicPos;
                 uint32_t curLen = ((rem < len) ? (uint32_t)rem : len);
-                size_t pos = (dicPos - rep0) + ((dicPos < rep0) ? outSize : 0);
+                size_t pos = (dicPos - rep0) + ((dicPos < rep0) ? dicBufSize : 0);
 
                 processedPos += curLen;
 
                 len -= curLen;
-                if (pos + curLen <= outSize) {
-                    uint8_t* dest = outBuffer + dicPos;
-                    ptrdiff_t realSrc = (ptrdiff_t)pos - (ptrdiff_t)dicPos;
-                    const uint8_t* lim = dest + curLen;
+                if (pos + curLen <= dicBufSize) {
+                    uint8_t* dest = dic + dicPos;
+                    const uint8_t* src = dic + pos;
                     dicPos += curLen;
-                    do {
-                        *dest = *(dest + realSrc);
-                    } while (++dest != lim);
+                    // Eight bytes at a time whenever a word read never sees bytes of the same
+                    // word write, which holds for a source ahead of dest as well. Nothing past
+                    // the match is written, in a ring those bytes are still part of the window.
+                    if ((size_t)(dest - src) >= 8) {
+                        while (curLen >= 16) {
+                            LZMA_COPY8(dest, src);
+                            LZMA_COPY8(dest + 8, src + 8);
+                            dest += 16;
+                            src += 16;
+                            curLen -= 16;
+                        }
+                        if (curLen >= 8) {
+                            LZMA_COPY8(dest, src);
+                            dest += 8;
+                            src += 8;
+                            curLen -= 8;
+                        }
+                        while (curLen-- != 0) {
+                            *dest++ = *src++;
+                        }
+                    }
+                    else if (rep0 == 1) {
+                        __stosb(dest, *src, curLen);
+                    }
+                    else {
+                        const uint8_t* lim = dest + curLen;
+                        do {
+                            *dest = *src++;
+                        } while (++dest != lim);
+                    }
                 }
                 else {
                     do {
-                        outBuffer[dicPos++] = outBuffer[pos];
-                        if (++pos == outSize) {
+                        dic[dicPos++] = dic[pos];
+                        if (++pos == dicBufSize) {
                             pos = 0;
                         }
                     } while (--curLen != 0);
                 }
             }
-                }
-                    } while (dicPos < outSize && buf < bufLimit);
-                    NORMALIZE;
-                    remainLen = len;
-                }
+        }
+    } while (dicPos < limit && buf < bufLimit);
+    NORMALIZE;
+
+    p->buf = buf;
+    p->range = range;
+    p->code = code;
+    p->remainLen = len;
+    p->dicPos = dicPos;
+    p->processedPos = processedPos;
+    p->reps[0] = rep0;
+    p->reps[1] = rep1;
+    p->reps[2] = rep2;
+    p->reps[3] = rep3;
+    p->state = state;
+
+    return SZ_OK;
+}
 
-                if (processedPos >= dicSize) {
-                    checkDicSize = dicSize;
-                }
-                if (remainLen != 0 && remainLen < kMatchSpecLenStart) {
-                    uint32_t len = remainLen;
+static int LzmaDec_DecodeReal(CLzmaDec* p, size_t limit, const uint8_t* bufLimit)
+{
+    // lc = 3, lp = 0, pb = 2 are the default properties and what nearly every stream uses.
+    if (p->lc == 3 && p->lp == 0 && p->pb == 2) {
+        return LzmaDec_DecodeRealT(p, limit, bufLimit, 3, 0, 3);
+    }
+    return LzmaDec_DecodeRealT(p, limit, bufLimit, p->lc, ((uint32_t)1 << p->lp) - 1, ((uint32_t)1 << p->pb) - 1);
+}
 
-                    if (outSize - dicPos < len) {
-                        len = (uint32_t)(outSize - dicPos);
-                    }
+static void LzmaDec_WriteRem(CLzmaDec* p, size_t limit)
+{
+    if (p->remainLen != 0 && p->remainLen < kMatchSpecLenStart) {
+        uint8_t* dic = p->dic;
+        size_t dicPos = p->dicPos;
+        size_t dicBufSize = p->dicBufSize;
+        uint32_t len = p->remainLen;
+        uint32_t rep0 = p->reps[0];
+
+        if (limit - dicPos < len) {
+            len = (uint32_t)(limit - dicPos);
+        }
 
-                    if (checkDicSize == 0 && dicSize - processedPos <= len) {
-                        checkDicSize = dicSize;
-                    }
+        if (p->checkDicSize == 0 && p->dicSize - p->processedPos <= len) {
+            p->checkDicSize = p->dicSize;
+        }
 
-                    processedPos += len;
-                    remainLen -= len;
-                    while (len-- != 0) {
-                        outBuffer[dicPos] = outBuffer[(dicPos - rep0) + ((dicPos < rep0) ? outSize : 0)];
-                        ++dicPos;
+        p->processedPos += len;
+        p->remainLen -= len;
+        while (len-- != 0) {
+            dic[dicPos] = dic[(dicPos - rep0) + ((dicPos < rep0) ? dicBufSize : 0)];
+            ++dicPos;
+        }
+        p->dicPos = dicPos;
+    }
+}
+
+static int LzmaDec_DecodeReal2(CLzmaDec* p, size_t limit, const uint8_t* bufLimit)
+{
+    do {
+        size_t limit2 = limit;
+        if (p->checkDicSize == 0) {
+            uint32_t rem = p->dicSize - p->processedPos;
+            if (limit - p->dicPos > rem) {
+                limit2 = p->dicPos + rem;
+            }
+        }
+        RINOK(LzmaDec_DecodeReal(p, limit2, bufLimit));
+        if (p->processedPos >= p->dicSize) {
+            p->checkDicSize = p->dicSize;
+        }
+        LzmaDec_WriteRem(p, limit);
+    } while (p->dicPos < limit && p->buf < bufLimit && p->remainLen < kMatchSpecLenStart);
+
+    if (p->remainLen > kMatchSpecLenStart) {
+        p->remainLen = kMatchSpecLenStart;
+    }
+    return SZ_OK;
+}
+
+typedef enum
+{
+    DUMMY_ERROR, /* unexpected end of input stream */
+    DUMMY_LIT,
+    DUMMY_MATCH,
+    DUMMY_REP
+} ELzmaDummy;
+
+/* Decodes the next symbol without touching the state, to find out whether the
+   few input bytes left hold it completely. */
+static ELzmaDummy LzmaDec_TryDummy(const CLzmaDec* p, const uint8_t* buf, size_t inSize)
+{
+    uint32_t range = p->range;
+    uint32_t code = p->code;
+    const uint8_t* bufLimit = buf + inSize;
+    uint32_t* probs = p->probs;
+    uint32_t state = p->state;
+    ELzmaDummy res;
+    uint32_t* prob;
+    uint32_t bound;
+    uint32_t ttt;
+    uint32_t posState = p->processedPos & (((uint32_t)1 << p->pb) - 1);
+
+    prob = probs + IsMatch + (state << kNumPosBitsMax) + posState;
+    IF_BIT_0_CHECK(prob) {
+        UPDATE_0_CHECK
+
+        prob = probs + Literal;
+        if (p->checkDicSize != 0 || p->processedPos != 0) {
+            prob += (LZMA_LIT_SIZE * (((p->processedPos & (((uint32_t)1 << p->lp) - 1)) << p->lc) +
+                (p->dic[(p->dicPos == 0 ? p->dicBufSize : p->dicPos) - 1] >> (8 - p->lc))));
+        }
+
+        if (state < kNumLitStates) {
+            uint32_t symbol = 1;
+            do {
+                GET_BIT_CHECK(prob + symbol, symbol)
+            } while (symbol < 0x100);
+        }
+        else {
+            uint32_t matchByte = p->dic[p->dicPos - p->reps[0] + ((p->dicPos < p->reps[0]) ? p->dicBufSize : 0)];
+            uint32_t offs = 0x100;
+            uint32_t symbol = 1;
+            do {
+                uint32_t bit;
+                uint32_t* probLit;
+                matchByte <<= 1;
+                bit = (matchByte & offs);
+                probLit = prob + offs + bit + symbol;
+                GET_BIT2_CHECK(probLit, symbol, offs &= ~bit, offs &= bit)
+            } while (symbol < 0x100);
+        }
+        res = DUMMY_LIT;
+    }
+    else {
+        uint32_t len;
+        UPDATE_1_CHECK;
+
+        prob = probs + IsRep + state;
+        IF_BIT_0_CHECK(prob) {
+            UPDATE_0_CHECK;
+            state = 0;
+            prob = probs + LenCoder;
+            res = DUMMY_MATCH;
+        }
+        else {
+            UPDATE_1_CHECK;
+            res = DUMMY_REP;
+            prob = probs + IsRepG0 + state;
+            IF_BIT_0_CHECK(prob) {
+                UPDATE_0_CHECK;
+                prob = probs + IsRep0Long + (state << kNumPosBitsMax) + posState;
+                IF_BIT_0_CHECK(prob) {
+                    UPDATE_0_CHECK;
+                    NORMALIZE_CHECK;
+                    return DUMMY_REP;
+                }
+                else {
+                    UPDATE_1_CHECK;
+                }
+            }
+            else {
+                UPDATE_1_CHECK;
+                prob = probs + IsRepG1 + state;
+                IF_BIT_0_CHECK(prob) {
+                    UPDATE_0_CHECK;
+                }
+                else {
+                    UPDATE_1_CHECK;
+                    prob = probs + IsRepG2 + state;
+                    IF_BIT_0_CHECK(prob) {
+                        UPDATE_0_CHECK;
+                    }
+                    else {
+                        UPDATE_1_CHECK;
                     }
                 }
-            } while (dicPos < outSize && buf < bufLimit && remainLen < kMatchSpecLenStart);
+            }
+            state = kNumStates;
+            prob = probs + RepLenCoder;
+        }
+        {
+            uint32_t limit, offset;
+            uint32_t* probLen = prob + LenChoice;
+            IF_BIT_0_CHECK(probLen) {
+                UPDATE_0_CHECK;
+                probLen = prob + LenLow + (posState << kLenNumLowBits);
+                offset = 0;
+                limit = 1 << kLenNumLowBits;
+            }
+            else {
+                UPDATE_1_CHECK;
+                probLen = prob + LenChoice2;
+                IF_BIT_0_CHECK(probLen) {
+                    UPDATE_0_CHECK;
+                    probLen = prob + LenMid + (posState << kLenNumMidBits);
+                    offset = kLenNumLowSymbols;
+                    limit = 1 << kLenNumMidBits;
+                }
+                else {
+                    UPDATE_1_CHECK;
+                    probLen = prob + LenHigh;
+                    offset = kLenNumLowSymbols + kLenNumMidSymbols;
+                    limit = 1 << kLenNumHighBits;
+                }
+            }
+            TREE_DECODE_CHECK(probLen, limit, len);
+            len += offset;
+        }
+
+        if (state < 4) {
+            uint32_t posSlot;
+            prob = probs + PosSlot + ((len < kNumLenToPosStates ? len : kNumLenToPosStates - 1) << kNumPosSlotBits);
+            TREE_DECODE_CHECK(prob, 1 << kNumPosSlotBits, posSlot);
+            if (posSlot >= kStartPosModelIndex) {
+                int numDirectBits = ((posSlot >> 1) - 1);
+
+                if (posSlot < kEndPosModelIndex) {
+                    prob = probs + SpecPos + ((2 | (posSlot & 1)) << numDirectBits) - posSlot - 1;
+                }
+                else {
+                    numDirectBits -= kNumAlignBits;
+                    do {
+                        NORMALIZE_CHECK
+                        range >>= 1;
+                        code -= range & (((code - range) >> 31) - 1);
+                    } while (--numDirectBits != 0);
+                    prob = probs + Align;
+                    numDirectBits = kNumAlignBits;
+                }
+                {
+                    uint32_t i = 1;
+                    do {
+                        GET_BIT_CHECK(prob + i, i);
+                    } while (--numDirectBits != 0);
+                }
+            }
+        }
+    }
+    NORMALIZE_CHECK;
+    return res;
+}
+
+static void LzmaDec_InitDicAndState(CLzmaDec* p)
+{
+    p->dicPos = 0;
+    p->needFlush = 1;
+    p->remainLen = 0;
+    p->tempBufSize = 0;
+    p->processedPos = 0;
+    p->checkDicSize = 0;
+    p->needInitState = 1;
+}
+
+static void LzmaDec_InitStateReal(CLzmaDec* p)
+{
+    __stosd((unsigned long*)p->probs, kBitModelTotal >> 1, p->numProbs);
+    p->reps[0] = p->reps[1] = p->reps[2] = p->reps[3] = 1;
+    p->state = 0;
+    p->needInitState = 0;
+}
+
+static int LzmaDec_DecodeProps(CLzmaDec* p, const uint8_t* data)
+{
+    uint32_t dicSize = data[1] | ((uint32_t)data[2] << 8) | ((uint32_t)data[3] << 16) | ((uint32_t)data[4] << 24);
+    uint8_t d = data[0];
+
+    if (d >= (9 * 5 * 5)) {
+        return SZ_ERROR_UNSUPPORTED;
+    }
+    if (dicSize < LZMA_DIC_MIN) {
+        dicSize = LZMA_DIC_MIN;
+    }
+    p->dicSize = dicSize;
+    p->lc = d % 9;
+    d /= 9;
+    p->pb = d / 5;
+    p->lp = d % 5;
+    return SZ_OK;
+}
+
+static int LzmaDec_AllocateProbs(CLzmaDec* p, const uint8_t* props)
+{
+    uint32_t numProbs;
+
+    RINOK(LzmaDec_DecodeProps(p, props));
+    numProbs = Literal + ((uint32_t)LZMA_LIT_SIZE << (p->lc + p->lp));
+    if (p->probs == NULL || numProbs != p->numProbs) {
+        memory_free(p->probs);
+        p->probs = (uint32_t*)memory_alloc(numProbs << 2);
+        if (p->probs == NULL) {
+            p->numProbs = 0;
+            return SZ_ERROR_MEM;
+        }
+        p->numProbs = numProbs;
+    }
+    return SZ_OK;
+}
 
-            if (remainLen > kMatchSpecLenStart) {
-                remainLen = kMatchSpecLenStart;
+static int LzmaDec_DecodeToDic(CLzmaDec* p, size_t dicLimit, const uint8_t* src, size_t* srcLen, ELzmaFinishMode finishMode, ELzmaStatus* status)
+{
+    size_t inSize = *srcLen;
+
+    (*srcLen) = 0;
+    LzmaDec_WriteRem(p, dicLimit);
+
+    *status = LZMA_STATUS_NOT_SPECIFIED;
+
+    while (p->remainLen != kMatchSpecLenStart) {
+        int checkEndMarkNow;
+
+        if (p->needFlush != 0) {
+            for (; inSize > 0 && p->tempBufSize < RC_INIT_SIZE; (*srcLen)++, inSize--) {
+                p->tempBuf[p->tempBufSize++] = *src++;
             }
-            processed = (size_t)(buf - realSrc);
-            realSrc += processed;
+            if (p->tempBufSize < RC_INIT_SIZE) {
+                *status = LZMA_STATUS_NEEDS_MORE_INPUT;
+                return SZ_OK;
+            }
+            if (p->tempBuf[0] != 0) {
+                return SZ_ERROR_DATA;
+            }
+            p->code = _byteswap_ulong(*(uint32_t*)(p->tempBuf + 1));
+            p->range = 0xFFFFFFFF;
+            p->needFlush = 0;
+            p->tempBufSize = 0;
+        }
+
+        checkEndMarkNow = 0;
+        if (p->dicPos >= dicLimit) {
+            if (p->remainLen == 0 && p->code == 0) {
+                *status = LZMA_STATUS_MAYBE_FINISHED_WITHOUT_MARK;
+                return SZ_OK;
+            }
+            if (finishMode == LZMA_FINISH_ANY) {
+                *status = LZMA_STATUS_NOT_FINISHED;
+                return SZ_OK;
+            }
+            if (p->remainLen != 0) {
+                *status = LZMA_STATUS_NOT_FINISHED;
+                return SZ_ERROR_DATA;
+            }
+            checkEndMarkNow = 1;
+        }
+
+        if (p->needInitState) {
+            LzmaDec_InitStateReal(p);
+        }
+
+        if (p->tempBufSize == 0) {
+            size_t processed;
+            const uint8_t* bufLimit;
+            if (inSize < LZMA_REQUIRED_INPUT_MAX || checkEndMarkNow) {
+                ELzmaDummy dummyRes = LzmaDec_TryDummy(p, src, inSize);
+                if (dummyRes == DUMMY_ERROR) {
+                    __movsb(p->tempBuf, src, inSize);
+                    p->tempBufSize = (uint32_t)inSize;
+                    (*srcLen) += inSize;
+                    *status = LZMA_STATUS_NEEDS_MORE_INPUT;
+                    return SZ_OK;
+                }
+                if (checkEndMarkNow && dummyRes != DUMMY_MATCH) {
+                    *status = LZMA_STATUS_NOT_FINISHED;
+                    return SZ_ERROR_DATA;
+                }
+                bufLimit = src;
+            }
+            else {
+                bufLimit = src + inSize - LZMA_REQUIRED_INPUT_MAX;
+            }
+            p->buf = src;
+            if (LzmaDec_DecodeReal2(p, dicLimit, bufLimit) != SZ_OK) {
+                return SZ_ERROR_DATA;
+            }
+            processed = (size_t)(p->buf - src);
+            (*srcLen) += processed;
+            src += processed;
             inSize -= processed;
         }
+        else {
+            uint32_t rem = p->tempBufSize, lookAhead = 0;
+            while (rem < LZMA_REQUIRED_INPUT_MAX && lookAhead < inSize) {
+                p->tempBuf[rem++] = src[lookAhead++];
+            }
+            p->tempBufSize = rem;
+            if (rem < LZMA_REQUIRED_INPUT_MAX || checkEndMarkNow) {
+                ELzmaDummy dummyRes = LzmaDec_TryDummy(p, p->tempBuf, rem);
+                if (dummyRes == DUMMY_ERROR) {
+                    (*srcLen) += lookAhead;
+                    *status = LZMA_STATUS_NEEDS_MORE_INPUT;
+                    return SZ_OK;
+                }
+                if (checkEndMarkNow && dummyRes != DUMMY_MATCH) {
+                    *status = LZMA_STATUS_NOT_FINISHED;
+                    return SZ_ERROR_DATA;
+                }
+            }
+            p->buf = p->tempBuf;
+            if (LzmaDec_DecodeReal2(p, dicLimit, p->buf) != SZ_OK) {
+                return SZ_ERROR_DATA;
+            }
+            lookAhead -= (rem - (uint32_t)(p->buf - p->tempBuf));
+            (*srcLen) += lookAhead;
+            src += lookAhead;
+            inSize -= lookAhead;
+            p->tempBufSize = 0;
+        }
     }
-    if (code == 0)
+    if (p->code == 0) {
         *status = LZMA_STATUS_FINISHED_WITH_MARK;
-    res = (code == 0) ? SZ_OK : SZ_ERROR_DATA;
-end:
+    }
+    return (p->code == 0) ? SZ_OK : SZ_ERROR_DATA;
+}
+
+void lzma_dec_init(CLzmaDec* p)
+{
+    __stosb((uint8_t*)p, 0, sizeof(CLzmaDec));
+}
+
+int lzma_dec_allocate(CLzmaDec* p, const uint8_t* props, uint32_t propsSize)
+{
+    size_t dicBufSize;
+
+    if (propsSize < LZMA_PROPS_SIZE) {
+        return SZ_ERROR_UNSUPPORTED;
+    }
+    RINOK(LzmaDec_AllocateProbs(p, props));
+
+    if (p->dicSize > LZMA_DEC_DIC_MAX) {
+        return SZ_ERROR_UNSUPPORTED;
+    }
+
+    // The window is kept across streams as long as it is large enough.
+    dicBufSize = p->dicSize;
+    if (p->dic == NULL || dicBufSize > p->dicBufSize) {
+        memory_free(p->dic);
+        p->dic = (uint8_t*)memory_alloc(dicBufSize);
+        if (p->dic == NULL) {
+            p->dicBufSize = 0;
+            return SZ_ERROR_MEM;
+        }
+        p->dicBufSize = dicBufSize;
+    }
+
+    __movsb(p->props, props, LZMA_PROPS_SIZE);
+    p->propsSize = LZMA_PROPS_SIZE;
+    LzmaDec_InitDicAndState(p);
+    return SZ_OK;
+}
+
+void lzma_dec_reset(CLzmaDec* p)
+{
+    p->propsSize = 0;
+    LzmaDec_InitDicAndState(p);
+}
+
+int lzma_dec_decode(CLzmaDec* p, const uint8_t* src, size_t* srcLen, uint8_t* dest, size_t* destLen, ELzmaFinishMode finishMode, ELzmaStatus* status)
+{
+    size_t outSize = *destLen;
+    size_t inSize = *srcLen;
+
+    *srcLen = *destLen = 0;
+    *status = LZMA_STATUS_NOT_SPECIFIED;
 
+    // The stream starts with the properties, which may arrive split over several calls.
+    if (p->propsSize < LZMA_PROPS_SIZE) {
+        while (inSize > 0 && p->propsSize < LZMA_PROPS_SIZE) {
+            p->props[p->propsSize++] = *src++;
+            --inSize;
+            ++(*srcLen);
+        }
+        if (p->propsSize < LZMA_PROPS_SIZE) {
+            *status = LZMA_STATUS_NEEDS_MORE_INPUT;
+            return SZ_OK;
+        }
+        RINOK(lzma_dec_allocate(p, p->props, LZMA_PROPS_SIZE));
+    }
+
+    for ( ; ; ) {
+        size_t inSizeCur = inSize, outSizeCur, dicPos;
+        ELzmaFinishMode curFinishMode;
+        int res;
+
+        if (p->dicPos == p->dicBufSize) {
+            p->dicPos = 0;
+        }
+        dicPos = p->dicPos;
+        if (outSize > p->dicBufSize - dicPos) {
+            outSizeCur = p->dicBufSize;
+            curFinishMode = LZMA_FINISH_ANY;
+        }
+        else {
+            outSizeCur = dicPos + outSize;
+            curFinishMode = finishMode;
+        }
+
+        res = LzmaDec_DecodeToDic(p, outSizeCur, src, &inSizeCur, curFinishMode, status);
+        src += inSizeCur;
+        inSize -= inSizeCur;
+        *srcLen += inSizeCur;
+        outSizeCur = p->dicPos - dicPos;
+        __movsb(dest, p->dic + dicPos, outSizeCur);
+        dest += outSizeCur;
+        outSize -= outSizeCur;
+        *destLen += outSizeCur;
+        if (res != SZ_OK) {
+            return res;
+        }
+        if (outSizeCur == 0 || outSize == 0) {
+            return SZ_OK;
+        }
+    }
+}
+
+void lzma_dec_free(CLzmaDec* p)
+{
+    memory_free(p->probs);
+    memory_free(p->dic);
+    lzma_dec_init(p);
+}
+
+/* Decodes one raw stream straight into dest, which serves as the window in place of
+   the ring of p. The probability table of p is reused when it has the right size. */
+static int LzmaDec_DecodeBuffer(CLzmaDec* p, uint8_t* dest, size_t* destLen, const uint8_t* props, const uint8_t* src, size_t srcLen, ELzmaFinishMode finishMode, ELzmaStatus* status)
+{
+    uint8_t* dic = p->dic;
+    size_t dicBufSize = p->dicBufSize;
+    int res;
+
+    res = LzmaDec_AllocateProbs(p, props);
+    if (res != SZ_OK) {
+        *destLen = 0;
+        return res;
+    }
+
+    p->dic = dest;
+    p->dicBufSize = *destLen;
+    LzmaDec_InitDicAndState(p);
+
+    res = LzmaDec_DecodeToDic(p, p->dicBufSize, src, &srcLen, finishMode, status);
     if (res == SZ_OK && *status == LZMA_STATUS_NEEDS_MORE_INPUT) {
         res = SZ_ERROR_INPUT_EOF;
     }
 
-    (*pOutSize) = dicPos;
-    memory_free(probs);
+    *destLen = p->dicPos;
+    p->dic = dic;
+    p->dicBufSize = dicBufSize;
+    lzma_dec_reset(p);
+    return res;
+}
+
+int lzma_dec_decode_buffer(CLzmaDec* p, uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, ELzmaStatus* status)
+{
+    *status = LZMA_STATUS_NOT_SPECIFIED;
+    if (srcLen < LZMA_PROPS_SIZE + RC_INIT_SIZE) {
+        *destLen = 0;
+        return SZ_ERROR_INPUT_EOF;
+    }
+    return LzmaDec_DecodeBuffer(p, dest, destLen, src, src + LZMA_PROPS_SIZE, srcLen - LZMA_PROPS_SIZE, LZMA_FINISH_ANY, status);
+}
+
+int lzma_decode(uint8_t* outBuffer, uint32_t* pOutSize, const uint8_t* inBuffer, uint32_t inSize, ELzmaStatus* status)
+{
+    CLzmaDec dec;
+    size_t outSize = *pOutSize;
+    int res;
+
+    // The whole output is the window, nothing is copied out of it.
+    lzma_dec_init(&dec);
+    res = lzma_dec_decode_buffer(&dec, outBuffer, &outSize, inBuffer, inSize, status);
+    (*pOutSize) = (uint32_t)outSize;
+    lzma_dec_free(&dec);
     return res;
 }
 
 int lzma_auto_decode(uint8_t* inStream, uint32_t inSize, uint8_t** outStream, uint32_t* poutSize)
 {
-    size_t outSize, origOutSize;
-    int ret = 1;
+    CLzmaDec dec;
+    const uint8_t* src = inStream + LZMA_PROPS_SIZE;
+    size_t inLeft, inLen, outSize;
+    uint8_t* outBuffer;
     ELzmaStatus st;
+    int res;
 
-    do {
-        outSize = inSize;
-        do {
-            if (*outStream != NULL) {
-                memory_free(*outStream);
+    *outStream = NULL;
+    *poutSize = 0;
+    if (inSize < LZMA_PROPS_SIZE + RC_INIT_SIZE) {
+        return 0;
+    }
+
+    lzma_dec_init(&dec);
+    if (LzmaDec_AllocateProbs(&dec, inStream) != SZ_OK) {
+        return 0;
+    }
+
+    // The stream carries no uncompressed size, so it is decoded once into a buffer that
+    // grows in place. The buffer is the window itself, matches never wrap around it.
+    outSize = (size_t)inSize << 1;
+    dec.dic = (uint8_t*)memory_alloc(outSize);
+    if (dec.dic == NULL) {
+        memory_free(dec.probs);
+        return 0;
+    }
+    dec.dicBufSize = outSize;
+    LzmaDec_InitDicAndState(&dec);
+
+    inLeft = inSize - LZMA_PROPS_SIZE;
+    for ( ; ; ) {
+        inLen = inLeft;
+        res = LzmaDec_DecodeToDic(&dec, outSize, src, &inLen, LZMA_FINISH_ANY, &st);
+        src += inLen;
+        inLeft -= inLen;
+        if (res != SZ_OK || st == LZMA_STATUS_FINISHED_WITH_MARK) {
+            break;
+        }
+        if (st == LZMA_STATUS_NEEDS_MORE_INPUT) {
+            res = SZ_ERROR_INPUT_EOF;
+            break;
+        }
+
+        // Output limit reached: grow the buffer and go on from where the decoder stopped.
+        if (outSize > ((uint32_t)-1 >> 1)) {
+            res = SZ_ERROR_OUTPUT_EOF;
+            break;
+        }
+        outSize <<= 1;
+        outBuffer = (uint8_t*)memory_realloc(dec.dic, outSize);
+        if (outBuffer == NULL) {
+            res = SZ_ERROR_MEM;
+            break;
+        }
+        dec.dic = outBuffer;
+        dec.dicBufSize = outSize;
+    }
+
+    memory_free(dec.probs);
+    if (res != SZ_OK) {
+        memory_free(dec.dic);
+        return 0;
+    }
+
+    *poutSize = (uint32_t)dec.dicPos;
+    outBuffer = (uint8_t*)memory_realloc(dec.dic, dec.dicPos != 0 ? dec.dicPos : 1);
+    *outStream = (outBuffer != NULL) ? outBuffer : dec.dic;
+    return 1;
+}
+
+// Preset dictionary
+
+struct _CLzmaDict
+{
+    CLzmaEncProps props;
+    uint8_t propsEncoded[LZMA_PROPS_SIZE];
+    uint8_t* data;
+    uint32_t size;
+
+    /* encoder: coder model and match finder tables as left after coding the dictionary */
+    CSaveState encState;
+    CLzRef* refs;
+    uint32_t numRefs;
+
+    /* decoder: the same model as rebuilt by decoding that stream */
+    uint32_t* probs;
+    uint32_t numProbs;
+    uint32_t state;
+    uint32_t reps[4];
+};
+
+void lzma_dict_destroy(CLzmaDict* d)
+{
+    if (d == NULL) {
+        return;
+    }
+    memory_free(d->data);
+    memory_free(d->encState.litProbs);
+    memory_free(d->refs);
+    memory_free(d->probs);
+    memory_free(d);
+}
+
+CLzmaDict* lzma_dict_create(const uint8_t* data, size_t size, const CLzmaEncProps* props)
+{
+    CLzmaDict* d;
+    CLzmaEnc* p;
+    CLzmaDec dec;
+    CMatchFinder* mf;
+    uint8_t* packed = NULL;
+    size_t packedSize, packedLen;
+    size_t window = size + (size > LZMA_DICT_WINDOW_EXTRA ? size : LZMA_DICT_WINDOW_EXTRA);
+    ELzmaStatus st;
+    uint32_t i;
+    int res;
+
+    if (size == 0 || size > LZMA_DICT_MAX) {
+        return NULL;
+    }
+
+    d = (CLzmaDict*)memory_alloc(sizeof(CLzmaDict));
+    p = (CLzmaEnc*)lzma_enc_create();
+    if (d == NULL || p == NULL) {
+        memory_free(d);
+        lzma_enc_destroy(p);
+        return NULL;
+    }
+
+    // The window holds the dictionary and leaves at least as much again for the message.
+    // It is rounded to a size the header stores exactly, both sides then agree on it.
+    d->props = *props;
+    for (i = 11; i <= 30; ++i) {
+        if (window <= ((size_t)2 << i)) {
+            d->props.dictSize = ((uint32_t)2 << i);
+            break;
+        }
+        if (window <= ((size_t)3 << i)) {
+            d->props.dictSize = ((uint32_t)3 << i);
+            break;
+        }
+    }
+    d->props.numThreads = 1;
+    d->size = (uint32_t)size;
+
+    res = lzma_enc_set_props(p, &d->props);
+    if (res == SZ_OK) {
+        d->data = (uint8_t*)memory_alloc(size);
+        packedSize = size + (size >> 1) + (1 << 10);
+        packed = (uint8_t*)memory_alloc(packedSize + size);
+        if (d->data == NULL || packed == NULL) {
+            res = SZ_ERROR_MEM;
+        }
+    }
+
+    // Priming is coding the dictionary once, without an end marker. The encoder state left
+    // behind is kept as is; the decoder state is whatever decoding that stream leaves.
+    if (res == SZ_OK) {
+        __movsb(d->data, data, size);
+        d->propsEncoded[0] = (uint8_t)((p->pb * 5 + p->lp) * 9 + p->lc);
+        for (i = 0; i < 4; ++i) {
+            d->propsEncoded[1 + i] = (uint8_t)(d->props.dictSize >> (8 * i));
+        }
+        p->writeEndMark = FALSE;
+        packedLen = packedSize;
+        res = LzmaEnc_MemEncode(p, packed, &packedLen, d->data, size);
+    }
+    if (res == SZ_OK) {
+        mf = &p->matchFinderBase;
+        d->numRefs = mf->hashSizeSum + mf->numSons;
+        d->refs = AllocRefs(d->numRefs);
+        d->encState.litProbs = (uint32_t*)memory_alloc(((size_t)0x300 << p->lclp) * sizeof(uint32_t));
+        if (d->refs == NULL || d->encState.litProbs == NULL) {
+            res = SZ_ERROR_MEM;
+        }
+        else {
+            __movsb((uint8_t*)d->refs, (const uint8_t*)mf->hash, (size_t)d->numRefs * sizeof(CLzRef));
+            LzmaEnc_SaveState(p, &d->encState);
+        }
+    }
+
+    if (res == SZ_OK) {
+        lzma_dec_init(&dec);
+        res = LzmaDec_AllocateProbs(&dec, d->propsEncoded);
+        if (res == SZ_OK) {
+            dec.dic = packed + packedSize;
+            dec.dicBufSize = size;
+            LzmaDec_InitDicAndState(&dec);
+            res = LzmaDec_DecodeToDic(&dec, size, packed, &packedLen, LZMA_FINISH_ANY, &st);
+            if (res == SZ_OK && (dec.dicPos != size || dec.remainLen != 0)) {
+                res = SZ_ERROR_DATA;
             }
-            outSize *= 2;
-            origOutSize = outSize;
-            *outStream = (uint8_t*)memory_alloc(outSize);
-            ret = lzma_decode(*outStream, &outSize, inStream, inSize, &st);
-        } while (ret == SZ_OK && outSize == origOutSize);
+        }
+        if (res == SZ_OK) {
+            d->probs = dec.probs;
+            d->numProbs = dec.numProbs;
+            d->state = dec.state;
+            __movsb((uint8_t*)d->reps, (const uint8_t*)dec.reps, sizeof(d->reps));
+        }
+        else {
+            memory_free(dec.probs);
+        }
+    }
+
+    memory_free(packed);
+    lzma_enc_destroy(p);
+    if (res != SZ_OK) {
+        lzma_dict_destroy(d);
+        return NULL;
+    }
+    return d;
+}
+
+int lzma_enc_encode_dict(CLzmaEncHandle pp, const CLzmaDict* d, uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, uint8_t* propsEncoded, size_t* propsSize)
+{
+    CLzmaEnc *p = (CLzmaEnc*)pp;
+    CSeqOutStreamBuf outStream;
+    size_t need = (size_t)d->size + srcLen;
+    int res;
+
+    if (*propsSize < LZMA_PROPS_SIZE) {
+        return SZ_ERROR_PARAM;
+    }
+    RINOK(lzma_enc_set_props(p, &d->props));
+
+    // Matches reach back into the dictionary, so it sits in front of the message.
+    if (p->primeBuf == NULL || p->primeBufSize < need) {
+        memory_free(p->primeBuf);
+        p->primeBufSize = 0;
+        p->primeBuf = (uint8_t*)memory_alloc(need);
+        if (p->primeBuf == NULL) {
+            return SZ_ERROR_MEM;
+        }
+        p->primeBufSize = need;
+    }
+    __movsb(p->primeBuf, d->data, d->size);
+    __movsb(p->primeBuf + d->size, src, srcLen);
+
+    *propsSize = LZMA_PROPS_SIZE;
+    __movsb(propsEncoded, d->propsEncoded, LZMA_PROPS_SIZE);
+
+    outStream.funcTable.Write = MyWrite;
+    outStream.data = dest;
+    outStream.rem = *destLen;
+    outStream.overflow = FALSE;
+    p->rc.outStream = &outStream.funcTable;
+
+    LzmaEnc_SetInputBuf(p, p->primeBuf, srcLen);
+    res = LzmaEnc_AllocAndInit(p, 0);
+    if (res == SZ_OK && p->matchFinderBase.hashSizeSum + p->matchFinderBase.numSons != d->numRefs) {
+        res = SZ_ERROR_PARAM;
+    }
+    if (res == SZ_OK) {
+        // Pick up where coding the dictionary stopped, with a fresh range coder.
+        LzmaEnc_RestoreState(p, &d->encState);
+        LzmaEnc_InitPrices(p);
+        MatchFinder_InitPrimed(&p->matchFinderBase, d->refs, d->size);
+        p->needInit = 0;
+        p->nowPos64 = d->size;
+        res = LzmaEnc_Encode2(p);
+    }
+
+    *destLen -= outStream.rem;
+    p->matchFinderBase.directInput = 0;
+    p->matchFinderBase.bufferBase = 0;
+    if (res == SZ_OK && outStream.overflow) {
+        res = SZ_ERROR_OUTPUT_EOF;
+    }
+    return res;
+}
+
+int lzma_dec_decode_dict(CLzmaDec* p, const CLzmaDict* d, uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, ELzmaStatus* status)
+{
+    size_t outSize = *destLen;
+    size_t need = (size_t)d->size + outSize;
+    uint32_t i;
+    int res;
+
+    *destLen = 0;
+    *status = LZMA_STATUS_NOT_SPECIFIED;
+    if (srcLen < LZMA_PROPS_SIZE + RC_INIT_SIZE) {
+        return SZ_ERROR_INPUT_EOF;
+    }
+    for (i = 0; i < LZMA_PROPS_SIZE; ++i) {
+        if (src[i] != d->propsEncoded[i]) {
+            return SZ_ERROR_PARAM;
+        }
+    }
+    RINOK(LzmaDec_AllocateProbs(p, src));
+
+    // The window is the dictionary followed by room for the whole message.
+    if (p->dic == NULL || p->dicBufSize < need) {
+        memory_free(p->dic);
+        p->dic = (uint8_t*)memory_alloc(need);
+        if (p->dic == NULL) {
+            p->dicBufSize = 0;
+            return SZ_ERROR_MEM;
+        }
+        p->dicBufSize = need;
+    }
+    __movsb(p->dic, d->data, d->size);
+
+    LzmaDec_InitDicAndState(p);
+    __movsb((uint8_t*)p->probs, (const uint8_t*)d->probs, (size_t)d->numProbs * sizeof(uint32_t));
+    __movsb((uint8_t*)p->reps, (const uint8_t*)d->reps, sizeof(p->reps));
+    p->state = d->state;
+    p->needInitState = 0;
+    p->dicPos = p->processedPos = d->size;
+
+    srcLen -= LZMA_PROPS_SIZE;
+    res = LzmaDec_DecodeToDic(p, need, src + LZMA_PROPS_SIZE, &srcLen, LZMA_FINISH_ANY, status);
+    if (res == SZ_OK && *status == LZMA_STATUS_NEEDS_MORE_INPUT) {
+        res = SZ_ERROR_INPUT_EOF;
+    }
+
+    *destLen = p->dicPos - d->size;
+    __movsb(dest, p->dic + d->size, *destLen);
+    lzma_dec_reset(p);
+    return res;
+}
+
+// Block-parallel framed format
+
+typedef struct _lzma_mt_job
+{
+    const CLzmaEncProps* props;
+    const uint8_t* src;
+    uint8_t* dest;
+    size_t srcLen;
+    uint32_t blockSize;
+    uint32_t numBlocks;
+    uint8_t* index;
+    uint8_t* propsOut;
+    size_t* offsets;
+    volatile long next;
+    volatile long result;
+} lzma_mt_job_t;
+
+#define LZMA_MT_ENTRY(job, i) ((uint32_t*)((job)->index + (size_t)(i) * LZMA_MT_INDEX_ENTRY_SIZE))
+
+static void lzma_mt_encode_worker(void* arg)
+{
+    lzma_mt_job_t* job = (lzma_mt_job_t*)arg;
+    CLzmaEncHandle enc;
+    uint32_t i;
+    int res;
+
+    // One encoder per thread, reused for all the blocks it takes.
+    enc = lzma_enc_create();
+    if (enc == NULL) {
+        _InterlockedCompareExchange(&job->result, SZ_ERROR_MEM, SZ_OK);
+        return;
+    }
+    res = lzma_enc_set_props(enc, job->props);
+    if (res != SZ_OK) {
+        _InterlockedCompareExchange(&job->result, res, SZ_OK);
+        lzma_enc_destroy(enc);
+        return;
+    }
+
+    while ((i = (uint32_t)_InterlockedIncrement(&job->next) - 1) < job->numBlocks && job->result == SZ_OK) {
+        const uint8_t* src = job->src + (size_t)i * job->blockSize;
+        uint8_t* dest = job->dest + (size_t)i * job->blockSize;
+        size_t left = job->srcLen - (size_t)i * job->blockSize;
+        uint32_t unpackSize = (left < job->blockSize) ? (uint32_t)left : job->blockSize;
+        uint8_t props[LZMA_PROPS_SIZE];
+        size_t propsSize = LZMA_PROPS_SIZE;
+        size_t packSize = unpackSize - 1;
+
+        // A block is kept compressed only when it shrinks, otherwise it is stored as is.
+        res = lzma_enc_encode(enc, dest, &packSize, src, unpackSize, props, &propsSize);
+        if (res == SZ_ERROR_OUTPUT_EOF) {
+            __movsb(dest, src, unpackSize);
+            packSize = unpackSize;
+        }
+        else if (res != SZ_OK) {
+            _InterlockedCompareExchange(&job->result, res, SZ_OK);
+            break;
+        }
 
-        *poutSize = outSize;
-    } while (0);
+        // The first block is the largest, so its window covers every other block.
+        if (i == 0) {
+            __movsb(job->propsOut, props, LZMA_PROPS_SIZE);
+        }
+        LZMA_MT_ENTRY(job, i)[0] = (uint32_t)packSize;
+        LZMA_MT_ENTRY(job, i)[1] = unpackSize;
+    }
+
+    lzma_enc_destroy(enc);
+}
 
-    return (ret == SZ_OK);
-}
\ No newline at end of file
+static void lzma_mt_decode_worker(void* arg)
+{
+    lzma_mt_job_t* job = (lzma_mt_job_t*)arg;
+    const uint8_t* props = job->src + LZMA_MT_PROPS_OFFSET;
+    CLzmaDec dec;
+    uint32_t i;
+
+    lzma_dec_init(&dec);
+    while ((i = (uint32_t)_InterlockedIncrement(&job->next) - 1) < job->numBlocks && job->result == SZ_OK) {
+        uint32_t packSize = LZMA_MT_ENTRY(job, i)[0];
+        size_t unpackSize = LZMA_MT_ENTRY(job, i)[1];
+        const uint8_t* src = job->src + job->offsets[i];
+        uint8_t* dest = job->dest + (size_t)i * job->blockSize;
+        ELzmaStatus status;
+        int res;
+
+        if (packSize == unpackSize) {
+            __movsb(dest, src, unpackSize);
+            continue;
+        }
+
+        res = LzmaDec_DecodeBuffer(&dec, dest, &unpackSize, props, src, packSize, LZMA_FINISH_END, &status);
+        if (res == SZ_OK && (status != LZMA_STATUS_FINISHED_WITH_MARK || unpackSize != LZMA_MT_ENTRY(job, i)[1])) {
+            res = SZ_ERROR_DATA;
+        }
+        if (res != SZ_OK) {
+            _InterlockedCompareExchange(&job->result, res, SZ_OK);
+            break;
+        }
+    }
+
+    lzma_dec_free(&dec);
+}
+
+/* Runs the job on the calling thread plus up to numThreads - 1 workers. */
+static void lzma_mt_run(lzma_mt_job_t* job, async_thread_cb worker, uint32_t numThreads)
+{
+    async_thread_t tids[LZMA_MT_MAX_THREADS];
+    SYSTEM_INFO si;
+    uint32_t i, n;
+
+    if (numThreads == 0) {
+        fn_GetSystemInfo(&si);
+        numThreads = si.dwNumberOfProcessors;
+    }
+    if (numThreads > LZMA_MT_MAX_THREADS) {
+        numThreads = LZMA_MT_MAX_THREADS;
+    }
+    if (numThreads > job->numBlocks) {
+        numThreads = job->numBlocks;
+    }
+
+    job->next = 0;
+    job->result = SZ_OK;
+
+    for (n = 0; n + 1 < numThreads; ++n) {
+        if (async_thread_create(&tids[n], worker, job) != 0) {
+            break;
+        }
+    }
+
+    worker(job);
+
+    for (i = 0; i < n; ++i) {
+        async_thread_join(&tids[i]);
+    }
+}
+
+size_t lzma_mt_bound(size_t srcLen, uint32_t blockSize)
+{
+    size_t numBlocks;
+
+    if (blockSize == 0) {
+        blockSize = LZMA_MT_BLOCK_SIZE;
+    }
+    numBlocks = (srcLen + blockSize - 1) / blockSize;
+    return LZMA_MT_HEADER_SIZE + numBlocks * LZMA_MT_INDEX_ENTRY_SIZE + srcLen;
+}
+
+int lzma_mt_encode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, const CLzmaEncProps* props, uint32_t blockSize, uint32_t numThreads)
+{
+    lzma_mt_job_t job;
+    CLzmaEncProps blockProps;
+    size_t numBlocks, dataOffset, pos;
+    uint8_t* data;
+    uint32_t i;
+
+    if (blockSize == 0) {
+        blockSize = LZMA_MT_BLOCK_SIZE;
+    }
+    numBlocks = (srcLen + blockSize - 1) / blockSize;
+    if (numBlocks > (uint32_t)-1) {
+        return SZ_ERROR_PARAM;
+    }
+    if (*destLen < lzma_mt_bound(srcLen, blockSize)) {
+        return SZ_ERROR_OUTPUT_EOF;
+    }
+
+    // The blocks already spread over the threads, each encoder keeps its match finder inline.
+    blockProps = *props;
+    blockProps.numThreads = 1;
+
+    *(uint32_t*)dest = LZMA_MT_MAGIC;
+    *(uint32_t*)(dest + 4) = blockSize;
+    *(uint32_t*)(dest + 8) = (uint32_t)numBlocks;
+    __stosb(dest + LZMA_MT_PROPS_OFFSET, 0, LZMA_MT_HEADER_SIZE - LZMA_MT_PROPS_OFFSET);
+
+    dataOffset = LZMA_MT_HEADER_SIZE + numBlocks * LZMA_MT_INDEX_ENTRY_SIZE;
+    data = dest + dataOffset;
+
+    // Each block is compressed into its own blockSize slot, the slots are packed together afterwards.
+    job.props = &blockProps;
+    job.src = src;
+    job.dest = data;
+    job.srcLen = srcLen;
+    job.blockSize = blockSize;
+    job.numBlocks = (uint32_t)numBlocks;
+    job.index = dest + LZMA_MT_HEADER_SIZE;
+    job.propsOut = dest + LZMA_MT_PROPS_OFFSET;
+    job.offsets = NULL;
+    lzma_mt_run(&job, lzma_mt_encode_worker, numThreads);
+    if (job.result != SZ_OK) {
+        return (int)job.result;
+    }
+
+    for (i = 0, pos = 0; i < job.numBlocks; ++i) {
+        uint32_t packSize = LZMA_MT_ENTRY(&job, i)[0];
+        if (pos != (size_t)i * blockSize) {
+            __movsb(data + pos, data + (size_t)i * blockSize, packSize);
+        }
+        pos += packSize;
+    }
+
+    *destLen = dataOffset + pos;
+    return SZ_OK;
+}
+
+int lzma_mt_decoded_size(const uint8_t* src, size_t srcLen, size_t* size)
+{
+    uint32_t blockSize, numBlocks, unpackSize = 0, i;
+    uint64_t total = 0;
+
+    if (srcLen < LZMA_MT_HEADER_SIZE || *(const uint32_t*)src != LZMA_MT_MAGIC) {
+        return SZ_ERROR_NO_ARCHIVE;
+    }
+    blockSize = *(const uint32_t*)(src + 4);
+    numBlocks = *(const uint32_t*)(src + 8);
+    if ((srcLen - LZMA_MT_HEADER_SIZE) / LZMA_MT_INDEX_ENTRY_SIZE < numBlocks) {
+        return SZ_ERROR_INPUT_EOF;
+    }
+
+    // Every block but the last is exactly blockSize, which is where the decoder puts them.
+    for (i = 0; i < numBlocks; ++i) {
+        unpackSize = ((const uint32_t*)(src + LZMA_MT_HEADER_SIZE + (size_t)i * LZMA_MT_INDEX_ENTRY_SIZE))[1];
+        if (unpackSize > blockSize || (unpackSize != blockSize && i + 1 != numBlocks)) {
+            return SZ_ERROR_DATA;
+        }
+    }
+    if (numBlocks != 0) {
+        total = (uint64_t)(numBlocks - 1) * blockSize + unpackSize;
+        if (total > (size_t)-1) {
+            return SZ_ERROR_DATA;
+        }
+    }
+    *size = (size_t)total;
+    return SZ_OK;
+}
+
+int lzma_mt_decode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, uint32_t numThreads)
+{
+    lzma_mt_job_t job;
+    size_t outSize, pos;
+    uint32_t blockSize, i;
+    int res;
+
+    res = lzma_mt_decoded_size(src, srcLen, &outSize);
+    if (res != SZ_OK) {
+        return res;
+    }
+    if (*destLen < outSize) {
+        return SZ_ERROR_OUTPUT_EOF;
+    }
+
+    blockSize = *(const uint32_t*)(src + 4);
+    job.numBlocks = *(const uint32_t*)(src + 8);
+    job.index = (uint8_t*)src + LZMA_MT_HEADER_SIZE;
+    job.src = src;
+    job.dest = dest;
+    job.srcLen = srcLen;
+    job.blockSize = blockSize;
+    job.props = NULL;
+    job.propsOut = NULL;
+
+    // The index gives every block its place in both buffers, so blocks decode independently.
+    job.offsets = (size_t*)memory_alloc(((size_t)job.numBlocks + 1) * sizeof(size_t));
+    if (job.offsets == NULL) {
+        return SZ_ERROR_MEM;
+    }
+    pos = LZMA_MT_HEADER_SIZE + (size_t)job.numBlocks * LZMA_MT_INDEX_ENTRY_SIZE;
+    for (i = 0; i < job.numBlocks; ++i) {
+        uint32_t packSize = LZMA_MT_ENTRY(&job, i)[0];
+        uint32_t unpackSize = LZMA_MT_ENTRY(&job, i)[1];
+        if (packSize > unpackSize || packSize > srcLen - pos) {
+            memory_free(job.offsets);
+            return SZ_ERROR_DATA;
+        }
+        job.offsets[i] = pos;
+        pos += packSize;
+    }
+
+    lzma_mt_run(&job, lzma_mt_decode_worker, numThreads);
+    memory_free(job.offsets);
+    if (job.result != SZ_OK) {
+        return (int)job.result;
+    }
+
+    *destLen = outSize;
+    return SZ_OK;
+}
+
+// Seekable container
+
+#define LZMA_SEEK_ENTRY(index, i) ((const uint64_t*)((index) + (size_t)(i) * LZMA_SEEK_INDEX_ENTRY_SIZE))
+
+typedef struct _lzma_seek_slot
+{
+    uint8_t* data;
+    uint32_t block;
+    uint32_t stamp;
+} lzma_seek_slot_t;
+
+struct _lzma_seek
+{
+    const uint8_t* src;
+    const uint8_t* index;
+    uint64_t size;
+    uint64_t dataSize;
+    uint32_t blockSize;
+    uint32_t numBlocks;
+    uint8_t props[LZMA_PROPS_SIZE];
+    CLzmaDec dec;
+    uint32_t clock;
+    uint32_t numSlots;
+    lzma_seek_slot_t slots[1];
+};
+
+size_t lzma_seek_bound(size_t srcLen, uint32_t blockSize)
+{
+    size_t numBlocks;
+
+    if (blockSize == 0) {
+        blockSize = LZMA_SEEK_BLOCK_SIZE;
+    }
+    numBlocks = (srcLen + blockSize - 1) / blockSize;
+    return srcLen + numBlocks * LZMA_SEEK_INDEX_ENTRY_SIZE + LZMA_SEEK_FOOTER_SIZE;
+}
+
+int lzma_seek_encode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, const CLzmaEncProps* props, uint32_t blockSize, uint32_t numThreads)
+{
+    lzma_mt_job_t job;
+    CLzmaEncProps blockProps;
+    uint8_t blockPropsEncoded[LZMA_PROPS_SIZE];
+    size_t numBlocks, pos;
+    uint8_t* index;
+    uint8_t* footer;
+    uint32_t i;
+
+    if (blockSize == 0) {
+        blockSize = LZMA_SEEK_BLOCK_SIZE;
+    }
+    numBlocks = (srcLen + blockSize - 1) / blockSize;
+    if (numBlocks > (uint32_t)-1) {
+        return SZ_ERROR_PARAM;
+    }
+    if (*destLen < lzma_seek_bound(srcLen, blockSize)) {
+        return SZ_ERROR_OUTPUT_EOF;
+    }
+
+    blockProps = *props;
+    blockProps.numThreads = 1;
+    __stosb(blockPropsEncoded, 0, LZMA_PROPS_SIZE);
+
+    // Blocks are compressed the way the framed format does it, the sizes it records
+    // are turned into the trailing index once the blocks are packed together.
+    job.index = (uint8_t*)memory_alloc(numBlocks * LZMA_MT_INDEX_ENTRY_SIZE + 1);
+    if (job.index == NULL) {
+        return SZ_ERROR_MEM;
+    }
+    job.props = &blockProps;
+    job.src = src;
+    job.dest = dest;
+    job.srcLen = srcLen;
+    job.blockSize = blockSize;
+    job.numBlocks = (uint32_t)numBlocks;
+    job.propsOut = blockPropsEncoded;
+    job.offsets = NULL;
+    lzma_mt_run(&job, lzma_mt_encode_worker, numThreads);
+    if (job.result != SZ_OK) {
+        memory_free(job.index);
+        return (int)job.result;
+    }
+
+    for (i = 0, pos = 0; i < job.numBlocks; ++i) {
+        uint32_t packSize = LZMA_MT_ENTRY(&job, i)[0];
+        if (pos != (size_t)i * blockSize) {
+            __movsb(dest + pos, dest + (size_t)i * blockSize, packSize);
+        }
+        pos += packSize;
+    }
+
+    index = dest + pos;
+    for (i = 0, pos = 0; i < job.numBlocks; ++i) {
+        uint64_t* entry = (uint64_t*)(index + (size_t)i * LZMA_SEEK_INDEX_ENTRY_SIZE);
+        entry[0] = pos;
+        entry[1] = crc64(0, (void*)(src + (size_t)i * blockSize), LZMA_MT_ENTRY(&job, i)[1]);
+        pos += LZMA_MT_ENTRY(&job, i)[0];
+    }
+    memory_free(job.index);
+
+    footer = index + numBlocks * LZMA_SEEK_INDEX_ENTRY_SIZE;
+    *(uint64_t*)footer = srcLen;
+    *(uint64_t*)(footer + 8) = crc64(0, index, numBlocks * LZMA_SEEK_INDEX_ENTRY_SIZE);
+    *(uint32_t*)(footer + 16) = blockSize;
+    *(uint32_t*)(footer + 20) = (uint32_t)numBlocks;
+    __stosb(footer + 24, 0, 8);
+    __movsb(footer + 24, blockPropsEncoded, LZMA_PROPS_SIZE);
+    *(uint32_t*)(footer + 32) = LZMA_SEEK_MAGIC;
+
+    *destLen = (size_t)(footer + LZMA_SEEK_FOOTER_SIZE - dest);
+    return SZ_OK;
+}
+
+lzma_seek_t* lzma_seek_open(const uint8_t* src, size_t srcLen, uint32_t cacheBlocks)
+{
+    lzma_seek_t* r;
+    const uint8_t* footer;
+    uint64_t size, dataSize, prev;
+    uint32_t blockSize, numBlocks, i;
+
+    if (srcLen < LZMA_SEEK_FOOTER_SIZE) {
+        return NULL;
+    }
+    footer = src + srcLen - LZMA_SEEK_FOOTER_SIZE;
+    if (*(const uint32_t*)(footer + 32) != LZMA_SEEK_MAGIC) {
+        return NULL;
+    }
+    size = *(const uint64_t*)footer;
+    blockSize = *(const uint32_t*)(footer + 16);
+    numBlocks = *(const uint32_t*)(footer + 20);
+    if (blockSize == 0 || (size + blockSize - 1) / blockSize != numBlocks ||
+        (srcLen - LZMA_SEEK_FOOTER_SIZE) / LZMA_SEEK_INDEX_ENTRY_SIZE < numBlocks) {
+        return NULL;
+    }
+    dataSize = srcLen - LZMA_SEEK_FOOTER_SIZE - (size_t)numBlocks * LZMA_SEEK_INDEX_ENTRY_SIZE;
+    if (crc64(0, (void*)(src + dataSize), (size_t)numBlocks * LZMA_SEEK_INDEX_ENTRY_SIZE) != *(const uint64_t*)(footer + 8)) {
+        return NULL;
+    }
+
+    // Blocks follow each other, so every packed size comes out of two offsets.
+    for (i = 0, prev = 0; i < numBlocks; ++i) {
+        uint64_t offset = LZMA_SEEK_ENTRY(src + dataSize, i)[0];
+        uint64_t next = (i + 1 < numBlocks) ? LZMA_SEEK_ENTRY(src + dataSize, i + 1)[0] : dataSize;
+        if (offset != prev || next < offset || next - offset > blockSize) {
+            return NULL;
+        }
+        prev = next;
+    }
+
+    if (cacheBlocks == 0) {
+        cacheBlocks = LZMA_SEEK_CACHE_BLOCKS;
+    }
+    r = (lzma_seek_t*)memory_alloc(sizeof(lzma_seek_t) + (cacheBlocks - 1) * sizeof(lzma_seek_slot_t));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->src = src;
+    r->index = src + dataSize;
+    r->size = size;
+    r->dataSize = dataSize;
+    r->blockSize = blockSize;
+    r->numBlocks = numBlocks;
+    __movsb(r->props, footer + 24, LZMA_PROPS_SIZE);
+    lzma_dec_init(&r->dec);
+    r->numSlots = cacheBlocks;
+    for (i = 0; i < cacheBlocks; ++i) {
+        r->slots[i].block = (uint32_t)-1;
+    }
+    return r;
+}
+
+uint64_t lzma_seek_size(const lzma_seek_t* r)
+{
+    return r->size;
+}
+
+/* Returns the decoded block, from the cache or else decoded into the least recently used slot. */
+static int lzma_seek_get_block(lzma_seek_t* r, uint32_t block, const uint8_t** data)
+{
+    lzma_seek_slot_t* slot = &r->slots[0];
+    uint64_t offset, next;
+    size_t packSize, unpackSize, outSize;
+    ELzmaStatus status;
+    uint32_t i;
+    int res;
+
+    for (i = 0; i < r->numSlots; ++i) {
+        if (r->slots[i].block == block) {
+            r->slots[i].stamp = ++r->clock;
+            *data = r->slots[i].data;
+            return SZ_OK;
+        }
+        if (r->slots[i].stamp < slot->stamp) {
+            slot = &r->slots[i];
+        }
+    }
+
+    if (slot->data == NULL) {
+        slot->data = (uint8_t*)memory_alloc(r->blockSize);
+        if (slot->data == NULL) {
+            return SZ_ERROR_MEM;
+        }
+    }
+    slot->block = (uint32_t)-1;
+
+    offset = LZMA_SEEK_ENTRY(r->index, block)[0];
+    next = (block + 1 < r->numBlocks) ? LZMA_SEEK_ENTRY(r->index, block + 1)[0] : r->dataSize;
+    packSize = (size_t)(next - offset);
+    unpackSize = (block + 1 < r->numBlocks) ? r->blockSize : (size_t)(r->size - (uint64_t)block * r->blockSize);
+
+    if (packSize == unpackSize) {
+        __movsb(slot->data, r->src + offset, unpackSize);
+    }
+    else {
+        outSize = unpackSize;
+        res = LzmaDec_DecodeBuffer(&r->dec, slot->data, &outSize, r->props, r->src + offset, packSize, LZMA_FINISH_END, &status);
+        if (res == SZ_OK && (status != LZMA_STATUS_FINISHED_WITH_MARK || outSize != unpackSize)) {
+            res = SZ_ERROR_DATA;
+        }
+        if (res != SZ_OK) {
+            return res;
+        }
+    }
+    if (crc64(0, slot->data, unpackSize) != LZMA_SEEK_ENTRY(r->index, block)[1]) {
+        return SZ_ERROR_CRC;
+    }
+
+    slot->block = block;
+    slot->stamp = ++r->clock;
+    *data = slot->data;
+    return SZ_OK;
+}
+
+int lzma_seek_read_at(lzma_seek_t* r, uint64_t offset, uint8_t* dest, size_t len, size_t* readLen)
+{
+    *readLen = 0;
+    if (offset >= r->size) {
+        return SZ_OK;
+    }
+    if (len > r->size - offset) {
+        len = (size_t)(r->size - offset);
+    }
+
+    while (len != 0) {
+        uint32_t block = (uint32_t)(offset / r->blockSize);
+        size_t inBlock = (size_t)(offset - (uint64_t)block * r->blockSize);
+        size_t cur = r->blockSize - inBlock;
+        const uint8_t* data;
+
+        RINOK(lzma_seek_get_block(r, block, &data));
+        if (cur > len) {
+            cur = len;
+        }
+        __movsb(dest, data + inBlock, cur);
+        dest += cur;
+        offset += cur;
+        len -= cur;
+        *readLen += cur;
+    }
+    return SZ_OK;
+}
+
+void lzma_seek_close(lzma_seek_t* r)
+{
+    uint32_t i;
+
+    if (r == NULL) {
+        return;
+    }
+    for (i = 0; i < r->numSlots; ++i) {
+        memory_free(r->slots[i].data);
+    }
+    lzma_dec_free(&r->dec);
+    memory_free(r);
+}
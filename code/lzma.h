@@ -7,13 +7,18 @@
 
 typedef struct _CLzmaEncProps
 {
+  int level;       /* 0 <= level <= 9, default = 5. Supplies the defaults of the fields below */
   uint32_t dictSize; /* (1 << 12) <= dictSize <= (1 << 27) for 32-bit version
                       (1 << 12) <= dictSize <= (1 << 30) for 64-bit version
-                       default = (1 << 24) */
+                       default = (1 << (level * 2 + 14)) up to level 5, (1 << 25) at 6, (1 << 26) above.
+                       Never larger than the input it is used for */
   int lc;          /* 0 <= lc <= 8, default = 3 */
   int lp;          /* 0 <= lp <= 4, default = 0 */
   int pb;          /* 0 <= pb <= 4, default = 2 */
-  int fb;          /* 5 <= fb <= 273, default = 32 */
+  int fb;          /* 5 <= fb <= 273, default = 32, 64 from level 7 */
+  int btMode;      /* 0 - hash chain (Hc4) match finder, 1 - binary tree (Bt4), default = 0 below level 5, 1 from level 5 */
+  uint32_t mc;     /* match finder cycles, 1 <= mc <= (1 << 30), default = (16 + fb / 2) for Bt4, half of it for Hc4 */
+  int numThreads;  /* 1 or 2, default = 2 with Bt4: 2 runs the match finder on its own thread */
 } CLzmaEncProps;
 
 
@@ -65,6 +70,12 @@ typedef struct
 
 #define LZMA_REQUIRED_INPUT_MAX 20
 
+typedef enum
+{
+  LZMA_FINISH_ANY,   /* finish at any point */
+  LZMA_FINISH_END    /* block must be finished at the end */
+} ELzmaFinishMode;
+
 /* ELzmaFinishMode has meaning only if the decoding reaches output limit !!!
 
    You must use LZMA_FINISH_END, when you know that current output buffer
@@ -89,9 +100,176 @@ typedef enum
   LZMA_STATUS_MAYBE_FINISHED_WITHOUT_MARK  /* there is probability that stream was finished without end mark */
 } ELzmaStatus;
 
+/* Largest dictionary the streaming decoder accepts. The window is the only
+   memory that depends on the stream, so this bounds the decoder footprint. */
+#ifndef LZMA_DEC_DIC_MAX
+#define LZMA_DEC_DIC_MAX ((uint32_t)1 << 27)
+#endif
+
+/* Resumable decoder state. The dictionary is a ring of dicSize bytes allocated
+   once per stream (and kept for the next one when large enough), so a stream
+   of any length is decoded in constant memory. */
+typedef struct _CLzmaDec
+{
+  uint32_t lc, lp, pb;
+  uint32_t dicSize;
+  uint32_t *probs;
+  uint32_t numProbs;
+  uint8_t *dic;
+  size_t dicPos;
+  size_t dicBufSize;
+  const uint8_t *buf;
+  uint32_t range, code;
+  uint32_t processedPos;
+  uint32_t checkDicSize;
+  uint32_t state;
+  uint32_t reps[4];
+  uint32_t remainLen;
+  int needFlush;
+  int needInitState;
+  uint32_t tempBufSize;
+  uint8_t tempBuf[LZMA_REQUIRED_INPUT_MAX];
+  uint32_t propsSize;
+  uint8_t props[LZMA_PROPS_SIZE];
+} CLzmaDec;
+
+typedef void * CLzmaEncHandle;
+
 void lzma_encprops_init(CLzmaEncProps *p);
 int lzma_encode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, const CLzmaEncProps* props, uint8_t* propsEncoded, size_t* propsSize);
+
+/* Reusable encoder. The tables and buffers of a handle are set up once and kept
+   from one lzma_enc_encode() call to the next, which only resets the coder state. */
+CLzmaEncHandle lzma_enc_create(void);
+int lzma_enc_set_props(CLzmaEncHandle p, const CLzmaEncProps* props);
+int lzma_enc_encode(CLzmaEncHandle p, uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, uint8_t* propsEncoded, size_t* propsSize);
+void lzma_enc_destroy(CLzmaEncHandle p);
+
 int lzma_decode(uint8_t* outBuffer, uint32_t* pOutSize, const uint8_t* inBuffer, uint32_t inSize, ELzmaStatus* status);
 int lzma_auto_decode(uint8_t* inStream, uint32_t inSize, uint8_t** outStream, uint32_t* poutSize);
 
+/* Streaming decoder.
+
+   lzma_dec_init() clears the state. The stream may then be fed as is, starting
+   with its LZMA_PROPS_SIZE bytes of properties, or lzma_dec_allocate() may be
+   called first with properties stored elsewhere, for a raw stream.
+
+   lzma_dec_decode() consumes up to *srcLen input bytes and produces up to
+   *destLen output bytes, both are updated with the amounts actually used. It can
+   be called with any chunking of input and output; check status to find out
+   whether more input is needed (LZMA_STATUS_NEEDS_MORE_INPUT) or the end mark
+   was reached (LZMA_STATUS_FINISHED_WITH_MARK).
+
+   lzma_dec_reset() prepares the state for the next stream (properties first),
+   keeping the allocated buffers. lzma_dec_free() releases them. */
+void lzma_dec_init(CLzmaDec* p);
+int lzma_dec_allocate(CLzmaDec* p, const uint8_t* props, uint32_t propsSize);
+void lzma_dec_reset(CLzmaDec* p);
+int lzma_dec_decode(CLzmaDec* p, const uint8_t* src, size_t* srcLen, uint8_t* dest, size_t* destLen, ELzmaFinishMode finishMode, ELzmaStatus* status);
+void lzma_dec_free(CLzmaDec* p);
+
+/* One-shot decoding of a whole stream (properties first) into dest with a reusable
+   state: the probability table is kept between calls. The state is left reset. */
+int lzma_dec_decode_buffer(CLzmaDec* p, uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, ELzmaStatus* status);
+
+// Preset dictionary
+
+/* Small messages that look alike compress poorly on their own. A dictionary of
+   typical content is coded once by lzma_dict_create(), and the coder state it
+   leaves behind is where every message coded with it starts from, on both sides.
+   The window is sized from the dictionary (twice its size, at least
+   LZMA_DICT_WINDOW_EXTRA bytes more), props->dictSize is ignored. */
+#ifndef LZMA_DICT_MAX
+#define LZMA_DICT_MAX ((uint32_t)1 << 24)
+#endif
+
+#ifndef LZMA_DICT_WINDOW_EXTRA
+#define LZMA_DICT_WINDOW_EXTRA ((uint32_t)1 << 16)
+#endif
+
+typedef struct _CLzmaDict CLzmaDict;
+
+CLzmaDict* lzma_dict_create(const uint8_t* data, size_t size, const CLzmaEncProps* props);
+void lzma_dict_destroy(CLzmaDict* d);
+
+/* The encoder handle is left with the properties of the dictionary. Streams carry
+   their properties first, which must match those of d. */
+int lzma_enc_encode_dict(CLzmaEncHandle p, const CLzmaDict* d, uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, uint8_t* propsEncoded, size_t* propsSize);
+int lzma_dec_decode_dict(CLzmaDec* p, const CLzmaDict* d, uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, ELzmaStatus* status);
+
+// Block-parallel framed format
+
+/* The input is cut into blocks of blockSize bytes, each compressed as its own
+   raw stream on a pool of threads. The frame is laid out as
+
+     uint32_t magic, blockSize, numBlocks
+     uint8_t  props[LZMA_PROPS_SIZE], padding up to LZMA_MT_HEADER_SIZE
+     numBlocks index entries { uint32_t packSize, unpackSize }
+     the blocks, back to back
+
+   A block that does not shrink is stored as is, with packSize == unpackSize.
+   The index gives the position of every block in both buffers, so blocks are
+   decompressed in parallel as well. */
+#define LZMA_MT_MAGIC 0x424D5A4C /* "LZMB" */
+#define LZMA_MT_PROPS_OFFSET 12
+#define LZMA_MT_HEADER_SIZE 20
+#define LZMA_MT_INDEX_ENTRY_SIZE 8
+
+/* Default block size. Smaller blocks spread better over threads, larger blocks compress better. */
+#ifndef LZMA_MT_BLOCK_SIZE
+#define LZMA_MT_BLOCK_SIZE ((uint32_t)1 << 22)
+#endif
+
+#ifndef LZMA_MT_MAX_THREADS
+#define LZMA_MT_MAX_THREADS 64
+#endif
+
+/* blockSize = 0 selects LZMA_MT_BLOCK_SIZE, numThreads = 0 uses one thread per processor.
+   dest must hold lzma_mt_bound(srcLen, blockSize) bytes. */
+size_t lzma_mt_bound(size_t srcLen, uint32_t blockSize);
+int lzma_mt_encode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, const CLzmaEncProps* props, uint32_t blockSize, uint32_t numThreads);
+int lzma_mt_decoded_size(const uint8_t* src, size_t srcLen, size_t* size);
+int lzma_mt_decode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, uint32_t numThreads);
+
+// Seekable container
+
+/* Blocks of blockSize bytes compressed independently, back to back, followed by
+
+     numBlocks index entries { uint64_t offset, crc64 }
+     uint64_t size, indexCrc64
+     uint32_t blockSize, numBlocks
+     uint8_t  props[LZMA_PROPS_SIZE], padding up to 8 bytes
+     uint32_t magic
+
+   offset is where the block starts in the packed data, the CRC-64 is that of its
+   decoded bytes. A block that does not shrink is stored as is. Reading a range
+   only decodes the blocks it covers; the last few decoded blocks are kept. */
+#define LZMA_SEEK_MAGIC 0x534D5A4C /* "LZMS" */
+#define LZMA_SEEK_INDEX_ENTRY_SIZE 16
+#define LZMA_SEEK_FOOTER_SIZE 36
+
+/* Default block size, the unit a read decodes. */
+#ifndef LZMA_SEEK_BLOCK_SIZE
+#define LZMA_SEEK_BLOCK_SIZE ((uint32_t)1 << 20)
+#endif
+
+#ifndef LZMA_SEEK_CACHE_BLOCKS
+#define LZMA_SEEK_CACHE_BLOCKS 4
+#endif
+
+typedef struct _lzma_seek lzma_seek_t;
+
+/* blockSize = 0 selects LZMA_SEEK_BLOCK_SIZE, numThreads = 0 uses one thread per processor.
+   dest must hold lzma_seek_bound(srcLen, blockSize) bytes. */
+size_t lzma_seek_bound(size_t srcLen, uint32_t blockSize);
+int lzma_seek_encode(uint8_t* dest, size_t* destLen, const uint8_t* src, size_t srcLen, const CLzmaEncProps* props, uint32_t blockSize, uint32_t numThreads);
+
+/* The reader works on src in place, which must outlive it. cacheBlocks = 0 keeps
+   LZMA_SEEK_CACHE_BLOCKS decoded blocks. A reader is not to be shared between threads. */
+lzma_seek_t* lzma_seek_open(const uint8_t* src, size_t srcLen, uint32_t cacheBlocks);
+uint64_t lzma_seek_size(const lzma_seek_t* r);
+/* Reads up to len bytes from offset, *readLen is short only at the end of the data. */
+int lzma_seek_read_at(lzma_seek_t* r, uint64_t offset, uint8_t* dest, size_t len, size_t* readLen);
+void lzma_seek_close(lzma_seek_t* r);
+
 #endif // __SHARED_LZMA_H_
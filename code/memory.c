@@ -6,6 +6,45 @@ HANDLE __stdcall memory_process_heap(void)
 	return (HANDLE)fn_NtCurrentTeb()->ProcessEnvironmentBlock->ProcessHeap;
 }
 
+#ifdef MEMORY_STATS
+
+static void* volatile _memoryCurrent;
+static void* volatile _memoryPeak;
+
+/* delta is added modulo the size of size_t, a release passes its size negated. */
+static void memory_stats_add(size_t delta)
+{
+    void* old;
+    size_t cur, peak;
+
+    do {
+        old = _memoryCurrent;
+        cur = (size_t)old + delta;
+    } while (_InterlockedCompareExchangePointer(&_memoryCurrent, (void*)cur, old) != old);
+
+    do {
+        peak = (size_t)_memoryPeak;
+        if (cur <= peak) {
+            break;
+        }
+    } while (_InterlockedCompareExchangePointer(&_memoryPeak, (void*)cur, (void*)peak) != (void*)peak);
+}
+
+void __stdcall memory_stats(size_t* current, size_t* peak)
+{
+    *current = (size_t)_memoryCurrent;
+    *peak = (size_t)_memoryPeak;
+}
+
+void __stdcall memory_stats_reset(void)
+{
+    _memoryPeak = _memoryCurrent;
+}
+
+#define MEMORY_STATS_SIZE(ptr) fn_HeapSize(memory_process_heap(), 0, ptr)
+
+#endif // MEMORY_STATS
+
 void* __stdcall memory_alloc(size_t sz)
 {
     void* ptr;
@@ -17,6 +56,9 @@ void* __stdcall memory_alloc(size_t sz)
         fn_Sleep(1000);
     } while (1);
     
+#ifdef MEMORY_STATS
+    memory_stats_add(MEMORY_STATS_SIZE(ptr));
+#endif // MEMORY_STATS
     return ptr;
 }
 
@@ -34,14 +76,33 @@ void* __stdcall memory_aligned_alloc(size_t sz)
 
 void* __stdcall memory_realloc(void* ptr, size_t newSize)
 {
+#ifdef MEMORY_STATS
+    size_t oldSize;
+    void* newPtr;
+#endif // MEMORY_STATS
+
 	if (ptr == NULL) {
 		return memory_alloc(newSize);
 	}
+#ifdef MEMORY_STATS
+    oldSize = MEMORY_STATS_SIZE(ptr);
+    newPtr = fn_RtlReAllocateHeap(memory_process_heap(), HEAP_ZERO_MEMORY, ptr, newSize);
+    if (newPtr != NULL) {
+        memory_stats_add(MEMORY_STATS_SIZE(newPtr) - oldSize);
+    }
+    return newPtr;
+#else
 	return fn_RtlReAllocateHeap(memory_process_heap(), HEAP_ZERO_MEMORY, ptr, newSize);
+#endif // MEMORY_STATS
 }
 
 BOOLEAN __stdcall memory_free(void* ptr)
 {
+#ifdef MEMORY_STATS
+    if (ptr != NULL) {
+        memory_stats_add(0 - MEMORY_STATS_SIZE(ptr));
+    }
+#endif // MEMORY_STATS
 	return fn_RtlFreeHeap(memory_process_heap(), 0, ptr);
 }
 
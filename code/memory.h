@@ -8,5 +8,12 @@ BOOLEAN __stdcall memory_free(void* ptr);
 void* __stdcall memory_aligned_alloc(size_t sz);
 BOOLEAN __stdcall memory_aligned_free(void* ptr);
 
+#ifdef MEMORY_STATS
+/* Bytes held through the functions above, now and at most since the last
+   memory_stats_reset(), which starts the peak over from the current amount. */
+void __stdcall memory_stats(size_t* current, size_t* peak);
+void __stdcall memory_stats_reset(void);
+#endif // MEMORY_STATS
+
 
 #endif // __COMMON_CLIB_MEMORY_H_
@@ -18,6 +18,8 @@
 #include "win32stream.h"
 #include "win32service.h"
 #include "lzma.h"
+#include "lz.h"
+#include "compress.h"
 
 #include "zmodule_defs.h"
 #include "hipses.h"